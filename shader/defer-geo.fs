@@ -0,0 +1,21 @@
+#version 330 core
+
+in vec3 normal;
+in vec2 texCoord;
+in vec3 position;
+in vec4 instanceColor;
+
+layout (location = 0) out vec4 gAlbedoSpec;
+layout (location = 1) out vec4 gNormal;
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+};
+uniform Material material;
+
+void main() {
+    gAlbedoSpec.rgb = texture(material.diffuse, texCoord).rgb * instanceColor.rgb;
+    gAlbedoSpec.a = texture(material.specular, texCoord).r;
+    gNormal = vec4(normalize(normal), 1.0);
+}
\ No newline at end of file
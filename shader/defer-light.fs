@@ -0,0 +1,104 @@
+#version 330 core
+
+out vec4 fragColor;
+
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform vec2 screenSize;
+
+uniform vec3 viewPos;
+uniform float shininess;
+
+struct Light {
+    vec3 position;
+    vec3 attenuation;
+    vec3 direction;
+    vec2 cutoff;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+uniform Light light;
+
+// directional light, off when black
+uniform vec3 sunDirection;
+uniform vec3 sunColor;
+
+// 1.0 is lit: the main light's map and the sun's cascades, which sit
+// side by side in one map
+uniform sampler2DShadow spotShadowMap;
+uniform mat4 spotShadowTransform;
+uniform sampler2DShadow sunShadowMap;
+uniform mat4 sunShadowTransforms[3];
+
+float SpotShadow(vec3 position) {
+    vec4 coord = spotShadowTransform * vec4(position, 1.0);
+    if (coord.w <= 0.0)
+        return 1.0;
+    return texture(spotShadowMap, coord.xyz / coord.w);
+}
+
+float SunShadow(vec3 position) {
+    // the nearest cascade holding the point
+    for (int i = 0; i < 3; i++) {
+        vec3 coord = (sunShadowTransforms[i] * vec4(position, 1.0)).xyz;
+        if (all(greaterThan(coord, vec3(0.001))) && all(lessThan(coord, vec3(0.999))))
+            return texture(sunShadowMap, vec3((coord.x + float(i)) / 3.0, coord.yz));
+    }
+    return 1.0;
+}
+
+void main() {
+    vec2 uv = gl_FragCoord.xy / screenSize;
+    float depth = texture(gDepth, uv).r;
+    // nothing drawn here, keep the clear color
+    if (depth == 1.0)
+        discard;
+
+    vec4 worldPos = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec3 position = worldPos.xyz / worldPos.w;
+    vec4 albedoSpec = texture(gAlbedoSpec, uv);
+    vec3 texColor = albedoSpec.rgb;
+    vec3 pixelNorm = normalize(texture(gNormal, uv).xyz);
+
+    // same terms as lighting-3.fs
+    vec3 ambient = texColor * light.ambient;
+
+    float dist = length(light.position - position);
+    vec3 distPoly = vec3(1.0, dist, dist*dist);
+    float attenuation = 1.0 / dot(distPoly, light.attenuation);
+    vec3 lightDir = (light.position - position) / dist;
+
+    vec3 result = ambient;
+
+    float theta = dot(lightDir, normalize(-light.direction));
+    float intensity = clamp(
+        (theta - light.cutoff[1]) / (light.cutoff[0] - light.cutoff[1]),
+        0.0, 1.0);
+
+    if (intensity > 0.0) {
+        float diff = max(dot(pixelNorm, lightDir), 0.0);
+        vec3 diffuse = diff * texColor * light.diffuse;
+
+        vec3 viewDir = normalize(viewPos - position);
+        vec3 reflectDir = reflect(-lightDir, pixelNorm);
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+        vec3 specular = spec * albedoSpec.a * light.specular;
+
+        result += (diffuse + specular) * intensity * SpotShadow(position);
+    }
+
+    result *= attenuation;
+
+    if (any(greaterThan(sunColor, vec3(0.0)))) {
+        float diff = max(dot(pixelNorm, -sunDirection), 0.0);
+        vec3 viewDir = normalize(viewPos - position);
+        vec3 reflectDir = reflect(sunDirection, pixelNorm);
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+        result += (diff * texColor + spec * albedoSpec.a) * sunColor * SunShadow(position);
+    }
+
+    fragColor = vec4(result, 1.0);
+}
\ No newline at end of file
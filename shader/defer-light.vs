@@ -0,0 +1,8 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+
+void main() {
+    // the unit plane stretched over the screen
+    gl_Position = vec4(aPos.xy * 2.0, 0.0, 1.0);
+}
\ No newline at end of file
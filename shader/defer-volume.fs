@@ -0,0 +1,51 @@
+#version 330 core
+
+flat in vec4 lightPositionRadius;
+flat in vec3 lightColor;
+flat in vec4 lightDirectionInner;
+flat in vec4 lightAttenuationOuter;
+
+out vec4 fragColor;
+
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform vec2 screenSize;
+
+uniform vec3 viewPos;
+uniform float shininess;
+
+void main() {
+    vec2 uv = gl_FragCoord.xy / screenSize;
+    float depth = texture(gDepth, uv).r;
+    vec4 worldPos = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec3 position = worldPos.xyz / worldPos.w;
+
+    vec3 toLight = lightPositionRadius.xyz - position;
+    float dist = length(toLight);
+    if (depth == 1.0 || dist > lightPositionRadius.w)
+        discard;
+
+    vec3 lightDir = toLight / dist;
+    float theta = dot(lightDir, -lightDirectionInner.xyz);
+    float intensity = clamp(
+        (theta - lightAttenuationOuter.w) / (lightDirectionInner.w - lightAttenuationOuter.w),
+        0.0, 1.0);
+    if (intensity <= 0.0)
+        discard;
+
+    vec4 albedoSpec = texture(gAlbedoSpec, uv);
+    vec3 pixelNorm = normalize(texture(gNormal, uv).xyz);
+    float attenuation = 1.0 / dot(vec3(1.0, dist, dist*dist), lightAttenuationOuter.xyz);
+
+    float diff = max(dot(pixelNorm, lightDir), 0.0);
+    vec3 diffuse = diff * albedoSpec.rgb * lightColor;
+
+    vec3 viewDir = normalize(viewPos - position);
+    vec3 reflectDir = reflect(-lightDir, pixelNorm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    vec3 specular = spec * albedoSpec.a * lightColor;
+
+    fragColor = vec4((diffuse + specular) * intensity * attenuation, 1.0);
+}
\ No newline at end of file
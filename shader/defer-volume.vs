@@ -0,0 +1,27 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+
+// per-light attributes (glVertexAttribDivisor 1)
+layout (location = 3) in vec4 aPositionRadius;
+layout (location = 4) in vec4 aColor;
+layout (location = 5) in vec4 aDirectionInner;
+layout (location = 6) in vec4 aAttenuationOuter;
+
+uniform mat4 viewProjection;
+
+flat out vec4 lightPositionRadius;
+flat out vec3 lightColor;
+flat out vec4 lightDirectionInner;
+flat out vec4 lightAttenuationOuter;
+
+void main() {
+    // unit box around the light's range
+    vec3 worldPos = aPositionRadius.xyz + aPos * 2.0 * aPositionRadius.w;
+    gl_Position = viewProjection * vec4(worldPos, 1.0);
+
+    lightPositionRadius = aPositionRadius;
+    lightColor = aColor.rgb;
+    lightDirectionInner = aDirectionInner;
+    lightAttenuationOuter = aAttenuationOuter;
+}
\ No newline at end of file
@@ -0,0 +1,140 @@
+#version 330 core
+
+in vec3 normal;
+in vec2 texCoord;
+in vec3 position;
+in vec4 instanceColor;
+
+out vec4 fragColor;
+
+uniform vec3 viewPos;
+
+struct Light {
+    vec3 position;
+    vec3 attenuation;
+    vec3 direction;
+    vec2 cutoff;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+uniform Light light;
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+uniform Material material;
+
+// directional light, off when black
+uniform vec3 sunDirection;
+uniform vec3 sunColor;
+
+// 1.0 is lit: the main light's map and the sun's cascades, which sit
+// side by side in one map
+uniform sampler2DShadow spotShadowMap;
+uniform mat4 spotShadowTransform;
+uniform sampler2DShadow sunShadowMap;
+uniform mat4 sunShadowTransforms[3];
+
+float SpotShadow(vec3 position) {
+    vec4 coord = spotShadowTransform * vec4(position, 1.0);
+    if (coord.w <= 0.0)
+        return 1.0;
+    return texture(spotShadowMap, coord.xyz / coord.w);
+}
+
+float SunShadow(vec3 position) {
+    // the nearest cascade holding the point
+    for (int i = 0; i < 3; i++) {
+        vec3 coord = (sunShadowTransforms[i] * vec4(position, 1.0)).xyz;
+        if (all(greaterThan(coord, vec3(0.001))) && all(lessThan(coord, vec3(0.999))))
+            return texture(sunShadowMap, vec3((coord.x + float(i)) / 3.0, coord.yz));
+    }
+    return 1.0;
+}
+
+// local lights, 4 texels each: position + radius, color,
+// direction + cos inner, attenuation + cos outer
+uniform samplerBuffer lightData;
+// offset and count into lightIndices per froxel
+uniform usamplerBuffer clusters;
+uniform usamplerBuffer lightIndices;
+
+uniform mat4 view;
+uniform vec3 clusterCount;
+uniform vec2 tileScale;         // tiles per pixel
+uniform vec2 sliceScaleBias;    // slice = log(depth) * x + y
+
+vec3 ShadeLight(vec3 lightDir, vec3 pixelNorm, vec3 viewDir,
+    vec3 texColor, vec3 specColor, vec3 diffuseColor, vec3 specularColor) {
+    float diff = max(dot(pixelNorm, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, pixelNorm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    return diff * texColor * diffuseColor + spec * specColor * specularColor;
+}
+
+void main() {
+    vec3 texColor = texture(material.diffuse, texCoord).xyz * instanceColor.xyz;
+    vec3 specColor = texture(material.specular, texCoord).xyz;
+    vec3 pixelNorm = normalize(normal);
+    vec3 viewDir = normalize(viewPos - position);
+
+    // main light, as in lighting-3-instanced.fs
+    float dist = length(light.position - position);
+    float attenuation = 1.0 / dot(vec3(1.0, dist, dist*dist), light.attenuation);
+    vec3 lightDir = (light.position - position) / dist;
+    float theta = dot(lightDir, normalize(-light.direction));
+    float intensity = clamp(
+        (theta - light.cutoff[1]) / (light.cutoff[0] - light.cutoff[1]),
+        0.0, 1.0);
+
+    vec3 result = texColor * light.ambient;
+    if (intensity > 0.0) {
+        result += ShadeLight(lightDir, pixelNorm, viewDir, texColor, specColor,
+            light.diffuse, light.specular) * intensity * SpotShadow(position);
+    }
+    result *= attenuation;
+
+    if (any(greaterThan(sunColor, vec3(0.0)))) {
+        result += ShadeLight(-sunDirection, pixelNorm, viewDir, texColor, specColor,
+            sunColor, sunColor) * SunShadow(position);
+    }
+
+    // local lights binned into this fragment's froxel
+    float depth = -(view * vec4(position, 1.0)).z;
+    ivec3 cluster = ivec3(
+        ivec2(gl_FragCoord.xy * tileScale),
+        int(floor(log(max(depth, 1e-4)) * sliceScaleBias.x + sliceScaleBias.y)));
+    ivec3 count = ivec3(clusterCount);
+    cluster = clamp(cluster, ivec3(0), count - 1);
+    uvec2 range = texelFetch(clusters,
+        (cluster.z * count.y + cluster.y) * count.x + cluster.x).xy;
+
+    for (uint i = 0u; i < range.y; i++) {
+        int index = int(texelFetch(lightIndices, int(range.x + i)).r) * 4;
+        vec4 positionRadius = texelFetch(lightData, index);
+        vec4 color = texelFetch(lightData, index + 1);
+        vec4 directionInner = texelFetch(lightData, index + 2);
+        vec4 attenuationOuter = texelFetch(lightData, index + 3);
+
+        vec3 toLight = positionRadius.xyz - position;
+        float lightDist = length(toLight);
+        if (lightDist > positionRadius.w)
+            continue;
+        vec3 localDir = toLight / lightDist;
+        float localIntensity = clamp(
+            (dot(localDir, -directionInner.xyz) - attenuationOuter.w) /
+            (directionInner.w - attenuationOuter.w),
+            0.0, 1.0);
+        if (localIntensity <= 0.0)
+            continue;
+        float localAttenuation = 1.0 / dot(vec3(1.0, lightDist, lightDist*lightDist),
+            attenuationOuter.xyz);
+        result += ShadeLight(localDir, pixelNorm, viewDir, texColor, specColor,
+            color.rgb, color.rgb) * localIntensity * localAttenuation;
+    }
+
+    fragColor = vec4(result, 1.0);
+}
\ No newline at end of file
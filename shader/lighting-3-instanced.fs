@@ -0,0 +1,118 @@
+#version 330 core
+
+in vec3 normal;
+in vec2 texCoord;
+in vec3 position;
+in vec4 instanceColor;
+
+out vec4 fragColor;
+
+uniform vec3 viewPos;
+uniform vec3 lightPos;
+uniform vec3 lightColor;
+uniform vec3 objectColor;
+
+uniform float ambientStrength;
+uniform float specularStrength;
+uniform float specularShiniess;
+
+struct Light {
+    vec3 position;
+    vec3 attenuation;
+    vec3 direction;
+    // float cutoff;
+    vec2 cutoff;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+uniform Light light;
+
+struct Material {
+    vec3 ambient;
+
+    sampler2D diffuse;
+    sampler2D specular;
+
+    float shininess;
+};
+uniform Material material;
+
+// directional light, off when black
+uniform vec3 sunDirection;
+uniform vec3 sunColor;
+
+// 1.0 is lit: the main light's map and the sun's cascades, which sit
+// side by side in one map
+uniform sampler2DShadow spotShadowMap;
+uniform mat4 spotShadowTransform;
+uniform sampler2DShadow sunShadowMap;
+uniform mat4 sunShadowTransforms[3];
+
+float SpotShadow(vec3 position) {
+    vec4 coord = spotShadowTransform * vec4(position, 1.0);
+    if (coord.w <= 0.0)
+        return 1.0;
+    return texture(spotShadowMap, coord.xyz / coord.w);
+}
+
+float SunShadow(vec3 position) {
+    // the nearest cascade holding the point
+    for (int i = 0; i < 3; i++) {
+        vec3 coord = (sunShadowTransforms[i] * vec4(position, 1.0)).xyz;
+        if (all(greaterThan(coord, vec3(0.001))) && all(lessThan(coord, vec3(0.999))))
+            return texture(sunShadowMap, vec3((coord.x + float(i)) / 3.0, coord.yz));
+    }
+    return 1.0;
+}
+
+void main() {
+ 
+    vec3 texColor = texture2D(material.diffuse, texCoord).xyz * instanceColor.xyz;
+    vec3 ambient = texColor * light.ambient;
+
+    // vec3 lightDir = normalize(light.direction - position);
+    // vec3 lightDir = normalize(-light.direction);
+
+    float dist = length(light.position - position);
+    vec3 distPoly = vec3(1.0, dist, dist*dist);
+    float attenuation = 1.0 / dot(distPoly, light.attenuation);
+    vec3 lightDir = (light.position - position) / dist;
+
+    vec3 result = ambient;
+
+    float theta = dot(lightDir, normalize(-light.direction));
+    float intensity = clamp(
+        (theta - light.cutoff[1]) / (light.cutoff[0] - light.cutoff[1]),
+        0.0, 1.0);
+
+    // if (theta > light.cutoff) {
+    if (intensity > 0.0) {
+        vec3 pixelNorm = normalize(normal);
+        float diff = max(dot(pixelNorm, lightDir), 0.0);
+        vec3 diffuse = diff * texColor * light.diffuse;
+
+        vec3 specColor = texture2D(material.specular, texCoord).xyz;
+        vec3 viewDir = normalize(viewPos - position);
+        vec3 reflectDir = reflect(-lightDir, pixelNorm);
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+        vec3 specular = spec * specColor * light.specular;
+
+        // result += (diffuse + specular) ;
+        result += (diffuse + specular) * intensity * SpotShadow(position);
+    }
+
+    result *= attenuation;
+
+    if (any(greaterThan(sunColor, vec3(0.0)))) {
+        vec3 pixelNorm = normalize(normal);
+        float diff = max(dot(pixelNorm, -sunDirection), 0.0);
+        vec3 viewDir = normalize(viewPos - position);
+        vec3 reflectDir = reflect(sunDirection, pixelNorm);
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+        vec3 specColor = texture2D(material.specular, texCoord).xyz;
+        result += (diff * texColor + spec * specColor) * sunColor * SunShadow(position);
+    }
+
+    fragColor = vec4(result, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+
+// per-instance attributes (glVertexAttribDivisor 1)
+layout (location = 3) in mat4 aTransform;
+layout (location = 7) in mat4 aModelTransform;
+layout (location = 11) in vec4 aColor;
+layout (location = 12) in mat3 aNormalTransform;
+layout (location = 15) in uvec2 aLightRange;
+
+out vec3 normal;
+out vec2 texCoord;
+out vec3 position;
+out vec4 instanceColor;
+flat out uvec2 lightRange;
+
+void main() {
+    gl_Position = aTransform * vec4(aPos, 1.0);
+    normal = aNormalTransform * aNormal;
+    texCoord = aTexCoord;
+    position = (aModelTransform * vec4(aPos, 1.0)).xyz;
+    instanceColor = aColor;
+    lightRange = aLightRange;
+}
\ No newline at end of file
@@ -6,6 +6,7 @@ layout (location = 2) in vec2 aTexCoord;
 
 uniform mat4 transform;
 uniform mat4 modelTransform;
+uniform mat3 normalTransform;   // transpose(inverse(modelTransform)), computed on the cpu
 
 out vec3 normal;
 out vec2 texCoord;
@@ -13,7 +14,7 @@ out vec3 position;
 
 void main() {
     gl_Position = transform * vec4(aPos, 1.0);
-    normal = (transpose(inverse(modelTransform)) * vec4(aNormal, 0.0)).xyz;
+    normal = normalTransform * aNormal;
     texCoord = aTexCoord;
     position = (modelTransform * vec4(aPos, 1.0)).xyz;
 }
\ No newline at end of file
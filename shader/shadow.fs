@@ -0,0 +1,5 @@
+#version 330 core
+
+// depth only, written by the rasterizer
+void main() {
+}
\ No newline at end of file
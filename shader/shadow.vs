@@ -0,0 +1,10 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+
+// per-instance light space transform (glVertexAttribDivisor 1)
+layout (location = 3) in mat4 aTransform;
+
+void main() {
+    gl_Position = aTransform * vec4(aPos, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,4683 @@
+#include "engine.h"
+
+#define STB_IMAGE_IMPLEMENTATION    // added for link error
+#include <stb/stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h>
+
+void TraceCapture::Start(const std::string& filename, int frameCount) {
+    auto& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.filename = filename;
+    state.framesLeft = frameCount;
+    state.start = Clock::now();
+    state.events.clear();
+    state.threads.clear();
+    state.threads[std::this_thread::get_id()] = 0;
+    state.capturing = true;
+}
+
+void TraceCapture::EndFrame() {
+    auto& state = GetState();
+    if (!state.capturing)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (--state.framesLeft > 0)
+            return;
+    }
+    Stop();
+}
+
+void TraceCapture::Stop() {
+    auto& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (!state.capturing)
+        return;
+    state.capturing = false;
+
+    std::ofstream fout(state.filename);
+    if (!fout.is_open()) {
+        SPDLOG_ERROR("failed to write trace: {}", state.filename);
+        return;
+    }
+    // ts and dur are in microseconds
+    auto micros = [&](Clock::time_point time) {
+        return std::chrono::duration<double, std::micro>(time - state.start).count();
+    };
+    fout << "{\"traceEvents\":[\n";
+    for (auto& thread: state.threads) {
+        fout << fmt::format(
+            "{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},"
+            "\"args\":{{\"name\":\"{}\"}}}},\n",
+            thread.second, thread.second == 0 ? "main" : fmt::format("worker {}", thread.second));
+    }
+    for (size_t i = 0; i < state.events.size(); i++) {
+        auto& event = state.events[i];
+        fout << fmt::format(
+            "{{\"name\":\"{}\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":1,\"tid\":{}}}{}\n",
+            event.name, micros(event.begin), micros(event.end) - micros(event.begin),
+            event.thread, i + 1 < state.events.size() ? "," : "");
+    }
+    fout << "],\"displayTimeUnit\":\"ms\"}\n";
+    SPDLOG_INFO("trace written: {}, {} events", state.filename, state.events.size());
+    state.events.clear();
+}
+
+void TraceCapture::AddEvent(const char* name, Clock::time_point begin, Clock::time_point end) {
+    auto& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (!state.capturing)
+        return;
+    auto thread = state.threads.emplace(std::this_thread::get_id(), (int)state.threads.size());
+    state.events.push_back({ name, begin, end, thread.first->second });
+}
+
+
+
+FrameArena& FrameArena::Get() {
+    static thread_local FrameArena arena;
+    return arena;
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment) {
+    // the rest of a block too small for the request is skipped
+    while (m_block < m_blocks.size()) {
+        auto& block = m_blocks[m_block];
+        auto base = (uintptr_t)block.data.get();
+        auto aligned = (base + m_offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (aligned + size <= base + block.size) {
+            m_offset = aligned + size - base;
+            return (void*)aligned;
+        }
+        m_block++;
+        m_offset = 0;
+    }
+
+    size_t blockSize = std::max((size_t)BlockSize, size + alignment);
+    m_blocks.push_back({ std::unique_ptr<uint8_t[]>(new uint8_t[blockSize]), blockSize });
+    m_block = m_blocks.size() - 1;
+    m_offset = 0;
+    return Allocate(size, alignment);
+}
+
+void FrameArena::Reset() {
+    m_peak = std::max(m_peak, GetUsed());
+    m_block = 0;
+    m_offset = 0;
+}
+
+size_t FrameArena::GetUsed() const {
+    size_t used = m_offset;
+    for (size_t i = 0; i < m_block && i < m_blocks.size(); i++)
+        used += m_blocks[i].size;
+    return used;
+}
+
+size_t FrameArena::GetCapacity() const {
+    size_t capacity = 0;
+    for (auto& block: m_blocks)
+        capacity += block.size;
+    return capacity;
+}
+
+
+
+double GetTime() {
+    static auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int FrameClock::Advance(double time) {
+    if (m_lastTime < 0.0)
+        m_lastTime = time;
+    m_accumulator += std::max(time - m_lastTime, 0.0);
+    m_lastTime = time;
+    int steps = (int)(m_accumulator / m_stepTime);
+    if (steps > m_maxSteps) {
+        steps = m_maxSteps;
+        m_accumulator = fmod(m_accumulator, m_stepTime);
+        return steps;
+    }
+    m_accumulator -= steps * m_stepTime;
+    return steps;
+}
+
+optional<string> LoadTextFile(const string& filename) {
+    ifstream fin(filename);
+    if (!fin.is_open()) {
+        SPDLOG_ERROR("failed to open file: {}", filename);
+        return {};
+    }
+
+    stringstream text;
+    text << fin.rdbuf();
+    return text.str();
+}
+
+glm::vec3 GetAttenuationCoeff(float distance) {
+    const auto linear_coeff = glm::vec4(
+        8.4523112e-05,
+        4.4712582e+00,
+        -1.8516388e+00,
+        3.3955811e+01
+    );
+    const auto quad_coeff = glm::vec4(
+        -7.6103583e-04,
+        9.0120201e+00,
+        -1.1618500e+01,
+        1.0000464e+02
+    );
+
+    float kc = 1.0f;
+    float d = 1.0f / distance;
+    auto dvec = glm::vec4(1.0f, d, d*d, d*d*d);
+    float kl = glm::dot(linear_coeff, dvec);
+    float kq = glm::dot(quad_coeff, dvec);
+    
+    return glm::vec3(kc, glm::max(kl, 0.0f), glm::max(kq*kq, 0.0f));
+}
+
+BoundingBox ComputeBoundingBox(const Vertex* vertices, size_t count) {
+    BoundingBox box;
+    for (size_t i = 0; i < count; i++)
+        box.Expand(vertices[i].position);
+    return box;
+}
+
+BoundingSphere ComputeBoundingSphere(const Vertex* vertices, size_t count,
+    const BoundingBox& box) {
+    BoundingSphere sphere;
+    if (!box.IsValid())
+        return sphere;
+    sphere.center = box.GetCenter();
+    float radiusSq = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        auto d = vertices[i].position - sphere.center;
+        radiusSq = std::max(radiusSq, glm::dot(d, d));
+    }
+    sphere.radius = sqrtf(radiusSq);
+    return sphere;
+}
+
+glm::mat3 ComputeNormalMatrix(const glm::mat4& m) {
+    auto c0 = glm::vec3(m[0]);
+    auto c1 = glm::vec3(m[1]);
+    auto c2 = glm::vec3(m[2]);
+    float scaleSq = glm::dot(c0, c0);
+    const float epsilon = 1e-5f * scaleSq;
+    if (fabsf(glm::dot(c1, c1) - scaleSq) <= epsilon &&
+        fabsf(glm::dot(c2, c2) - scaleSq) <= epsilon &&
+        fabsf(glm::dot(c0, c1)) <= epsilon &&
+        fabsf(glm::dot(c0, c2)) <= epsilon &&
+        fabsf(glm::dot(c1, c2)) <= epsilon && scaleSq > 0.0f) {
+        return glm::mat3(c0, c1, c2) * (1.0f / scaleSq);
+    }
+    return glm::transpose(glm::inverse(glm::mat3(m)));
+}
+
+bool IsMultiDrawIndirectSupported() {
+    return GLAD_GL_VERSION_4_3 ||
+        (GLAD_GL_ARB_multi_draw_indirect && GLAD_GL_ARB_base_instance);
+}
+
+bool IsBufferStorageSupported() {
+    return GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+}
+
+
+
+ShaderUPtr Shader::CreateFromFile(const std::string& filename, GLenum shaderType) {
+    auto shader = std::unique_ptr<Shader>(new Shader());
+    if (!shader->LoadFile(filename, shaderType))
+        return nullptr;
+    return std::move(shader);
+}
+
+bool Shader::LoadFile(const std::string& filename, GLenum shaderType) {
+    auto result = LoadTextFile(filename);
+    if (!result.has_value()) {
+        return false;
+    }
+
+    auto& code = result.value();
+    const char* codePtr = code.c_str();
+    int32_t codeLength = (int32_t)code.length();
+
+    // create and compile shader
+    m_shader = glCreateShader(shaderType);
+    glShaderSource(m_shader, 1, (const GLchar* const*)&codePtr, &codeLength);
+    glCompileShader(m_shader);
+
+    // check compile error
+    int success = 0;
+    glGetShaderiv(m_shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char infoLog[1024];
+        glGetShaderInfoLog(m_shader, 1024, nullptr, infoLog);
+        SPDLOG_ERROR("failed to compile shader: \"{}\"", filename);
+        SPDLOG_ERROR("reason: {}", infoLog);
+        return false;
+    }
+    return true;
+}
+
+Shader::~Shader() {
+    if (m_shader) {
+        glDeleteShader(m_shader);
+    }
+}
+
+
+
+ProgramUPtr Program::Create(const std::vector<ShaderPtr>& shaders) {
+    auto program = ProgramUPtr(new Program());
+    if (!program->Link(shaders))
+        return nullptr;
+    return std::move(program);
+}
+
+ProgramUPtr Program::Create(const std::string& vertShaderFilename,
+    const std::string& fragShaderFilename) {
+    TRACE_SCOPE("Program::Create");
+    ShaderPtr vs = Shader::CreateFromFile(vertShaderFilename, GL_VERTEX_SHADER);
+    ShaderPtr fs = Shader::CreateFromFile(fragShaderFilename, GL_FRAGMENT_SHADER);
+    if (!vs || !fs)
+        return nullptr;
+    return std::move(Create({vs, fs}));
+}
+
+bool Program::Link(const std::vector<ShaderPtr>& shaders) {
+    m_program = glCreateProgram();
+    for (auto& shader: shaders)
+        glAttachShader(m_program, shader->Get());
+    glLinkProgram(m_program);
+
+    int success = 0;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infoLog[1024];
+        glGetProgramInfoLog(m_program, 1024, nullptr, infoLog);
+        SPDLOG_ERROR("failed to link program: {}", infoLog);
+        return false;
+    }
+
+    return true;
+}
+
+Program::~Program() {
+    if (m_program) {
+        glDeleteProgram(m_program);
+    }
+}
+
+void Program::Use() const {
+    glUseProgram(m_program);
+}
+
+void Program::SetUniform(const char* name, int value) const {
+    auto loc = glGetUniformLocation(m_program, name);
+    glUniform1i(loc, value);
+}
+
+void Program::SetUniform(const char* name, const glm::mat4& value) const {
+    auto loc = glGetUniformLocation(m_program, name);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Program::SetUniform(const char* name, const glm::mat3& value) const {
+    auto loc = glGetUniformLocation(m_program, name);
+    glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Program::SetUniform(const char* name, float value) const {
+    auto loc = glGetUniformLocation(m_program, name);
+    glUniform1f(loc, value);
+}
+
+void Program::SetUniform(const char* name, const glm::vec2& value) const {
+    auto loc = glGetUniformLocation(m_program, name);
+    glUniform2fv(loc, 1, glm::value_ptr(value));
+}
+
+void Program::SetUniform(const char* name, const glm::vec3& value) const {
+    auto loc = glGetUniformLocation(m_program, name);
+    glUniform3fv(loc, 1, glm::value_ptr(value));
+}
+
+void Program::SetUniform(const char* name, const glm::vec4& value) const {
+    auto loc = glGetUniformLocation(m_program, name);
+    glUniform4fv(loc, 1, glm::value_ptr(value));
+}
+
+
+
+BufferUPtr Buffer::CreateWithData( uint32_t bufferType, uint32_t usage,
+    // const void* data, size_t dataSize) {
+    const void* data, size_t stride, size_t count) {
+    
+    auto buffer = BufferUPtr(new Buffer());
+    // if (!buffer->Init(bufferType, usage, data, dataSize))
+    if (!buffer->Init(bufferType, usage, data, stride, count))
+        return nullptr;
+    return std::move(buffer);
+}
+
+Buffer::~Buffer() {
+    if (m_buffer) {
+        glDeleteBuffers(1, &m_buffer);
+    }
+}
+
+void Buffer::Bind() const {
+    glBindBuffer(m_bufferType, m_buffer);
+}
+
+void Buffer::UpdateData(const void* data, size_t count) {
+    // respecify the whole store so the driver can orphan the old one
+    // instead of waiting for draws still reading it
+    m_count = count;
+    Bind();
+    glBufferData(m_bufferType, m_stride * m_count, data, m_usage);
+}
+
+bool Buffer::Init(
+    uint32_t bufferType, uint32_t usage,
+    // const void* data, size_t dataSize) {
+    const void* data, size_t stride, size_t count) {
+        
+    m_bufferType = bufferType;
+    m_usage = usage;
+
+    m_stride = stride;
+    m_count = count;
+
+    glGenBuffers(1, &m_buffer);
+    Bind();
+    // glBufferData(m_bufferType, dataSize, data, usage);
+    glBufferData(m_bufferType, m_stride * m_count, data, usage);
+    return true;
+}
+
+
+
+StreamBufferUPtr StreamBuffer::Create(size_t regionSize) {
+    auto streamBuffer = StreamBufferUPtr(new StreamBuffer());
+    streamBuffer->m_persistent = IsBufferStorageSupported();
+    if (!streamBuffer->Init(regionSize))
+        return nullptr;
+    SPDLOG_INFO("stream buffer: {}", streamBuffer->m_persistent ?
+        "persistent mapped ring" : "orphaning");
+    return std::move(streamBuffer);
+}
+
+StreamBuffer::~StreamBuffer() {
+    Release();
+}
+
+bool StreamBuffer::Init(size_t regionSize) {
+    // regions start aligned for any use of the offsets
+    m_regionSize = (regionSize + 255) & ~(size_t)255;
+    m_region = 0;
+    m_offset = 0;
+
+    // the copy target leaves the bindings of draws alone
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    if (!m_persistent) {
+        glBufferData(GL_COPY_WRITE_BUFFER, m_regionSize, nullptr, GL_STREAM_DRAW);
+        return true;
+    }
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, m_regionSize * RegionCount, nullptr, flags);
+    m_mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0,
+        m_regionSize * RegionCount, flags);
+    if (!m_mapped) {
+        SPDLOG_ERROR("failed to map stream buffer");
+        return false;
+    }
+    return true;
+}
+
+void StreamBuffer::Release() {
+    for (auto& fence: m_fences) {
+        if (fence)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (m_mapped) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        m_mapped = nullptr;
+    }
+    if (m_buffer) {
+        glDeleteBuffers(1, &m_buffer);
+        m_buffer = 0;
+    }
+}
+
+void StreamBuffer::BeginFrame() {
+    m_offset = 0;
+    if (!m_persistent) {
+        // the draws of earlier frames keep reading the old storage
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, m_regionSize, nullptr, GL_STREAM_DRAW);
+        return;
+    }
+
+    auto& fence = m_fences[m_region];
+    if (!fence)
+        return;
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        m_stallCount++;
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+            ;
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void StreamBuffer::Reserve(size_t size) {
+    if (m_offset + size <= m_regionSize)
+        return;
+
+    // a new buffer the size of this frame's writes at least, queued draws
+    // hold on to the old one until they are done
+    size_t regionSize = m_regionSize;
+    while (regionSize < m_offset + size)
+        regionSize *= 2;
+    int region = m_region;
+    Release();
+    Init(regionSize);
+    m_region = region;
+    SPDLOG_INFO("stream buffer grown to {} KB per region", m_regionSize / 1024);
+}
+
+size_t StreamBuffer::Write(const void* data, size_t size, size_t alignment) {
+    m_offset = (m_offset + alignment - 1) & ~(alignment - 1);
+    Reserve(size);
+    size_t offset = m_offset;
+    m_offset += size;
+
+    if (m_persistent) {
+        offset += m_regionSize * m_region;
+        memcpy(m_mapped + offset, data, size);
+        return offset;
+    }
+
+    // nothing of the orphaned storage is read before this frame's draws
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    auto mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (mapped) {
+        memcpy(mapped, data, size);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    }
+    return offset;
+}
+
+void StreamBuffer::EndFrame() {
+    if (!m_persistent)
+        return;
+    m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_region = (m_region + 1) % RegionCount;
+}
+
+
+
+VertexLayoutUPtr VertexLayout::Create() {
+    auto vertexLayout = VertexLayoutUPtr(new VertexLayout());
+    vertexLayout->Init();
+    return std::move(vertexLayout);
+}
+
+VertexLayout::~VertexLayout() {
+    if (m_vertexArrayObject) {
+        glDeleteVertexArrays(1, &m_vertexArrayObject);
+    }
+}
+
+void VertexLayout::Bind() const {
+    glBindVertexArray(m_vertexArrayObject);
+}
+
+void VertexLayout::SetAttrib(
+    uint32_t attribIndex, int count,
+    uint32_t type, bool normalized,
+    size_t stride, uint64_t offset) const {
+        
+    glEnableVertexAttribArray(attribIndex);
+    glVertexAttribPointer(attribIndex, count,
+        type, normalized, stride, (const void*)offset);
+}
+
+void VertexLayout::SetIntAttrib(
+    uint32_t attribIndex, int count, uint32_t type,
+    size_t stride, uint64_t offset) const {
+
+    glEnableVertexAttribArray(attribIndex);
+    glVertexAttribIPointer(attribIndex, count, type, stride, (const void*)offset);
+}
+
+void VertexLayout::DisableAttrib(int attribIndex) const {
+    glDisableVertexAttribArray(attribIndex);
+}
+
+void VertexLayout::SetAttribDivisor(uint32_t attribIndex, uint32_t divisor) const {
+    glVertexAttribDivisor(attribIndex, divisor);
+}
+
+void VertexLayout::Init() {
+    glGenVertexArrays(1, &m_vertexArrayObject);
+    Bind();
+}
+
+
+
+void SetVertexAttribs(const VertexLayout* layout) {
+    layout->SetAttrib(0, 3, GL_FLOAT, false, sizeof(Vertex), 0);
+    layout->SetAttrib(1, 3, GL_FLOAT, false, sizeof(Vertex), 
+        offsetof(Vertex, normal));
+    layout->SetAttrib(2, 2, GL_FLOAT, false, sizeof(Vertex), 
+        offsetof(Vertex, texCoord));
+}
+
+void SetInstanceAttribs(const VertexLayout* layout,
+    uint32_t instanceBuffer, uint64_t offset) {
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    uint64_t base = offset;
+    for (uint32_t i = 0; i < 4; i++) {
+        layout->SetAttrib(3 + i, 4, GL_FLOAT, false, sizeof(InstanceData),
+            base + offsetof(InstanceData, transform) + sizeof(glm::vec4) * i);
+        layout->SetAttribDivisor(3 + i, 1);
+        layout->SetAttrib(7 + i, 4, GL_FLOAT, false, sizeof(InstanceData),
+            base + offsetof(InstanceData, modelTransform) + sizeof(glm::vec4) * i);
+        layout->SetAttribDivisor(7 + i, 1);
+    }
+    layout->SetAttrib(11, 4, GL_FLOAT, false, sizeof(InstanceData),
+        base + offsetof(InstanceData, color));
+    layout->SetAttribDivisor(11, 1);
+    for (uint32_t i = 0; i < 3; i++) {
+        layout->SetAttrib(12 + i, 3, GL_FLOAT, false, sizeof(InstanceData),
+            base + offsetof(InstanceData, normalTransform) + sizeof(glm::vec3) * i);
+        layout->SetAttribDivisor(12 + i, 1);
+    }
+    layout->SetIntAttrib(15, 2, GL_UNSIGNED_INT, sizeof(InstanceData),
+        base + offsetof(InstanceData, lightRange));
+    layout->SetAttribDivisor(15, 1);
+}
+
+
+
+ImageUPtr Image::Load(const std::string& filepath) {
+    auto image = ImageUPtr(new Image());
+    if (!image->LoadWithStb(filepath))
+        return nullptr;
+    return std::move(image);
+}
+
+ImageUPtr Image::Create(int width, int height, int channelCount) {
+    auto image = ImageUPtr(new Image());
+    if (!image->Allocate(width, height, channelCount))
+        return nullptr;
+    return std::move(image);
+}
+
+ImageUPtr Image::CreateSingleColorImage(int width, int height, const glm::vec4& color) {
+    glm::vec4 clamped = glm::clamp(color * 255.0f, 0.0f, 255.0f);
+    uint8_t rgba[4] = {
+        (uint8_t)clamped.r, 
+        (uint8_t)clamped.g, 
+        (uint8_t)clamped.b, 
+        (uint8_t)clamped.a, 
+    };
+    auto image = Create(width, height, 4);
+    for (int i = 0; i < width * height; i++) {
+        memcpy(image->m_data + 4 * i, rgba, 4);
+    }
+    return std::move(image);
+}
+
+Image::~Image() {
+    if (m_data) {
+        stbi_image_free(m_data);
+    }
+}
+
+void Image::SetCheckImage(int gridX, int gridY) {
+    for (int j = 0; j < m_height; j++) {
+        for (int i = 0; i < m_width; i++) {
+            int pos = (j * m_width + i) * m_channelCount;
+            bool even = ((i / gridX) + (j / gridY)) % 2 == 0;
+            uint8_t value = even ? 255 : 0;
+            for (int k = 0; k < m_channelCount; k++)
+                m_data[pos + k] = value;
+            if (m_channelCount > 3)
+                m_data[3] = 255;
+        }
+    }
+}
+
+bool Image::LoadWithStb(const std::string& filepath) {
+    stbi_set_flip_vertically_on_load(true);
+    m_data = stbi_load(filepath.c_str(), &m_width, &m_height, &m_channelCount, 0);
+    if (!m_data) {
+        SPDLOG_ERROR("failed to load image: {}", filepath);
+        return false;
+    }
+    return true;
+}
+
+bool Image::Allocate(int width, int height, int channelCount) {
+    m_width = width;
+    m_height = height;
+    m_channelCount = channelCount;
+    m_data = (uint8_t*)malloc(m_width * m_height * m_channelCount);
+    return m_data ? true : false;
+}
+
+
+
+TextureUPtr Texture::CreateFromImage(const Image* image) {
+    auto texture = TextureUPtr(new Texture());
+    texture->CreateTexture();
+    texture->SetTextureFromImage(image);
+    return std::move(texture);
+}
+
+TextureUPtr Texture::Create(int width, int height, uint32_t format, uint32_t type) {
+    auto texture = TextureUPtr(new Texture());
+    texture->CreateTexture();
+    texture->SetTextureFormat(width, height, format, type);
+    texture->SetFilter(GL_NEAREST, GL_NEAREST);
+    return std::move(texture);
+}
+
+Texture::~Texture() {
+    if (m_texture) {
+        glDeleteTextures(1, &m_texture);
+    }
+}
+
+void Texture::Bind() const {
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+}
+
+void Texture::SetFilter(uint32_t minFilter, uint32_t magFilter) const {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+}
+
+void Texture::SetWrap(uint32_t sWrap, uint32_t tWrap) const {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sWrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, tWrap);
+}
+
+void Texture::CreateTexture() {
+    glGenTextures(1, &m_texture);
+    // bind and set default filter and wrap option
+    Bind();
+    SetFilter(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR);
+    SetWrap(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+}
+
+void Texture::SetTextureFromImage(const Image* image) {
+    GLenum format = GL_RGBA;
+    switch (image->GetChannelCount()) {
+        default: break;
+        case 1: format = GL_RED; break;
+        case 2: format = GL_RG; break;
+        case 3: format = GL_RGB; break;
+    }
+    
+    m_width = image->GetWidth();
+    m_height = image->GetHeight();
+    m_format = GL_RGBA;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+        image->GetWidth(), image->GetHeight(), 0,
+        format, GL_UNSIGNED_BYTE,
+        image->GetData());
+
+    glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+void Texture::SetTextureFormat(int width, int height, uint32_t format, uint32_t type) {
+    m_width = width;
+    m_height = height;
+    m_format = format;
+
+    // pixel transfer format matching the internal format
+    GLenum imageFormat = GL_RGBA;
+    switch (format) {
+        default: break;
+        case GL_DEPTH_COMPONENT16:
+        case GL_DEPTH_COMPONENT24:
+        case GL_DEPTH_COMPONENT32F: imageFormat = GL_DEPTH_COMPONENT; break;
+        case GL_DEPTH24_STENCIL8: imageFormat = GL_DEPTH_STENCIL; break;
+        case GL_R8:
+        case GL_R16F:
+        case GL_R32F: imageFormat = GL_RED; break;
+        case GL_RG8:
+        case GL_RG16F:
+        case GL_RG32F: imageFormat = GL_RG; break;
+        case GL_RGB8:
+        case GL_RGB16F:
+        case GL_RGB32F: imageFormat = GL_RGB; break;
+    }
+
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0,
+        imageFormat, type, nullptr);
+}
+
+
+
+BufferTextureUPtr BufferTexture::Create(uint32_t format, size_t stride) {
+    auto texture = BufferTextureUPtr(new BufferTexture());
+    if (!texture->Init(format, stride))
+        return nullptr;
+    return std::move(texture);
+}
+
+BufferTexture::~BufferTexture() {
+    if (m_texture) {
+        glDeleteTextures(1, &m_texture);
+    }
+}
+
+void BufferTexture::Bind() const {
+    glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+}
+
+void BufferTexture::UpdateData(const void* data, size_t count) {
+    // an empty store can't back a texture, keep at least one element
+    m_buffer->UpdateData(count ? data : nullptr, std::max(count, (size_t)1));
+}
+
+bool BufferTexture::Init(uint32_t format, size_t stride) {
+    m_buffer = Buffer::CreateWithData(GL_TEXTURE_BUFFER, GL_STREAM_DRAW,
+        nullptr, stride, 1);
+    if (!m_buffer)
+        return false;
+    glGenTextures(1, &m_texture);
+    Bind();
+    glTexBuffer(GL_TEXTURE_BUFFER, format, m_buffer->Get());
+    return true;
+}
+
+
+
+FramebufferUPtr Framebuffer::Create(const std::vector<TexturePtr>& colorAttachments,
+    TexturePtr depthStencilAttachment) {
+    auto framebuffer = FramebufferUPtr(new Framebuffer());
+    if (!framebuffer->InitWithAttachments(colorAttachments, depthStencilAttachment))
+        return nullptr;
+    return std::move(framebuffer);
+}
+
+Framebuffer::~Framebuffer() {
+    if (m_depthStencilBuffer) {
+        glDeleteRenderbuffers(1, &m_depthStencilBuffer);
+    }
+    if (m_framebuffer) {
+        glDeleteFramebuffers(1, &m_framebuffer);
+    }
+}
+
+void Framebuffer::BindToDefault() {
+    glBindFramebuffer(GL_FRAMEBUFFER, s_defaultFramebuffer);
+}
+
+void Framebuffer::Bind() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+}
+
+bool Framebuffer::InitWithAttachments(const std::vector<TexturePtr>& colorAttachments,
+    TexturePtr depthStencilAttachment) {
+    m_colorAttachments = colorAttachments;
+    m_depthStencilAttachment = depthStencilAttachment;
+    glGenFramebuffers(1, &m_framebuffer);
+    Bind();
+
+    std::vector<GLenum> drawBuffers;
+    for (size_t i = 0; i < m_colorAttachments.size(); i++) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + (GLenum)i,
+            GL_TEXTURE_2D, m_colorAttachments[i]->Get(), 0);
+        drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + (GLenum)i);
+    }
+    if (drawBuffers.empty()) {
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+    else {
+        glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+    }
+
+    if (m_depthStencilAttachment) {
+        auto attachment = m_depthStencilAttachment->GetFormat() == GL_DEPTH24_STENCIL8 ?
+            GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment,
+            GL_TEXTURE_2D, m_depthStencilAttachment->Get(), 0);
+    }
+    else if (!m_colorAttachments.empty()) {
+        auto& color = m_colorAttachments[0];
+        glGenRenderbuffers(1, &m_depthStencilBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_depthStencilBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8,
+            color->GetWidth(), color->GetHeight());
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+            GL_RENDERBUFFER, m_depthStencilBuffer);
+    }
+
+    auto result = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    BindToDefault();
+    if (result != GL_FRAMEBUFFER_COMPLETE) {
+        SPDLOG_ERROR("failed to create framebuffer: 0x{:04x}", result);
+        return false;
+    }
+    return true;
+}
+
+
+
+// index of the lowest / highest set bit of a non-zero mask
+static uint32_t LowestBit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (uint32_t)index;
+#else
+    return (uint32_t)__builtin_ctz(mask);
+#endif
+}
+
+static uint32_t HighestBit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return (uint32_t)index;
+#else
+    return 31 - (uint32_t)__builtin_clz(mask);
+#endif
+}
+
+// sizes below SubBinCount have a bin each, larger ones are binned by their
+// highest bit and the SubBinShift bits below it, rounding down
+uint32_t OffsetAllocator::GetBin(uint32_t size) {
+    if (size < SubBinCount)
+        return size;
+    uint32_t high = HighestBit(size);
+    uint32_t level = high - SubBinShift + 1;
+    uint32_t sub = (size >> (high - SubBinShift)) & (SubBinCount - 1);
+    return level * SubBinCount + sub;
+}
+
+void OffsetAllocator::Reset(uint32_t size) {
+    m_nodes.clear();
+    m_unusedNodes.clear();
+    m_firstLevelMask = 0;
+    memset(m_secondLevelMasks, 0, sizeof(m_secondLevelMasks));
+    for (auto& bin: m_bins)
+        bin = InvalidNode;
+    m_size = size;
+    m_freeSize = size;
+    m_head = NewNode(0, size);
+    if (size > 0)
+        InsertFree(m_head);
+}
+
+uint32_t OffsetAllocator::NewNode(uint32_t offset, uint32_t size) {
+    uint32_t node;
+    if (!m_unusedNodes.empty()) {
+        node = m_unusedNodes.back();
+        m_unusedNodes.pop_back();
+        m_nodes[node] = Node();
+    }
+    else {
+        node = (uint32_t)m_nodes.size();
+        m_nodes.push_back(Node());
+    }
+    m_nodes[node].offset = offset;
+    m_nodes[node].size = size;
+    return node;
+}
+
+void OffsetAllocator::InsertFree(uint32_t node) {
+    uint32_t bin = GetBin(m_nodes[node].size);
+    m_nodes[node].used = false;
+    m_nodes[node].binPrev = InvalidNode;
+    m_nodes[node].binNext = m_bins[bin];
+    if (m_bins[bin] != InvalidNode)
+        m_nodes[m_bins[bin]].binPrev = node;
+    m_bins[bin] = node;
+    m_firstLevelMask |= 1u << (bin / SubBinCount);
+    m_secondLevelMasks[bin / SubBinCount] |= 1u << (bin % SubBinCount);
+}
+
+void OffsetAllocator::RemoveFree(uint32_t node) {
+    auto& n = m_nodes[node];
+    if (n.binPrev != InvalidNode) {
+        m_nodes[n.binPrev].binNext = n.binNext;
+    }
+    else {
+        uint32_t bin = GetBin(n.size);
+        m_bins[bin] = n.binNext;
+        if (m_bins[bin] == InvalidNode) {
+            uint32_t level = bin / SubBinCount;
+            m_secondLevelMasks[level] &= ~(1u << (bin % SubBinCount));
+            if (!m_secondLevelMasks[level])
+                m_firstLevelMask &= ~(1u << level);
+        }
+    }
+    if (n.binNext != InvalidNode)
+        m_nodes[n.binNext].binPrev = n.binPrev;
+    n.binPrev = InvalidNode;
+    n.binNext = InvalidNode;
+}
+
+uint32_t OffsetAllocator::Allocate(uint32_t size) {
+    if (size == 0 || size > m_freeSize)
+        return InvalidNode;
+
+    // the first bin whose every range fits: round the size up to the
+    // next bin boundary before binning it
+    uint64_t rounded = size;
+    if (size >= SubBinCount)
+        rounded += (1ull << (HighestBit(size) - SubBinShift)) - 1;
+    uint32_t bin = GetBin((uint32_t)std::min<uint64_t>(rounded, UINT32_MAX));
+    uint32_t level = bin / SubBinCount;
+    uint32_t subMask = m_secondLevelMasks[level] & (~0u << (bin % SubBinCount));
+    if (!subMask) {
+        uint32_t levelMask = level + 1 < LevelCount ?
+            m_firstLevelMask & (~0u << (level + 1)) : 0;
+        if (!levelMask)
+            return InvalidNode;
+        level = LowestBit(levelMask);
+        subMask = m_secondLevelMasks[level];
+    }
+    uint32_t node = m_bins[level * SubBinCount + LowestBit(subMask)];
+    RemoveFree(node);
+
+    // the rest of the range stays free behind it
+    if (m_nodes[node].size > size) {
+        uint32_t rest = NewNode(m_nodes[node].offset + size, m_nodes[node].size - size);
+        m_nodes[rest].prev = node;
+        m_nodes[rest].next = m_nodes[node].next;
+        if (m_nodes[node].next != InvalidNode)
+            m_nodes[m_nodes[node].next].prev = rest;
+        m_nodes[node].next = rest;
+        m_nodes[node].size = size;
+        InsertFree(rest);
+    }
+    m_nodes[node].used = true;
+    m_freeSize -= size;
+    return node;
+}
+
+void OffsetAllocator::Free(uint32_t node) {
+    if (node == InvalidNode)
+        return;
+    m_freeSize += m_nodes[node].size;
+
+    // merges with free neighbors, the one in front keeps its node
+    uint32_t prev = m_nodes[node].prev;
+    if (prev != InvalidNode && !m_nodes[prev].used) {
+        RemoveFree(prev);
+        m_nodes[prev].size += m_nodes[node].size;
+        m_nodes[prev].next = m_nodes[node].next;
+        if (m_nodes[node].next != InvalidNode)
+            m_nodes[m_nodes[node].next].prev = prev;
+        m_unusedNodes.push_back(node);
+        node = prev;
+    }
+    uint32_t next = m_nodes[node].next;
+    if (next != InvalidNode && !m_nodes[next].used) {
+        RemoveFree(next);
+        m_nodes[node].size += m_nodes[next].size;
+        m_nodes[node].next = m_nodes[next].next;
+        if (m_nodes[next].next != InvalidNode)
+            m_nodes[m_nodes[next].next].prev = node;
+        m_unusedNodes.push_back(next);
+    }
+    InsertFree(node);
+}
+
+void OffsetAllocator::Grow(uint32_t size) {
+    if (size == 0)
+        return;
+    uint32_t last = m_head;
+    while (m_nodes[last].next != InvalidNode)
+        last = m_nodes[last].next;
+
+    if (!m_nodes[last].used) {
+        if (m_nodes[last].size > 0)
+            RemoveFree(last);
+        m_nodes[last].size += size;
+    }
+    else {
+        uint32_t rest = NewNode(m_size, size);
+        m_nodes[rest].prev = last;
+        m_nodes[last].next = rest;
+        last = rest;
+    }
+    InsertFree(last);
+    m_size += size;
+    m_freeSize += size;
+}
+
+void OffsetAllocator::Compact(const std::function<void(uint32_t, uint32_t, uint32_t)>& move) {
+    m_firstLevelMask = 0;
+    memset(m_secondLevelMasks, 0, sizeof(m_secondLevelMasks));
+    for (auto& bin: m_bins)
+        bin = InvalidNode;
+
+    uint32_t offset = 0;
+    uint32_t head = InvalidNode;
+    uint32_t last = InvalidNode;
+    for (uint32_t node = m_head; node != InvalidNode;) {
+        uint32_t next = m_nodes[node].next;
+        if (!m_nodes[node].used) {
+            m_unusedNodes.push_back(node);
+            node = next;
+            continue;
+        }
+        auto& n = m_nodes[node];
+        move(n.offset, offset, n.size);
+        n.offset = offset;
+        offset += n.size;
+        n.prev = last;
+        n.next = InvalidNode;
+        if (last != InvalidNode)
+            m_nodes[last].next = node;
+        else
+            head = node;
+        last = node;
+        node = next;
+    }
+
+    // the free space is one range at the end
+    if (offset < m_size || head == InvalidNode) {
+        uint32_t rest = NewNode(offset, m_size - offset);
+        m_nodes[rest].prev = last;
+        if (last != InvalidNode)
+            m_nodes[last].next = rest;
+        else
+            head = rest;
+        if (m_nodes[rest].size > 0)
+            InsertFree(rest);
+    }
+    m_head = head;
+}
+
+uint32_t OffsetAllocator::GetLargestFree() const {
+    if (!m_firstLevelMask)
+        return 0;
+    uint32_t level = HighestBit(m_firstLevelMask);
+    uint32_t bin = level * SubBinCount + HighestBit(m_secondLevelMasks[level]);
+    uint32_t largest = 0;
+    for (uint32_t node = m_bins[bin]; node != InvalidNode; node = m_nodes[node].binNext)
+        largest = std::max(largest, m_nodes[node].size);
+    return largest;
+}
+
+
+
+GeometryAllocation::~GeometryAllocation() {
+    m_pool->Free(m_vertexNode, m_indexNode);
+}
+
+int32_t GeometryAllocation::GetBaseVertex() const {
+    if (m_vertexNode == OffsetAllocator::InvalidNode)
+        return 0;
+    return (int32_t)m_pool->m_vertexAllocator.GetOffset(m_vertexNode);
+}
+
+uint32_t GeometryAllocation::GetFirstIndex() const {
+    if (m_indexNode == OffsetAllocator::InvalidNode)
+        return 0;
+    return m_pool->m_indexAllocator.GetOffset(m_indexNode);
+}
+
+GeometryPoolPtr GeometryPool::Get() {
+    // made with the first mesh, gone with the last one's geometry
+    static std::weak_ptr<GeometryPool> s_pool;
+    auto pool = s_pool.lock();
+    if (!pool) {
+        pool = GeometryPoolPtr(Create(64 * 1024, 256 * 1024));
+        s_pool = pool;
+    }
+    return pool;
+}
+
+GeometryPoolUPtr GeometryPool::Create(uint32_t vertexCapacity, uint32_t indexCapacity) {
+    auto pool = GeometryPoolUPtr(new GeometryPool());
+    if (!pool->Init(vertexCapacity, indexCapacity))
+        return nullptr;
+    return std::move(pool);
+}
+
+bool GeometryPool::Init(uint32_t vertexCapacity, uint32_t indexCapacity) {
+    m_vertexLayout = VertexLayout::Create();
+    m_vertexBuffer = Buffer::CreateWithData(GL_ARRAY_BUFFER, GL_STATIC_DRAW,
+        nullptr, sizeof(Vertex), vertexCapacity);
+    m_indexBuffer = Buffer::CreateWithData(GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW,
+        nullptr, sizeof(uint32_t), indexCapacity);
+    if (!m_vertexBuffer || !m_indexBuffer)
+        return false;
+    SetVertexAttribs(m_vertexLayout.get());
+    m_vertexAllocator.Reset(vertexCapacity);
+    m_indexAllocator.Reset(indexCapacity);
+    return true;
+}
+
+void GeometryPool::BindBuffers() const {
+    m_vertexLayout->Bind();
+    m_vertexBuffer->Bind();
+    SetVertexAttribs(m_vertexLayout.get());
+    m_indexBuffer->Bind();
+}
+
+GeometryAllocationPtr GeometryPool::Allocate(const Vertex* vertices, uint32_t vertexCount,
+    const uint32_t* indices, uint32_t indexCount) {
+
+    // an empty range has no node, it reads as offset 0
+    auto allocate = [](OffsetAllocator& allocator, uint32_t count) {
+        return count > 0 ? allocator.Allocate(count) : OffsetAllocator::InvalidNode;
+    };
+    auto vertexNode = allocate(m_vertexAllocator, vertexCount);
+    auto indexNode = allocate(m_indexAllocator, indexCount);
+    if ((vertexCount > 0 && vertexNode == OffsetAllocator::InvalidNode) ||
+        (indexCount > 0 && indexNode == OffsetAllocator::InvalidNode)) {
+        m_vertexAllocator.Free(vertexNode);
+        m_indexAllocator.Free(indexNode);
+        // packed, the free space is one range. the buffers double until
+        // that range fits, when it already does they keep their size
+        uint32_t vertexCapacity = GetVertexCapacity();
+        while (vertexCapacity - GetUsedVertexCount() < vertexCount)
+            vertexCapacity *= 2;
+        uint32_t indexCapacity = GetIndexCapacity();
+        while (indexCapacity - GetUsedIndexCount() < indexCount)
+            indexCapacity *= 2;
+        Relocate(vertexCapacity, indexCapacity);
+        vertexNode = allocate(m_vertexAllocator, vertexCount);
+        indexNode = allocate(m_indexAllocator, indexCount);
+    }
+
+    // the copy target, element array bindings would change the bound layout
+    if (vertexCount > 0) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_vertexBuffer->Get());
+        glBufferSubData(GL_COPY_WRITE_BUFFER,
+            sizeof(Vertex) * m_vertexAllocator.GetOffset(vertexNode),
+            sizeof(Vertex) * vertexCount, vertices);
+    }
+    if (indexCount > 0) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_indexBuffer->Get());
+        glBufferSubData(GL_COPY_WRITE_BUFFER,
+            sizeof(uint32_t) * m_indexAllocator.GetOffset(indexNode),
+            sizeof(uint32_t) * indexCount, indices);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    auto allocation = GeometryAllocationPtr(new GeometryAllocation());
+    allocation->m_pool = shared_from_this();
+    allocation->m_vertexNode = vertexNode;
+    allocation->m_indexNode = indexNode;
+    allocation->m_vertexCount = vertexCount;
+    allocation->m_indexCount = indexCount;
+    return allocation;
+}
+
+void GeometryPool::Free(uint32_t vertexNode, uint32_t indexNode) {
+    m_vertexAllocator.Free(vertexNode);
+    m_indexAllocator.Free(indexNode);
+
+    // compacts once a quarter of the pool is free and its largest free
+    // range is under half of that
+    auto fragmented = [](const OffsetAllocator& allocator) {
+        return allocator.GetFreeSize() > allocator.GetSize() / 4 &&
+            allocator.GetLargestFree() < allocator.GetFreeSize() / 2;
+    };
+    if (fragmented(m_vertexAllocator) || fragmented(m_indexAllocator))
+        Relocate(GetVertexCapacity(), GetIndexCapacity());
+}
+
+// copies the ranges of allocator into their compacted offsets, ranges
+// that end up next to each other in one copy
+static void CopyCompacted(OffsetAllocator& allocator, size_t stride) {
+    uint32_t from = 0, to = 0, size = 0;
+    allocator.Compact([&](uint32_t rangeFrom, uint32_t rangeTo, uint32_t rangeSize) {
+        if (size > 0 && rangeFrom == from + size && rangeTo == to + size) {
+            size += rangeSize;
+            return;
+        }
+        if (size > 0) {
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                stride * from, stride * to, stride * size);
+        }
+        from = rangeFrom;
+        to = rangeTo;
+        size = rangeSize;
+    });
+    if (size > 0) {
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+            stride * from, stride * to, stride * size);
+    }
+}
+
+void GeometryPool::Relocate(uint32_t vertexCapacity, uint32_t indexCapacity) {
+    // new buffers are created with the pool's layout bound, so the element
+    // array binding it replaces is the pool's own
+    m_vertexLayout->Bind();
+    auto vertexBuffer = Buffer::CreateWithData(GL_ARRAY_BUFFER, GL_STATIC_DRAW,
+        nullptr, sizeof(Vertex), vertexCapacity);
+    auto indexBuffer = Buffer::CreateWithData(GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW,
+        nullptr, sizeof(uint32_t), indexCapacity);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, m_vertexBuffer->Get());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer->Get());
+    CopyCompacted(m_vertexAllocator, sizeof(Vertex));
+    glBindBuffer(GL_COPY_READ_BUFFER, m_indexBuffer->Get());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer->Get());
+    CopyCompacted(m_indexAllocator, sizeof(uint32_t));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    m_vertexAllocator.Grow(vertexCapacity - m_vertexAllocator.GetSize());
+    m_indexAllocator.Grow(indexCapacity - m_indexAllocator.GetSize());
+    m_vertexBuffer = std::move(vertexBuffer);
+    m_indexBuffer = std::move(indexBuffer);
+    BindBuffers();
+    m_version++;
+    SPDLOG_INFO("geometry pool relocated: {} / {} vertices, {} / {} indices",
+        GetUsedVertexCount(), GetVertexCapacity(), GetUsedIndexCount(), GetIndexCapacity());
+}
+
+
+
+MeshUPtr Mesh::CreateBox() {
+    std::vector<Vertex> vertices = {
+        Vertex { glm::vec3(-0.5f, -0.5f, -0.5f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec2(0.0f, 0.0f) },
+        Vertex { glm::vec3( 0.5f, -0.5f, -0.5f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec2(1.0f, 0.0f) },
+        Vertex { glm::vec3( 0.5f,  0.5f, -0.5f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec2(1.0f, 1.0f) },
+        Vertex { glm::vec3(-0.5f,  0.5f, -0.5f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec2(0.0f, 1.0f) },
+
+        Vertex { glm::vec3(-0.5f, -0.5f,  0.5f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec2(0.0f, 0.0f) },
+        Vertex { glm::vec3( 0.5f, -0.5f,  0.5f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec2(1.0f, 0.0f) },
+        Vertex { glm::vec3( 0.5f,  0.5f,  0.5f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec2(1.0f, 1.0f) },
+        Vertex { glm::vec3(-0.5f,  0.5f,  0.5f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec2(0.0f, 1.0f) },
+
+        Vertex { glm::vec3(-0.5f,  0.5f,  0.5f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec2(1.0f, 0.0f) },
+        Vertex { glm::vec3(-0.5f,  0.5f, -0.5f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec2(1.0f, 1.0f) },
+        Vertex { glm::vec3(-0.5f, -0.5f, -0.5f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec2(0.0f, 1.0f) },
+        Vertex { glm::vec3(-0.5f, -0.5f,  0.5f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec2(0.0f, 0.0f) },
+
+        Vertex { glm::vec3( 0.5f,  0.5f,  0.5f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec2(1.0f, 0.0f) },
+        Vertex { glm::vec3( 0.5f,  0.5f, -0.5f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec2(1.0f, 1.0f) },
+        Vertex { glm::vec3( 0.5f, -0.5f, -0.5f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec2(0.0f, 1.0f) },
+        Vertex { glm::vec3( 0.5f, -0.5f,  0.5f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec2(0.0f, 0.0f) },
+
+        Vertex { glm::vec3(-0.5f, -0.5f, -0.5f), glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec2(0.0f, 1.0f) },
+        Vertex { glm::vec3( 0.5f, -0.5f, -0.5f), glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec2(1.0f, 1.0f) },
+        Vertex { glm::vec3( 0.5f, -0.5f,  0.5f), glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec2(1.0f, 0.0f) },
+        Vertex { glm::vec3(-0.5f, -0.5f,  0.5f), glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec2(0.0f, 0.0f) },
+
+        Vertex { glm::vec3(-0.5f,  0.5f, -0.5f), glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec2(0.0f, 1.0f) },
+        Vertex { glm::vec3( 0.5f,  0.5f, -0.5f), glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec2(1.0f, 1.0f) },
+        Vertex { glm::vec3( 0.5f,  0.5f,  0.5f), glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec2(1.0f, 0.0f) },
+        Vertex { glm::vec3(-0.5f,  0.5f,  0.5f), glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec2(0.0f, 0.0f) },
+    };
+
+    std::vector<uint32_t> indices = {
+         0,  2,  1,  2,  0,  3,
+         4,  5,  6,  6,  7,  4,
+         8,  9, 10, 10, 11,  8,
+        12, 14, 13, 14, 12, 15,
+        16, 17, 18, 18, 19, 16,
+        20, 22, 21, 22, 20, 23,
+    };
+
+    return Create(vertices, indices, GL_TRIANGLES);
+}
+
+MeshUPtr Mesh::CreatePlane() {
+    std::vector<Vertex> vertices = {
+        Vertex { glm::vec3(-0.5f, -0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(0.0f, 0.0f) },
+        Vertex { glm::vec3( 0.5f, -0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(1.0f, 0.0f) },
+        Vertex { glm::vec3( 0.5f,  0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(1.0f, 1.0f) },
+        Vertex { glm::vec3(-0.5f,  0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(0.0f, 1.0f) },
+    };
+
+    std::vector<uint32_t> indices = {
+        0,  1,  2,  2,  3,  0,
+    };
+
+    return Create(vertices, indices, GL_TRIANGLES);
+}
+
+MeshUPtr Mesh::Create( const std::vector<Vertex>& vertices,
+    const std::vector<uint32_t>& indices, uint32_t primitiveType) { 
+
+    auto mesh = MeshUPtr(new Mesh());
+    mesh->Init(vertices, indices, primitiveType);
+    return std::move(mesh);
+}
+
+MeshUPtr Mesh::CreateFromRange(GeometryAllocationPtr geometry,
+    uint32_t firstIndex, uint32_t indexCount, int32_t baseVertex,
+    uint32_t primitiveType,
+    const BoundingBox& boundingBox, const BoundingSphere& boundingSphere) {
+
+    auto mesh = MeshUPtr(new Mesh());
+    mesh->m_vertexLayout = geometry->GetPool()->GetVertexLayout();
+    mesh->m_geometry = geometry;
+    mesh->m_firstIndex = firstIndex;
+    mesh->m_indexCount = indexCount;
+    mesh->m_baseVertex = baseVertex;
+    mesh->m_primitiveType = primitiveType;
+    mesh->m_boundingBox = boundingBox;
+    mesh->m_boundingSphere = boundingSphere;
+    return std::move(mesh);
+}
+
+void Mesh::Init( const std::vector<Vertex>& vertices,
+    const std::vector<uint32_t>& indices, uint32_t primitiveType) {
+
+    m_primitiveType = primitiveType;
+    m_indexCount = (uint32_t)indices.size();
+    m_boundingBox = ComputeBoundingBox(vertices);
+    m_boundingSphere = ComputeBoundingSphere(vertices, m_boundingBox);
+
+    auto pool = GeometryPool::Get();
+    m_geometry = pool->Allocate(vertices.data(), (uint32_t)vertices.size(),
+        indices.data(), (uint32_t)indices.size());
+    m_vertexLayout = pool->GetVertexLayout();
+}
+
+void Mesh::Draw() const {
+    m_vertexLayout->Bind();
+    // if (m_material) {
+    //     m_material->SetToProgram(program);
+    // }
+    glDrawElementsBaseVertex(m_primitiveType, m_indexCount, GL_UNSIGNED_INT,
+        (const void*)(sizeof(uint32_t) * GetFirstIndex()), GetBaseVertex());
+}
+
+void Mesh::DrawInstanced(const Buffer* instanceBuffer,
+    size_t firstInstance, int instanceCount) const {
+    m_vertexLayout->Bind();
+    SetInstanceAttribs(m_vertexLayout.get(), instanceBuffer->Get(),
+        firstInstance * sizeof(InstanceData));
+    glDrawElementsInstancedBaseVertex(m_primitiveType, m_indexCount, GL_UNSIGNED_INT,
+        (const void*)(sizeof(uint32_t) * GetFirstIndex()), instanceCount, GetBaseVertex());
+}
+
+
+
+MultiDrawBatchUPtr MultiDrawBatch::Create() {
+    auto batch = MultiDrawBatchUPtr(new MultiDrawBatch());
+    batch->m_multiDraw = IsMultiDrawIndirectSupported();
+    SPDLOG_INFO("multi draw indirect: {}", batch->m_multiDraw ? "on" : "off (cpu loop)");
+    return std::move(batch);
+}
+
+void MultiDrawBatch::Clear() {
+    m_commands.clear();
+    m_runs.clear();
+}
+
+void MultiDrawBatch::Add(const Mesh* mesh, uint32_t baseInstance, uint32_t instanceCount) {
+    if (m_runs.empty() ||
+        m_runs.back().vertexLayout != mesh->GetVertexLayout() ||
+        m_runs.back().primitiveType != mesh->GetPrimitiveType()) {
+        m_runs.push_back({ mesh->GetVertexLayout(), mesh->GetPrimitiveType(),
+            m_commands.size(), 0 });
+    }
+    m_commands.push_back({ mesh->GetIndexCount(), instanceCount,
+        mesh->GetFirstIndex(), mesh->GetBaseVertex(), baseInstance });
+    m_runs.back().count++;
+}
+
+void MultiDrawBatch::Submit(StreamBuffer* streamBuffer, size_t instanceOffset) {
+    m_drawCallCount = 0;
+    if (m_commands.empty())
+        return;
+
+    if (m_multiDraw) {
+        size_t commandOffset = streamBuffer->Write(m_commands.data(),
+            m_commands.size() * sizeof(DrawElementsIndirectCommand));
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, streamBuffer->Get());
+        for (auto& run: m_runs) {
+            run.vertexLayout->Bind();
+            SetInstanceAttribs(run.vertexLayout, streamBuffer->Get(), instanceOffset);
+            glMultiDrawElementsIndirect(run.primitiveType, GL_UNSIGNED_INT,
+                (const void*)(commandOffset + sizeof(DrawElementsIndirectCommand) * run.first),
+                (GLsizei)run.count, 0);
+            m_drawCallCount++;
+        }
+        return;
+    }
+
+    for (auto& run: m_runs) {
+        run.vertexLayout->Bind();
+        for (size_t i = run.first; i < run.first + run.count; i++) {
+            auto& command = m_commands[i];
+            SetInstanceAttribs(run.vertexLayout, streamBuffer->Get(),
+                instanceOffset + command.baseInstance * sizeof(InstanceData));
+            glDrawElementsInstancedBaseVertex(run.primitiveType, command.count,
+                GL_UNSIGNED_INT, (const void*)(sizeof(uint32_t) * command.firstIndex),
+                command.instanceCount, command.baseVertex);
+            m_drawCallCount++;
+        }
+    }
+}
+
+
+
+// queue of the calling thread, workers of another job system use the shared one
+static thread_local const JobSystem* s_workerOwner { nullptr };
+static thread_local size_t s_workerIndex { 0 };
+
+JobSystemUPtr JobSystem::Create(size_t workerCount) {
+    auto jobSystem = JobSystemUPtr(new JobSystem());
+    jobSystem->Init(workerCount);
+    return std::move(jobSystem);
+}
+
+JobSystem* JobSystem::Get() {
+    static auto jobSystem = Create(std::max<size_t>(1, std::thread::hardware_concurrency()) - 1);
+    return jobSystem.get();
+}
+
+void JobSystem::Init(size_t workerCount) {
+    for (size_t i = 0; i < workerCount + 1; i++)
+        m_queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < workerCount; i++)
+        m_workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_quit = true;
+    }
+    m_wakeUp.notify_all();
+    for (auto& worker: m_workers)
+        worker.join();
+}
+
+void JobSystem::Run(Job job, JobCounter* counter) {
+    if (counter)
+        counter->m_count.fetch_add(1, std::memory_order_relaxed);
+    Push(std::move(job), counter);
+}
+
+void JobSystem::RunAfter(JobCounter& dependency, Job job, JobCounter* counter) {
+    if (counter)
+        counter->m_count.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(dependency.m_mutex);
+        if (dependency.m_count.load(std::memory_order_acquire) > 0) {
+            dependency.m_continuations.push_back({ std::move(job), counter });
+            return;
+        }
+    }
+    Push(std::move(job), counter);
+}
+
+void JobSystem::Wait(JobCounter& counter) {
+    // with nothing to run the jobs left are running elsewhere. a short
+    // spin catches quick ones, then the thread sleeps until the counter
+    // reaches zero, waking now and then to help with newly queued jobs
+    const int spinCount = 64;
+    size_t queueIndex = GetQueueIndex();
+    int idle = 0;
+    while (counter.m_count.load(std::memory_order_acquire) > 0) {
+        if (RunOne(queueIndex)) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < spinCount) {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(counter.m_mutex);
+        counter.m_done.wait_for(lock, std::chrono::milliseconds(1), [&]() {
+            return counter.m_count.load(std::memory_order_acquire) == 0;
+        });
+    }
+    // the last job may still hold the lock it reached zero under
+    std::lock_guard<std::mutex> lock(counter.m_mutex);
+}
+
+size_t JobSystem::GetQueueIndex() const {
+    return s_workerOwner == this ? s_workerIndex : m_workers.size();
+}
+
+void JobSystem::Push(Job job, JobCounter* counter) {
+    auto& queue = *m_queues[GetQueueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.PushBack({ std::move(job), counter });
+    }
+    m_queuedJobs.fetch_add(1, std::memory_order_release);
+    // a worker checking for jobs under the lock either sees this one or
+    // is already waiting for the notification
+    { std::lock_guard<std::mutex> lock(m_sleepMutex); }
+    m_wakeUp.notify_one();
+}
+
+bool JobSystem::RunOne(size_t queueIndex) {
+    if (m_queuedJobs.load(std::memory_order_acquire) == 0)
+        return false;
+
+    // newest of the own queue first, it is likely still in cache, then
+    // the oldest of every other queue
+    QueuedJob queued;
+    bool found = false;
+    for (size_t i = 0; i < m_queues.size() && !found; i++) {
+        auto& queue = *m_queues[(queueIndex + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.count == 0)
+            continue;
+        queued = i == 0 ? queue.PopBack() : queue.PopFront();
+        found = true;
+    }
+    if (!found)
+        return false;
+
+    // what the job allocates from the frame arena is gone after it
+    m_queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+    auto& arena = FrameArena::Get();
+    auto marker = arena.GetMarker();
+    queued.job();
+    arena.Rewind(marker);
+    if (queued.counter)
+        Finish(queued.counter);
+    return true;
+}
+
+void JobSystem::Finish(JobCounter* counter) {
+    std::vector<std::pair<Job, JobCounter*>> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter->m_mutex);
+        if (counter->m_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            continuations.swap(counter->m_continuations);
+            // under the lock, a woken waiter may free the counter after it
+            counter->m_done.notify_all();
+        }
+    }
+    for (auto& continuation: continuations)
+        Push(std::move(continuation.first), continuation.second);
+}
+
+void JobSystem::Queue::PushBack(QueuedJob&& job) {
+    if (count == jobs.size()) {
+        std::vector<QueuedJob> grown(std::max<size_t>(64, jobs.size() * 2));
+        for (size_t i = 0; i < count; i++)
+            grown[i] = std::move(jobs[(head + i) % jobs.size()]);
+        jobs.swap(grown);
+        head = 0;
+    }
+    jobs[(head + count) % jobs.size()] = std::move(job);
+    count++;
+}
+
+JobSystem::QueuedJob JobSystem::Queue::PopBack() {
+    count--;
+    return std::move(jobs[(head + count) % jobs.size()]);
+}
+
+JobSystem::QueuedJob JobSystem::Queue::PopFront() {
+    auto job = std::move(jobs[head]);
+    head = (head + 1) % jobs.size();
+    count--;
+    return job;
+}
+
+void JobSystem::WorkerLoop(size_t index) {
+    s_workerOwner = this;
+    s_workerIndex = index;
+    while (true) {
+        if (RunOne(index))
+            continue;
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wakeUp.wait(lock, [this]() {
+            return m_quit || m_queuedJobs.load(std::memory_order_acquire) > 0;
+        });
+        if (m_quit)
+            return;
+    }
+}
+
+
+
+SceneGraphUPtr SceneGraph::Create() {
+    return SceneGraphUPtr(new SceneGraph());
+}
+
+int SceneGraph::AddNode(int parent, const glm::mat4& localTransform) {
+    int node = (int)m_parents.size();
+    if (parent >= node || (parent >= 0 && m_subtreeEnds[parent] != node)) {
+        SPDLOG_ERROR("scene graph nodes must be added depth first, parent: {}", parent);
+        parent = -1;
+    }
+
+    m_parents.push_back(parent);
+    m_subtreeEnds.push_back(node + 1);
+    m_localTransforms.push_back(localTransform);
+    m_worldTransforms.push_back(localTransform);
+    m_dirty.push_back(0);
+    m_dirtyBelow.push_back(0);
+    m_changed.push_back(0);
+    if (parent < 0) {
+        m_roots.push_back(node);
+        // room for every root, so updates do not allocate
+        m_dirtyRoots.reserve(m_roots.size());
+        m_updatedCounts.resize(m_roots.size());
+    }
+    for (int p = parent; p >= 0; p = m_parents[p])
+        m_subtreeEnds[p] = node + 1;
+
+    MarkDirty(node);
+    return node;
+}
+
+void SceneGraph::SetLocalTransform(int node, const glm::mat4& localTransform) {
+    m_localTransforms[node] = localTransform;
+    MarkDirty(node);
+}
+
+void SceneGraph::MarkDirty(int node) {
+    m_dirty[node] = 1;
+    // stops at the first ancestor already on a dirty path
+    for (int p = node; p >= 0 && !m_dirtyBelow[p]; p = m_parents[p])
+        m_dirtyBelow[p] = 1;
+}
+
+bool SceneGraph::Update() {
+    m_dirtyRoots.clear();
+    for (auto root: m_roots) {
+        if (m_dirtyBelow[root])
+            m_dirtyRoots.push_back(root);
+    }
+
+    // independent roots touch disjoint ranges, large graphs update them in parallel
+    auto& dirtyRoots = m_dirtyRoots;
+    auto& updated = m_updatedCounts;
+    if (dirtyRoots.size() > 1 && m_parents.size() >= 4096) {
+        ParallelFor(dirtyRoots.size(), 1, [&](size_t i) {
+            updated[i] = UpdateSubtree(dirtyRoots[i]);
+        });
+    }
+    else {
+        for (size_t i = 0; i < dirtyRoots.size(); i++)
+            updated[i] = UpdateSubtree(dirtyRoots[i]);
+    }
+
+    m_updatedNodeCount = 0;
+    for (size_t i = 0; i < dirtyRoots.size(); i++)
+        m_updatedNodeCount += updated[i];
+    return m_updatedNodeCount > 0;
+}
+
+size_t SceneGraph::UpdateSubtree(int root) {
+    size_t updatedCount = 0;
+    int end = m_subtreeEnds[root];
+    int node = root;
+    while (node < end) {
+        int parent = m_parents[node];
+        // the parent was visited earlier in this sweep, so its flag is current
+        bool parentChanged = parent >= 0 && m_changed[parent];
+        // nothing changed in or above this subtree
+        if (!parentChanged && !m_dirtyBelow[node]) {
+            node = m_subtreeEnds[node];
+            continue;
+        }
+
+        m_changed[node] = parentChanged || m_dirty[node];
+        if (m_changed[node]) {
+            m_worldTransforms[node] = parent >= 0 ?
+                m_worldTransforms[parent] * m_localTransforms[node] :
+                m_localTransforms[node];
+            updatedCount++;
+        }
+        m_dirty[node] = 0;
+        m_dirtyBelow[node] = 0;
+        node++;
+    }
+
+    return updatedCount;
+}
+
+
+
+ModelUPtr Model::Load(const std::string& filename) {
+    TRACE_SCOPE("Model::Load");
+    auto model = ModelUPtr(new Model());
+    if (!model->LoadByAssimp(filename))
+        return nullptr;
+    return std::move(model);
+}
+
+bool Model::LoadByAssimp(const std::string& filename) {
+    Assimp::Importer importer;
+    auto scene = importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs);
+
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        SPDLOG_ERROR("failed to load model: {}", filename);
+        return false;
+    }
+
+    // auto dirname = filename.substr(0, filename.find_last_of("/"));
+    // auto LoadTexture = [&](aiMaterial* material, aiTextureType type) -> TexturePtr {
+    //     if (material->GetTextureCount(type) <= 0)
+    //         return nullptr;
+    //     aiString filepath;
+    //     material->GetTexture(aiTextureType_DIFFUSE, 0, &filepath);
+    //     auto image = Image::Load(fmt::format("{}/{}", dirname, filepath.C_Str()));
+    //     if (!image)
+    //         return nullptr;
+    //     return Texture::CreateFromImage(image.get());
+    // };
+    
+    // for (uint32_t i = 0; i < scene->mNumMaterials; i++) {
+    //     auto material = scene->mMaterials[i];
+    //     auto glMaterial = Material::Create();
+    //     glMaterial->diffuse = LoadTexture(material, aiTextureType_DIFFUSE);
+    //     glMaterial->specular = LoadTexture(material, aiTextureType_SPECULAR);
+    //     m_materials.push_back(std::move(glMaterial));
+    // }
+
+    m_sceneGraph = SceneGraph::Create();
+    ProcessNode(scene->mRootNode, scene, -1);
+    ProcessMeshes();
+    m_sceneGraph->Update();
+    CreateSharedGeometry();
+    return true;
+}
+
+void Model::CreateSharedGeometry() {
+    m_geometry = GeometryPool::Get()->Allocate(m_vertices.data(), (uint32_t)m_vertices.size(),
+        m_indices.data(), (uint32_t)m_indices.size());
+
+    for (size_t i = 0; i < m_ranges.size(); i++) {
+        auto& range = m_ranges[i];
+        m_meshes.push_back(Mesh::CreateFromRange(m_geometry,
+            range.firstIndex, range.indexCount, range.baseVertex, GL_TRIANGLES,
+            range.boundingBox, range.boundingSphere));
+        auto& transform = m_sceneGraph->GetWorldTransform(m_meshNodes[i]);
+        m_boundingBox.Expand(range.boundingBox.Transform(transform));
+    }
+    if (IsMultiDrawIndirectSupported()) {
+        m_indirectBuffer = Buffer::CreateWithData(GL_DRAW_INDIRECT_BUFFER, GL_STATIC_DRAW,
+            nullptr, sizeof(DrawElementsIndirectCommand), m_meshes.size());
+        UpdateIndirectBuffer();
+    }
+
+    m_vertices = std::vector<Vertex>();
+    m_indices = std::vector<uint32_t>();
+    m_ranges = std::vector<MeshRange>();
+}
+
+void ConvertMesh(const aiMesh* mesh, Vertex* vertices, uint32_t* indices) {
+    for (uint32_t i = 0; i < mesh->mNumVertices; i++) {
+        auto& v = vertices[i];
+        v.position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+        v.normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+        v.texCoord = glm::vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
+    }
+
+    for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
+        indices[3*i  ] = mesh->mFaces[i].mIndices[0];
+        indices[3*i+1] = mesh->mFaces[i].mIndices[1];
+        indices[3*i+2] = mesh->mFaces[i].mIndices[2];
+    }
+}
+
+void Model::ProcessMesh(const aiMesh* mesh, MeshRange& range) {
+    SPDLOG_INFO("process mesh: {}, #vert: {}, #face: {}",
+        mesh->mName.C_Str(), mesh->mNumVertices, mesh->mNumFaces);
+
+    auto vertices = m_vertices.data() + range.baseVertex;
+    ConvertMesh(mesh, vertices, m_indices.data() + range.firstIndex);
+
+    // auto glMesh = Mesh::Create(vertices, indices, GL_TRIANGLES);
+    // if (mesh->mMaterialIndex >= 0)
+    //     glMesh->SetMaterial(m_materials[mesh->mMaterialIndex]);
+
+    // m_meshes.push_back(std::move(glMesh));
+
+    range.boundingBox = ComputeBoundingBox(vertices, mesh->mNumVertices);
+    range.boundingSphere = ComputeBoundingSphere(vertices, mesh->mNumVertices,
+        range.boundingBox);
+}
+
+void Model::ProcessMeshes() {
+    // ranges of the shared geometry in node order, sized up front so
+    // every mesh converts in place in a job of its own. meshes are
+    // created in CreateSharedGeometry()
+    size_t vertexCount = 0, indexCount = 0;
+    for (auto mesh: m_sourceMeshes) {
+        m_ranges.push_back({ (uint32_t)indexCount, mesh->mNumFaces * 3,
+            (int32_t)vertexCount, BoundingBox(), BoundingSphere() });
+        vertexCount += mesh->mNumVertices;
+        indexCount += mesh->mNumFaces * 3;
+    }
+    m_vertices.resize(vertexCount);
+    m_indices.resize(indexCount);
+
+    auto jobSystem = JobSystem::Get();
+    JobCounter counter;
+    for (size_t i = 0; i < m_sourceMeshes.size(); i++)
+        jobSystem->Run([this, i]() { ProcessMesh(m_sourceMeshes[i], m_ranges[i]); }, &counter);
+    jobSystem->Wait(counter);
+    m_sourceMeshes.clear();
+}
+
+void Model::ProcessNode(aiNode* node, const aiScene* scene, int parentNode) {
+    // assimp matrices are row major
+    auto& m = node->mTransformation;
+    auto localTransform = glm::mat4(
+        m.a1, m.b1, m.c1, m.d1,
+        m.a2, m.b2, m.c2, m.d2,
+        m.a3, m.b3, m.c3, m.d3,
+        m.a4, m.b4, m.c4, m.d4);
+    int graphNode = m_sceneGraph->AddNode(parentNode, localTransform);
+
+    for (uint32_t i = 0; i < node->mNumMeshes; i++) {
+        auto meshIndex = node->mMeshes[i];
+        m_sourceMeshes.push_back(scene->mMeshes[meshIndex]);
+        m_meshNodes.push_back(graphNode);
+    }
+
+    for (uint32_t i = 0; i < node->mNumChildren; i++) {
+        ProcessNode(node->mChildren[i], scene, graphNode);
+    }
+}
+
+// void Model::Draw(const Program* program) const {
+//     for (auto& mesh: m_meshes) {
+//         mesh->Draw(program);
+//     }
+// }
+void Model::Draw() const {
+    if (!m_indirectBuffer) {
+        for (auto& mesh: m_meshes) {
+            mesh->Draw();
+        }
+        return;
+    }
+
+    auto pool = m_geometry->GetPool();
+    if (m_poolVersion != pool->GetVersion())
+        UpdateIndirectBuffer();
+    pool->GetVertexLayout()->Bind();
+    m_indirectBuffer->Bind();
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0,
+        (GLsizei)m_indirectBuffer->GetCount(), 0);
+}
+
+// the commands hold the meshes' offsets in the pool, rewritten after
+// the pool has moved them
+void Model::UpdateIndirectBuffer() const {
+    std::vector<DrawElementsIndirectCommand> commands;
+    commands.reserve(m_meshes.size());
+    for (auto& mesh: m_meshes) {
+        commands.push_back({ mesh->GetIndexCount(), 1,
+            mesh->GetFirstIndex(), mesh->GetBaseVertex(), 0 });
+    }
+    m_indirectBuffer->UpdateData(commands.data(), commands.size());
+    m_poolVersion = m_geometry->GetPool()->GetVersion();
+}
+
+
+
+void CullBoxes(const Frustum& frustum, const BoundsSoA& bounds,
+    size_t begin, size_t end, uint8_t* visible) {
+
+    glm::vec4 absPlanes[6];
+    for (int p = 0; p < 6; p++)
+        absPlanes[p] = glm::abs(frustum.planes[p]);
+
+    size_t i = begin;
+#if defined(USE_SSE) && defined(__AVX__)
+    for (; i + 8 <= end; i += 8) {
+        __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+        __m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+        __m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+        __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+        __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+        __m256 zero = _mm256_setzero_ps();
+        __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+        for (int p = 0; p < 6; p++) {
+            auto& plane = frustum.planes[p];
+            auto& absPlane = absPlanes[p];
+            __m256 d = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane.x)),
+                    _mm256_mul_ps(cy, _mm256_set1_ps(plane.y))),
+                _mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(plane.z)),
+                    _mm256_set1_ps(plane.w)));
+            __m256 r = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(absPlane.x)),
+                    _mm256_mul_ps(ey, _mm256_set1_ps(absPlane.y))),
+                _mm256_mul_ps(ez, _mm256_set1_ps(absPlane.z)));
+            inside = _mm256_and_ps(inside,
+                _mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(inside);
+        for (int k = 0; k < 8; k++)
+            visible[i + k] = (mask >> k) & 1;
+    }
+#endif
+#if defined(USE_SSE)
+    for (; i + 4 <= end; i += 4) {
+        __m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+        __m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+        __m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+        __m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+        __m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+        __m128 zero = _mm_setzero_ps();
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (int p = 0; p < 6; p++) {
+            auto& plane = frustum.planes[p];
+            auto& absPlane = absPlanes[p];
+            __m128 d = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)),
+                    _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+                _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)),
+                    _mm_set1_ps(plane.w)));
+            __m128 r = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(absPlane.x)),
+                    _mm_mul_ps(ey, _mm_set1_ps(absPlane.y))),
+                _mm_mul_ps(ez, _mm_set1_ps(absPlane.z)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; k++)
+            visible[i + k] = (mask >> k) & 1;
+    }
+#endif
+    for (; i < end; i++) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++) {
+            auto& plane = frustum.planes[p];
+            auto& absPlane = absPlanes[p];
+            float d = plane.x * bounds.centerX[i] + plane.y * bounds.centerY[i] +
+                plane.z * bounds.centerZ[i] + plane.w;
+            float r = absPlane.x * bounds.extentX[i] + absPlane.y * bounds.extentY[i] +
+                absPlane.z * bounds.extentZ[i];
+            inside = d + r >= 0.0f;
+        }
+        visible[i] = inside ? 1 : 0;
+    }
+}
+
+void ComputeTransforms(const TransformSoA& transforms, const glm::mat4& viewProjection,
+    size_t begin, size_t end, glm::mat4* model, size_t modelStride,
+    glm::mat4* mvp, size_t mvpStride) {
+
+    auto output = [](glm::mat4* base, size_t stride, size_t index) {
+        return (glm::mat4*)((uint8_t*)base + stride * index);
+    };
+
+    size_t i = begin;
+#if defined(USE_SSE)
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 two = _mm_set1_ps(2.0f);
+    __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= end; i += 4) {
+        __m128 qx = _mm_loadu_ps(&transforms.rotationX[i]);
+        __m128 qy = _mm_loadu_ps(&transforms.rotationY[i]);
+        __m128 qz = _mm_loadu_ps(&transforms.rotationZ[i]);
+        __m128 qw = _mm_loadu_ps(&transforms.rotationW[i]);
+        __m128 sx = _mm_loadu_ps(&transforms.scaleX[i]);
+        __m128 sy = _mm_loadu_ps(&transforms.scaleY[i]);
+        __m128 sz = _mm_loadu_ps(&transforms.scaleZ[i]);
+
+        __m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz);
+        __m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz);
+        __m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+
+        // m[column][row] for four objects, one lane each
+        __m128 m[4][4];
+        m[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+        m[0][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+        m[0][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+        m[0][3] = zero;
+        m[1][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+        m[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+        m[1][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+        m[1][3] = zero;
+        m[2][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+        m[2][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+        m[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+        m[2][3] = zero;
+        m[3][0] = _mm_loadu_ps(&transforms.positionX[i]);
+        m[3][1] = _mm_loadu_ps(&transforms.positionY[i]);
+        m[3][2] = _mm_loadu_ps(&transforms.positionZ[i]);
+        m[3][3] = one;
+
+        // transposes a column from lanes to one vec4 per object and stores it
+        auto store = [&](__m128 (&column)[4], glm::mat4* base, size_t stride, int c) {
+            __m128 r0 = column[0], r1 = column[1], r2 = column[2], r3 = column[3];
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            _mm_storeu_ps(&(*output(base, stride, i + 0))[c][0], r0);
+            _mm_storeu_ps(&(*output(base, stride, i + 1))[c][0], r1);
+            _mm_storeu_ps(&(*output(base, stride, i + 2))[c][0], r2);
+            _mm_storeu_ps(&(*output(base, stride, i + 3))[c][0], r3);
+        };
+
+        for (int c = 0; c < 4; c++) {
+            if (model)
+                store(m[c], model, modelStride, c);
+            if (!mvp)
+                continue;
+            __m128 p[4];
+            for (int r = 0; r < 4; r++) {
+                p[r] = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(viewProjection[0][r]), m[c][0]),
+                        _mm_mul_ps(_mm_set1_ps(viewProjection[1][r]), m[c][1])),
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(viewProjection[2][r]), m[c][2]),
+                        _mm_mul_ps(_mm_set1_ps(viewProjection[3][r]), m[c][3])));
+            }
+            store(p, mvp, mvpStride, c);
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        float qx = transforms.rotationX[i], qy = transforms.rotationY[i];
+        float qz = transforms.rotationZ[i], qw = transforms.rotationW[i];
+        glm::mat4 m(1.0f);
+        m[0] = glm::vec4(1.0f - 2.0f * (qy * qy + qz * qz), 2.0f * (qx * qy + qw * qz),
+            2.0f * (qx * qz - qw * qy), 0.0f) * transforms.scaleX[i];
+        m[1] = glm::vec4(2.0f * (qx * qy - qw * qz), 1.0f - 2.0f * (qx * qx + qz * qz),
+            2.0f * (qy * qz + qw * qx), 0.0f) * transforms.scaleY[i];
+        m[2] = glm::vec4(2.0f * (qx * qz + qw * qy), 2.0f * (qy * qz - qw * qx),
+            1.0f - 2.0f * (qx * qx + qy * qy), 0.0f) * transforms.scaleZ[i];
+        m[3] = glm::vec4(transforms.positionX[i], transforms.positionY[i],
+            transforms.positionZ[i], 1.0f);
+        if (model)
+            *output(model, modelStride, i) = m;
+        if (mvp)
+            *output(mvp, mvpStride, i) = viewProjection * m;
+    }
+}
+
+
+
+BvhUPtr Bvh::Create() {
+    return BvhUPtr(new Bvh());
+}
+
+// surface area in double, unbounded boxes would overflow float
+static double SurfaceArea(const BoundingBox& box) {
+    if (!box.IsValid())
+        return 0.0;
+    auto d = box.max - box.min;
+    return 2.0 * ((double)d.x * d.y + (double)d.y * d.z + (double)d.z * d.x);
+}
+
+void Bvh::LoadBoxes(const BoundsSoA& bounds) {
+    m_boxes.resize(bounds.Size());
+    for (size_t i = 0; i < bounds.Size(); i++) {
+        auto center = glm::vec3(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+        auto extent = glm::vec3(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+        m_boxes[i] = BoundingBox { center - extent, center + extent };
+    }
+}
+
+void Bvh::Build(const BoundsSoA& bounds) {
+    LoadBoxes(bounds);
+    size_t count = m_boxes.size();
+
+    m_nodes.clear();
+    m_nodes.reserve(count * 2);
+    m_indices.resize(count);
+    m_centers.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        m_indices[i] = i;
+        m_centers[i] = m_boxes[i].GetCenter();
+    }
+    if (count > 0)
+        BuildNode(0, (uint32_t)count, 0);
+    m_centers = std::vector<glm::vec3>();
+}
+
+uint32_t Bvh::BuildNode(uint32_t first, uint32_t count, int depth) {
+    uint32_t nodeIndex = (uint32_t)m_nodes.size();
+    m_nodes.push_back(Node());
+
+    BoundingBox box, centerBox;
+    for (uint32_t i = first; i < first + count; i++) {
+        box.Expand(m_boxes[m_indices[i]]);
+        centerBox.Expand(m_centers[m_indices[i]]);
+    }
+    m_nodes[nodeIndex].box = box;
+
+    auto makeLeaf = [&]() {
+        m_nodes[nodeIndex].first = first;
+        m_nodes[nodeIndex].count = count;
+        return nodeIndex;
+    };
+    if (count <= 2 || depth >= 64)
+        return makeLeaf();
+
+    // binned SAH over all three axes
+    struct Bin {
+        BoundingBox box;
+        uint32_t count { 0 };
+    };
+    double bestCost = DBL_MAX;
+    int bestAxis = -1;
+    int bestSplit = 0;
+    auto centerExtent = centerBox.max - centerBox.min;
+    for (int axis = 0; axis < 3; axis++) {
+        if (centerExtent[axis] <= 0.0f)
+            continue;
+        Bin bins[kBinCount];
+        float scale = (float)kBinCount / centerExtent[axis];
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t index = m_indices[i];
+            int bin = std::min(kBinCount - 1,
+                (int)((m_centers[index][axis] - centerBox.min[axis]) * scale));
+            bins[bin].box.Expand(m_boxes[index]);
+            bins[bin].count++;
+        }
+
+        // sweep from the right to get the cost of every right partition
+        double rightArea[kBinCount];
+        uint32_t rightCount[kBinCount];
+        BoundingBox rightBox;
+        uint32_t rightSum = 0;
+        for (int i = kBinCount - 1; i > 0; i--) {
+            rightBox.Expand(bins[i].box);
+            rightSum += bins[i].count;
+            rightArea[i] = SurfaceArea(rightBox);
+            rightCount[i] = rightSum;
+        }
+        BoundingBox leftBox;
+        uint32_t leftSum = 0;
+        for (int i = 0; i < kBinCount - 1; i++) {
+            leftBox.Expand(bins[i].box);
+            leftSum += bins[i].count;
+            if (leftSum == 0 || rightCount[i + 1] == 0)
+                continue;
+            double cost = SurfaceArea(leftBox) * leftSum + rightArea[i + 1] * rightCount[i + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i + 1;
+            }
+        }
+    }
+
+    // traversal cost 1 against intersection cost 1 per primitive
+    double leafCost = SurfaceArea(box) * count;
+    double splitCost = SurfaceArea(box) + bestCost;
+    uint32_t* begin = m_indices.data() + first;
+    uint32_t* end = begin + count;
+    uint32_t* middle = nullptr;
+    if (bestAxis >= 0 && (splitCost < leafCost || count > kMaxLeafSize)) {
+        float scale = (float)kBinCount / centerExtent[bestAxis];
+        middle = std::partition(begin, end, [&](uint32_t index) {
+            int bin = std::min(kBinCount - 1,
+                (int)((m_centers[index][bestAxis] - centerBox.min[bestAxis]) * scale));
+            return bin < bestSplit;
+        });
+    }
+    else if (count > kMaxLeafSize) {
+        // every center coincides, split in the middle of the list
+        middle = begin + count / 2;
+    }
+    else {
+        return makeLeaf();
+    }
+
+    uint32_t leftCount = (uint32_t)(middle - begin);
+    BuildNode(first, leftCount, depth + 1);
+    uint32_t right = BuildNode(first + leftCount, count - leftCount, depth + 1);
+    m_nodes[nodeIndex].first = right;
+    m_nodes[nodeIndex].count = 0;
+    return nodeIndex;
+}
+
+void Bvh::Refit(const BoundsSoA& bounds) {
+    LoadBoxes(bounds);
+    // children always come after their parent, so a reverse sweep is bottom up
+    for (size_t i = m_nodes.size(); i-- > 0;) {
+        auto& node = m_nodes[i];
+        BoundingBox box;
+        if (node.count > 0) {
+            for (uint32_t j = node.first; j < node.first + node.count; j++)
+                box.Expand(m_boxes[m_indices[j]]);
+        }
+        else {
+            box.Expand(m_nodes[i + 1].box);
+            box.Expand(m_nodes[node.first].box);
+        }
+        node.box = box;
+    }
+}
+
+// 0: outside, 1: intersecting, 2: inside
+static int ClassifyBox(const Frustum& frustum, const BoundingBox& box) {
+    auto center = box.GetCenter();
+    auto extent = box.GetExtent();
+    int result = 2;
+    for (auto& plane: frustum.planes) {
+        float d = glm::dot(glm::vec3(plane), center) + plane.w;
+        float r = glm::dot(glm::abs(glm::vec3(plane)), extent);
+        if (d + r < 0.0f)
+            return 0;
+        if (d - r < 0.0f)
+            result = 1;
+    }
+    return result;
+}
+
+void Bvh::QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& result) const {
+    result.clear();
+    if (m_nodes.empty())
+        return;
+
+    uint32_t stack[128];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        uint32_t nodeIndex = stack[--stackSize];
+        auto& node = m_nodes[nodeIndex];
+        int classification = ClassifyBox(frustum, node.box);
+        if (classification == 0)
+            continue;
+
+        if (classification == 2) {
+            // whole subtree is visible, its primitives are the contiguous
+            // range from its leftmost to its rightmost leaf
+            uint32_t leftmost = nodeIndex;
+            while (m_nodes[leftmost].count == 0)
+                leftmost++;
+            uint32_t rightmost = nodeIndex;
+            while (m_nodes[rightmost].count == 0)
+                rightmost = m_nodes[rightmost].first;
+            result.insert(result.end(),
+                m_indices.begin() + m_nodes[leftmost].first,
+                m_indices.begin() + m_nodes[rightmost].first + m_nodes[rightmost].count);
+            continue;
+        }
+
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                if (ClassifyBox(frustum, m_boxes[m_indices[i]]) != 0)
+                    result.push_back(m_indices[i]);
+            }
+        }
+        else {
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+    }
+}
+
+// slab test, returns the entry distance or a negative value on a miss
+static float IntersectRayBox(const glm::vec3& origin, const glm::vec3& invDirection,
+    const BoundingBox& box, float maxDistance) {
+    float tMin = 0.0f;
+    float tMax = maxDistance;
+    for (int axis = 0; axis < 3; axis++) {
+        float t0 = (box.min[axis] - origin[axis]) * invDirection[axis];
+        float t1 = (box.max[axis] - origin[axis]) * invDirection[axis];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tMin = std::max(tMin, t0);
+        tMax = std::min(tMax, t1);
+        if (tMin > tMax)
+            return -1.0f;
+    }
+    return tMin;
+}
+
+bool Bvh::Raycast(const glm::vec3& origin, const glm::vec3& direction,
+    float maxDistance, uint32_t& hitIndex, float& hitDistance) const {
+    if (m_nodes.empty())
+        return false;
+
+    auto invDirection = glm::vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    bool hit = false;
+    hitDistance = maxDistance;
+
+    uint32_t stack[128];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        uint32_t nodeIndex = stack[--stackSize];
+        auto& node = m_nodes[nodeIndex];
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                float t = IntersectRayBox(origin, invDirection, m_boxes[m_indices[i]], hitDistance);
+                if (t >= 0.0f && t < hitDistance) {
+                    hitDistance = t;
+                    hitIndex = m_indices[i];
+                    hit = true;
+                }
+            }
+            continue;
+        }
+
+        // visit the nearer child first so farther subtrees get rejected early
+        uint32_t left = nodeIndex + 1;
+        uint32_t right = node.first;
+        float tLeft = IntersectRayBox(origin, invDirection, m_nodes[left].box, hitDistance);
+        float tRight = IntersectRayBox(origin, invDirection, m_nodes[right].box, hitDistance);
+        if (tLeft >= 0.0f && tRight >= 0.0f) {
+            if (tLeft < tRight)
+                std::swap(left, right);
+            stack[stackSize++] = left;
+            stack[stackSize++] = right;
+        }
+        else if (tLeft >= 0.0f) {
+            stack[stackSize++] = left;
+        }
+        else if (tRight >= 0.0f) {
+            stack[stackSize++] = right;
+        }
+    }
+    return hit;
+}
+
+
+
+OcclusionCullerUPtr OcclusionCuller::Create(int width, int height) {
+    auto culler = OcclusionCullerUPtr(new OcclusionCuller());
+    // rows are rasterized four pixels at a time
+    culler->m_width = std::max(4, (width + 3) & ~3);
+    culler->m_height = std::max(1, height);
+
+    int levelWidth = culler->m_width;
+    int levelHeight = culler->m_height;
+    while (true) {
+        culler->m_levelSizes.push_back(glm::ivec2(levelWidth, levelHeight));
+        culler->m_levels.push_back(std::vector<float>(levelWidth * levelHeight, 1.0f));
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+        levelWidth = (levelWidth + 1) / 2;
+        levelHeight = (levelHeight + 1) / 2;
+    }
+    return std::move(culler);
+}
+
+void OcclusionCuller::RenderOccluders(const std::vector<Occluder>& occluders,
+    const glm::mat4& viewProjection) {
+
+    m_viewProjection = viewProjection;
+    m_triangles.clear();
+
+    auto& clip = m_clipPositions;
+    for (auto& occluder: occluders) {
+        auto& geometry = *occluder.geometry;
+        auto transform = viewProjection * occluder.modelTransform;
+        clip.resize(geometry.positions.size());
+        for (size_t i = 0; i < clip.size(); i++)
+            clip[i] = transform * glm::vec4(geometry.positions[i], 1.0f);
+
+        for (size_t i = 0; i + 2 < geometry.indices.size(); i += 3) {
+            ScreenTriangle triangle;
+            bool behindNear = false;
+            for (int k = 0; k < 3; k++) {
+                auto& p = clip[geometry.indices[i + k]];
+                // dropping triangles crossing the near plane only loses occlusion
+                if (p.w <= 1e-5f || p.z < -p.w) {
+                    behindNear = true;
+                    break;
+                }
+                // snapped to quarter pixels so the edge functions are exact
+                // and shared edges leave no cracks
+                triangle.v[k] = glm::vec3(
+                    roundf((p.x / p.w * 0.5f + 0.5f) * (float)m_width * 4.0f) * 0.25f,
+                    roundf((p.y / p.w * 0.5f + 0.5f) * (float)m_height * 4.0f) * 0.25f,
+                    p.z / p.w);
+            }
+            if (!behindNear)
+                m_triangles.push_back(triangle);
+        }
+    }
+
+    int bandCount = (m_height + kBandHeight - 1) / kBandHeight;
+    ParallelFor(bandCount, 1, [&](size_t band) {
+        int minY = (int)band * kBandHeight;
+        RasterizeBand(minY, std::min(minY + kBandHeight, m_height));
+    });
+    BuildHiZ();
+}
+
+void OcclusionCuller::RasterizeBand(int minY, int maxY) {
+    auto& depth = m_levels[0];
+    std::fill(depth.begin() + minY * m_width, depth.begin() + maxY * m_width, 1.0f);
+    for (auto& triangle: m_triangles)
+        RasterizeTriangle(triangle, minY, maxY);
+}
+
+void OcclusionCuller::RasterizeTriangle(const ScreenTriangle& triangle, int minY, int maxY) {
+    glm::vec3 a = triangle.v[0];
+    glm::vec3 b = triangle.v[1];
+    glm::vec3 c = triangle.v[2];
+    float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    if (fabsf(area) < 1e-6f)
+        return;
+    // both windings are rasterized, occluders need not be closed or consistent
+    if (area < 0.0f) {
+        std::swap(b, c);
+        area = -area;
+    }
+
+    int x0 = std::max(0, (int)floorf(std::min({ a.x, b.x, c.x })));
+    int x1 = std::min(m_width - 1, (int)ceilf(std::max({ a.x, b.x, c.x })));
+    int y0 = std::max(minY, (int)floorf(std::min({ a.y, b.y, c.y })));
+    int y1 = std::min(maxY - 1, (int)ceilf(std::max({ a.y, b.y, c.y })));
+    if (x0 > x1 || y0 > y1)
+        return;
+    x0 &= ~3;
+
+    // edge functions E(p) = A * x + B * y + C, positive inside
+    auto edge = [](const glm::vec3& p, const glm::vec3& q) {
+        float A = p.y - q.y;
+        float B = q.x - p.x;
+        return glm::vec3(A, B, -(A * p.x + B * p.y));
+    };
+    glm::vec3 eBC = edge(b, c);     // weight of a
+    glm::vec3 eCA = edge(c, a);     // weight of b
+    glm::vec3 eAB = edge(a, b);     // weight of c
+
+    // fill rule: a pixel center exactly on an edge belongs to only one of
+    // the two triangles sharing it
+    auto owns = [](const glm::vec3& e) {
+        return e.x > 0.0f || (e.x == 0.0f && e.y > 0.0f);
+    };
+    bool ownBC = owns(eBC);
+    bool ownCA = owns(eCA);
+    bool ownAB = owns(eAB);
+
+    // depth plane z = zx * x + zy * y + z0
+    float invArea = 1.0f / area;
+    float zx = (eBC.x * a.z + eCA.x * b.z + eAB.x * c.z) * invArea;
+    float zy = (eBC.y * a.z + eCA.y * b.z + eAB.y * c.z) * invArea;
+    float z0 = (eBC.z * a.z + eCA.z * b.z + eAB.z * c.z) * invArea;
+
+    auto& depth = m_levels[0];
+    for (int y = y0; y <= y1; y++) {
+        float py = (float)y + 0.5f;
+        float* row = depth.data() + y * m_width;
+#if defined(USE_SSE)
+        __m128 laneX = _mm_add_ps(_mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f), _mm_set1_ps((float)x0));
+        __m128 rowBC = _mm_set1_ps(eBC.y * py + eBC.z);
+        __m128 rowCA = _mm_set1_ps(eCA.y * py + eCA.z);
+        __m128 rowAB = _mm_set1_ps(eAB.y * py + eAB.z);
+        __m128 rowZ = _mm_set1_ps(zy * py + z0);
+        __m128 zero = _mm_setzero_ps();
+        __m128 four = _mm_set1_ps(4.0f);
+        __m128 ownerBC = _mm_castsi128_ps(_mm_set1_epi32(ownBC ? -1 : 0));
+        __m128 ownerCA = _mm_castsi128_ps(_mm_set1_epi32(ownCA ? -1 : 0));
+        __m128 ownerAB = _mm_castsi128_ps(_mm_set1_epi32(ownAB ? -1 : 0));
+        for (int x = x0; x <= x1; x += 4) {
+            __m128 w0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(eBC.x), laneX), rowBC);
+            __m128 w1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(eCA.x), laneX), rowCA);
+            __m128 w2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(eAB.x), laneX), rowAB);
+            __m128 inside = _mm_and_ps(
+                _mm_or_ps(_mm_cmpgt_ps(w0, zero), _mm_and_ps(ownerBC, _mm_cmpeq_ps(w0, zero))),
+                _mm_and_ps(
+                    _mm_or_ps(_mm_cmpgt_ps(w1, zero), _mm_and_ps(ownerCA, _mm_cmpeq_ps(w1, zero))),
+                    _mm_or_ps(_mm_cmpgt_ps(w2, zero), _mm_and_ps(ownerAB, _mm_cmpeq_ps(w2, zero)))));
+            if (_mm_movemask_ps(inside)) {
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zx), laneX), rowZ);
+                __m128 current = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_min_ps(current, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer),
+                    _mm_andnot_ps(inside, current)));
+            }
+            laneX = _mm_add_ps(laneX, four);
+        }
+#else
+        auto inside = [](const glm::vec3& e, bool owner, float px, float py) {
+            float w = e.x * px + e.y * py + e.z;
+            return w > 0.0f || (owner && w == 0.0f);
+        };
+        for (int x = x0; x <= x1; x++) {
+            float px = (float)x + 0.5f;
+            if (inside(eBC, ownBC, px, py) && inside(eCA, ownCA, px, py) &&
+                inside(eAB, ownAB, px, py)) {
+                row[x] = std::min(row[x], zx * px + zy * py + z0);
+            }
+        }
+#endif
+    }
+}
+
+void OcclusionCuller::BuildHiZ() {
+    for (size_t level = 1; level < m_levels.size(); level++) {
+        auto& src = m_levels[level - 1];
+        auto srcSize = m_levelSizes[level - 1];
+        auto& dst = m_levels[level];
+        auto dstSize = m_levelSizes[level];
+        for (int y = 0; y < dstSize.y; y++) {
+            int sy0 = y * 2;
+            int sy1 = std::min(sy0 + 1, srcSize.y - 1);
+            for (int x = 0; x < dstSize.x; x++) {
+                int sx0 = x * 2;
+                int sx1 = std::min(sx0 + 1, srcSize.x - 1);
+                dst[y * dstSize.x + x] = std::max(
+                    std::max(src[sy0 * srcSize.x + sx0], src[sy0 * srcSize.x + sx1]),
+                    std::max(src[sy1 * srcSize.x + sx0], src[sy1 * srcSize.x + sx1]));
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::IsVisible(const BoundingBox& box) const {
+    if (!box.IsValid())
+        return true;
+
+    // screen rectangle and nearest depth of the box
+    glm::vec2 rectMin(FLT_MAX);
+    glm::vec2 rectMax(-FLT_MAX);
+    float minZ = FLT_MAX;
+    for (int i = 0; i < 8; i++) {
+        auto corner = glm::vec3(
+            (i & 1) ? box.max.x : box.min.x,
+            (i & 2) ? box.max.y : box.min.y,
+            (i & 4) ? box.max.z : box.min.z);
+        auto p = m_viewProjection * glm::vec4(corner, 1.0f);
+        // crossing the near plane, too close to be hidden
+        if (p.w <= 1e-5f)
+            return true;
+        auto screen = glm::vec2(
+            (p.x / p.w * 0.5f + 0.5f) * (float)m_width,
+            (p.y / p.w * 0.5f + 0.5f) * (float)m_height);
+        rectMin = glm::min(rectMin, screen);
+        rectMax = glm::max(rectMax, screen);
+        minZ = std::min(minZ, p.z / p.w);
+    }
+    if (minZ < -1.0f)
+        return true;
+    if (rectMax.x < 0.0f || rectMax.y < 0.0f ||
+        rectMin.x >= (float)m_width || rectMin.y >= (float)m_height)
+        return true;     // off screen, left to frustum culling
+
+    int x0 = std::max(0, (int)floorf(rectMin.x));
+    int y0 = std::max(0, (int)floorf(rectMin.y));
+    int x1 = std::min(m_width - 1, (int)floorf(rectMax.x));
+    int y1 = std::min(m_height - 1, (int)floorf(rectMax.y));
+
+    // coarsest level where the rectangle spans at most 2x2 texels
+    size_t level = 0;
+    while (level + 1 < m_levels.size() &&
+        ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+        level++;
+
+    auto& hiZ = m_levels[level];
+    int levelWidth = m_levelSizes[level].x;
+    float maxDepth = 0.0f;
+    for (int y = y0 >> level; y <= (y1 >> level); y++)
+        for (int x = x0 >> level; x <= (x1 >> level); x++)
+            maxDepth = std::max(maxDepth, hiZ[y * levelWidth + x]);
+    return minZ <= maxDepth;
+}
+
+void OcclusionCuller::TestBoxes(const BoundsSoA& bounds, size_t begin, size_t end,
+    uint8_t* visible) const {
+    for (size_t i = begin; i < end; i++) {
+        if (!visible[i])
+            continue;
+        auto center = glm::vec3(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+        auto extent = glm::vec3(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+        if (!IsVisible(BoundingBox { center - extent, center + extent }))
+            visible[i] = 0;
+    }
+}
+
+
+
+DrawListBuilderUPtr DrawListBuilder::Create(size_t chunkSize) {
+    auto builder = DrawListBuilderUPtr(new DrawListBuilder());
+    // multiple of 8 keeps every chunk aligned to the SIMD width
+    builder->m_chunkSize = std::max<size_t>(8, (chunkSize + 7) & ~(size_t)7);
+    return std::move(builder);
+}
+
+const BoundsSoA& DrawListBuilder::UpdateBounds(const std::vector<SceneObject>& objects) {
+    m_worldBounds.Resize(objects.size());
+    ParallelFor(objects.size(), m_chunkSize, [&](size_t chunkIndex) {
+        size_t begin = chunkIndex * m_chunkSize;
+        size_t end = std::min(begin + m_chunkSize, objects.size());
+        for (size_t i = begin; i < end; i++) {
+            auto& object = objects[i];
+            m_worldBounds.Set(i, object.mesh ?
+                object.mesh->GetBoundingBox().Transform(object.modelTransform) : BoundingBox());
+        }
+    });
+    return m_worldBounds;
+}
+
+const DrawList& DrawListBuilder::Build(const std::vector<SceneObject>& objects,
+    const glm::mat4& viewProjection, const std::vector<uint8_t>* visibility) {
+
+    size_t chunkCount = (objects.size() + m_chunkSize - 1) / m_chunkSize;
+    m_chunkLists.resize(chunkCount);
+    m_visible.resize(objects.size());
+    auto frustum = Frustum::FromMatrix(viewProjection);
+
+    ParallelFor(objects.size(), m_chunkSize, [&](size_t chunkIndex) {
+        BuildChunk(chunkIndex, objects, viewProjection, frustum, visibility);
+    });
+
+    m_drawList.Clear();
+    for (auto& chunkList: m_chunkLists)
+        m_drawList.Append(chunkList);
+    return m_drawList;
+}
+
+void DrawListBuilder::BuildChunk(size_t chunkIndex,
+    const std::vector<SceneObject>& objects, const glm::mat4& viewProjection,
+    const Frustum& frustum, const std::vector<uint8_t>* visibility) {
+
+    auto& drawList = m_chunkLists[chunkIndex];
+    drawList.Clear();
+
+    size_t begin = chunkIndex * m_chunkSize;
+    size_t end = std::min(begin + m_chunkSize, objects.size());
+    if (m_frustumCulling)
+        CullBoxes(frustum, GetWorldBounds(), begin, end, m_visible.data());
+    else
+        std::fill(m_visible.begin() + begin, m_visible.begin() + end, 1);
+    if (visibility) {
+        for (size_t i = begin; i < end; i++)
+            m_visible[i] &= (*visibility)[i];
+    }
+
+    for (size_t i = begin; i < end; i++) {
+        auto& object = objects[i];
+        if (!object.mesh || !m_visible[i])
+            continue;
+        DrawCommand command;
+        command.mesh = object.mesh.get();
+        command.objectIndex = (uint32_t)i;
+        command.modelTransform = object.modelTransform;
+        command.transform = MultiplyMatrix(viewProjection, object.modelTransform);
+        command.normalTransform = ComputeNormalMatrix(object.modelTransform);
+        command.color = object.color;
+        drawList.commands.push_back(command);
+    }
+}
+
+
+
+float GetAttenuationRadius(const glm::vec3& attenuation, float intensity) {
+    float c = attenuation.x - 256.0f * intensity;
+    if (c >= 0.0f)
+        return 0.0f;
+    if (attenuation.z <= 0.0f)
+        return attenuation.y > 0.0f ? -c / attenuation.y : FLT_MAX;
+    return (-attenuation.y + sqrtf(attenuation.y * attenuation.y - 4.0f * attenuation.z * c)) /
+        (2.0f * attenuation.z);
+}
+
+void QueryLights(const LightBoundsSoA& bounds, const BoundingBox& box,
+    size_t begin, size_t end, std::vector<uint32_t>& result) {
+    size_t i = begin;
+#if defined(USE_SSE)
+    __m128 minX = _mm_set1_ps(box.min.x), maxX = _mm_set1_ps(box.max.x);
+    __m128 minY = _mm_set1_ps(box.min.y), maxY = _mm_set1_ps(box.max.y);
+    __m128 minZ = _mm_set1_ps(box.min.z), maxZ = _mm_set1_ps(box.max.z);
+    for (; i + 4 <= end; i += 4) {
+        __m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+        __m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+        __m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 r = _mm_loadu_ps(&bounds.radius[i]);
+        // distance from the center to the closest point of the box
+        __m128 dx = _mm_sub_ps(cx, _mm_min_ps(_mm_max_ps(cx, minX), maxX));
+        __m128 dy = _mm_sub_ps(cy, _mm_min_ps(_mm_max_ps(cy, minY), maxY));
+        __m128 dz = _mm_sub_ps(cz, _mm_min_ps(_mm_max_ps(cz, minZ), maxZ));
+        __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+            _mm_mul_ps(dz, dz));
+        int mask = _mm_movemask_ps(_mm_cmple_ps(distance2, _mm_mul_ps(r, r)));
+        for (int k = 0; k < 4; k++) {
+            if (mask & (1 << k))
+                result.push_back((uint32_t)(i + k));
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        auto center = glm::vec3(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+        auto toBox = center - glm::clamp(center, box.min, box.max);
+        if (glm::dot(toBox, toBox) <= bounds.radius[i] * bounds.radius[i])
+            result.push_back((uint32_t)i);
+    }
+}
+
+
+
+LightSetUPtr LightSet::Create() {
+    auto lightSet = LightSetUPtr(new LightSet());
+    if (!lightSet->Init())
+        return nullptr;
+    return std::move(lightSet);
+}
+
+bool LightSet::Init() {
+    m_dataTexture = BufferTexture::Create(GL_RGBA32F, sizeof(SceneLightData));
+    m_objectLightIndexTexture = BufferTexture::Create(GL_R32UI, sizeof(uint32_t));
+    return m_dataTexture && m_objectLightIndexTexture;
+}
+
+void LightSet::Update(const std::vector<SceneLight>& lights) {
+    // new entries get a key no light has
+    m_attenuationKeys.resize(lights.size(), glm::vec2(-1.0f));
+    m_attenuations.resize(lights.size());
+    m_data.resize(lights.size());
+    m_bounds.Resize(lights.size());
+    m_recomputedCount = 0;
+
+    for (size_t i = 0; i < lights.size(); i++) {
+        auto& light = lights[i];
+        auto key = glm::vec2(light.distance,
+            std::max(light.color.r, std::max(light.color.g, light.color.b)));
+        if (key != m_attenuationKeys[i]) {
+            auto coeff = GetAttenuationCoeff(key.x);
+            m_attenuations[i] = glm::vec4(coeff, GetAttenuationRadius(coeff, key.y));
+            m_attenuationKeys[i] = key;
+            m_recomputedCount++;
+        }
+        auto& attenuation = m_attenuations[i];
+
+        // point lights get a cone wider than the sphere
+        glm::vec2 cutoff = light.cutoff.x > 0.0f ?
+            glm::vec2(cosf(glm::radians(light.cutoff[0])),
+                cosf(glm::radians(light.cutoff[0] + light.cutoff[1]))) :
+            glm::vec2(-1.0f, -2.0f);
+        auto& data = m_data[i];
+        data.positionRadius = glm::vec4(light.position, attenuation.w);
+        data.color = glm::vec4(light.color, 1.0f);
+        data.directionInner = glm::vec4(glm::normalize(light.direction), cutoff.x);
+        data.attenuationOuter = glm::vec4(glm::vec3(attenuation), cutoff.y);
+        m_bounds.Set(i, light.position, attenuation.w);
+    }
+    m_dataTexture->UpdateData(m_data.data(), m_data.size());
+}
+
+void LightSet::CullObjects(const DrawList& drawList, const BoundsSoA& objectBounds) {
+    // draw lists keep the scene's object order, and objects are added
+    // spatially coherent (the cube grid row by row), so neighbouring
+    // commands are mostly neighbours in space and a chunk's box keeps
+    // few candidates
+    auto& commands = drawList.commands;
+    const size_t chunkSize = 64;
+    size_t chunkCount = (commands.size() + chunkSize - 1) / chunkSize;
+    if (m_cullChunks.size() < chunkCount)
+        m_cullChunks.resize(chunkCount);
+    m_objectLightRanges.resize(commands.size());
+
+    auto objectBox = [&](uint32_t index) {
+        auto center = glm::vec3(objectBounds.centerX[index],
+            objectBounds.centerY[index], objectBounds.centerZ[index]);
+        auto extent = glm::vec3(objectBounds.extentX[index],
+            objectBounds.extentY[index], objectBounds.extentZ[index]);
+        return BoundingBox { center - extent, center + extent };
+    };
+
+    ParallelFor(commands.size(), chunkSize, [&](size_t chunkIndex) {
+        auto& chunk = m_cullChunks[chunkIndex];
+        size_t begin = chunkIndex * chunkSize;
+        size_t end = std::min(begin + chunkSize, commands.size());
+
+        BoundingBox chunkBox;
+        for (size_t i = begin; i < end; i++)
+            chunkBox.Expand(objectBox(commands[i].objectIndex));
+        chunk.candidates.clear();
+        QueryLights(m_bounds, chunkBox, 0, m_bounds.Size(), chunk.candidates);
+
+        chunk.candidateBounds.Resize(chunk.candidates.size());
+        for (size_t c = 0; c < chunk.candidates.size(); c++) {
+            uint32_t light = chunk.candidates[c];
+            chunk.candidateBounds.Set(c, glm::vec3(m_bounds.centerX[light],
+                m_bounds.centerY[light], m_bounds.centerZ[light]), m_bounds.radius[light]);
+        }
+
+        // offsets are local to the chunk until the chunks are joined
+        chunk.indices.clear();
+        for (size_t i = begin; i < end; i++) {
+            chunk.matches.clear();
+            QueryLights(chunk.candidateBounds, objectBox(commands[i].objectIndex),
+                0, chunk.candidates.size(), chunk.matches);
+            m_objectLightRanges[i].offset = (uint32_t)chunk.indices.size();
+            m_objectLightRanges[i].count = (uint32_t)chunk.matches.size();
+            for (auto match: chunk.matches)
+                chunk.indices.push_back(chunk.candidates[match]);
+        }
+    });
+
+    m_objectLightIndices.clear();
+    for (size_t chunkIndex = 0; chunkIndex < chunkCount; chunkIndex++) {
+        auto& chunk = m_cullChunks[chunkIndex];
+        uint32_t base = (uint32_t)m_objectLightIndices.size();
+        size_t end = std::min((chunkIndex + 1) * chunkSize, commands.size());
+        for (size_t i = chunkIndex * chunkSize; i < end; i++)
+            m_objectLightRanges[i].offset += base;
+        m_objectLightIndices.insert(m_objectLightIndices.end(),
+            chunk.indices.begin(), chunk.indices.end());
+    }
+    m_objectLightIndexTexture->UpdateData(m_objectLightIndices.data(),
+        m_objectLightIndices.size());
+}
+
+
+
+DeferredRendererUPtr DeferredRenderer::Create(int width, int height) {
+    auto renderer = DeferredRendererUPtr(new DeferredRenderer());
+    if (!renderer->Init(width, height))
+        return nullptr;
+    return std::move(renderer);
+}
+
+bool DeferredRenderer::Init(int width, int height) {
+    m_geometryProgram = Program::Create("./shader/lighting-3-instanced.vs", "./shader/defer-geo.fs");
+    m_fullscreenProgram = Program::Create("./shader/defer-light.vs", "./shader/defer-light.fs");
+    m_volumeProgram = Program::Create("./shader/defer-volume.vs", "./shader/defer-volume.fs");
+    if (!m_geometryProgram || !m_fullscreenProgram || !m_volumeProgram)
+        return false;
+
+    m_plane = Mesh::CreatePlane();
+    // a box of its own, the light stream replaces the scene instance attributes
+    m_volume = Mesh::CreateBox();
+    return Resize(width, height);
+}
+
+bool DeferredRenderer::Resize(int width, int height) {
+    if (m_gBuffer && width == m_width && height == m_height)
+        return true;
+    m_width = std::max(width, 1);
+    m_height = std::max(height, 1);
+
+    // albedo rgb + specular a, world normal, depth for position reconstruction
+    m_gBuffer = Framebuffer::Create({
+        Texture::Create(m_width, m_height, GL_RGBA8),
+        Texture::Create(m_width, m_height, GL_RGBA16F, GL_FLOAT),
+    }, Texture::Create(m_width, m_height, GL_DEPTH24_STENCIL8, GL_UNSIGNED_INT_24_8));
+    return m_gBuffer != nullptr;
+}
+
+void DeferredRenderer::BeginGeometryPass(const glm::vec4& clearColor) {
+    m_gBuffer->Bind();
+    glViewport(0, 0, m_width, m_height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    glClearColor(clearColor.r, clearColor.g, clearColor.b, clearColor.a);
+    glEnable(GL_DEPTH_TEST);
+    m_geometryProgram->Use();
+}
+
+const Program* DeferredRenderer::BeginLightingPass(const glm::mat4& viewProjection,
+    const glm::vec3& viewPos, float shininess) {
+    m_viewProjection = viewProjection;
+    m_viewPos = viewPos;
+    m_shininess = shininess;
+
+    // scene depth goes to the default framebuffer for the volumes and
+    // anything drawn forward afterwards
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_gBuffer->Get());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, Framebuffer::GetDefault());
+    glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height,
+        GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+    Framebuffer::BindToDefault();
+    glViewport(0, 0, m_width, m_height);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    for (int i = 0; i < m_gBuffer->GetColorAttachmentCount(); i++) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        m_gBuffer->GetColorAttachment(i)->Bind();
+    }
+    glActiveTexture(GL_TEXTURE0 + m_gBuffer->GetColorAttachmentCount());
+    m_gBuffer->GetDepthStencilAttachment()->Bind();
+    glActiveTexture(GL_TEXTURE0);
+
+    m_fullscreenProgram->Use();
+    BindGBufferTextures(m_fullscreenProgram.get());
+    return m_fullscreenProgram.get();
+}
+
+void DeferredRenderer::BindGBufferTextures(const Program* program) const {
+    program->SetUniform("gAlbedoSpec", 0);
+    program->SetUniform("gNormal", 1);
+    program->SetUniform("gDepth", 2);
+    program->SetUniform("inverseViewProjection", glm::inverse(m_viewProjection));
+    program->SetUniform("screenSize", glm::vec2((float)m_width, (float)m_height));
+    program->SetUniform("viewPos", m_viewPos);
+    program->SetUniform("shininess", m_shininess);
+}
+
+void DeferredRenderer::DrawFullscreenLight() {
+    glDisable(GL_DEPTH_TEST);
+    m_plane->Draw();
+    glEnable(GL_DEPTH_TEST);
+}
+
+void DeferredRenderer::DrawLightVolumes(const LightSet& lights) {
+    if (lights.Size() == 0)
+        return;
+
+    // the light records are already uploaded, the same buffer is read
+    // as the per-light stream, attribute locations 3 ~ 6
+    auto layout = m_volume->GetVertexLayout();
+    layout->Bind();
+    glBindBuffer(GL_ARRAY_BUFFER, lights.GetDataTexture()->GetBuffer()->Get());
+    for (uint32_t i = 0; i < 4; i++) {
+        layout->SetAttrib(3 + i, 4, GL_FLOAT, false, sizeof(SceneLightData),
+            sizeof(glm::vec4) * i);
+        layout->SetAttribDivisor(3 + i, 1);
+    }
+    // the layout is the pool's, shared with the instanced draws, whose
+    // other instance attributes would be read past their stream
+    for (uint32_t i = 7; i < 16; i++)
+        layout->DisableAttrib(i);
+
+    m_volumeProgram->Use();
+    BindGBufferTextures(m_volumeProgram.get());
+    m_volumeProgram->SetUniform("viewProjection", m_viewProjection);
+
+    // back faces behind the scene surface cover every pixel inside the
+    // volume, also with the camera inside it. additive, no depth writes
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+    glDepthFunc(GL_GEQUAL);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_DEPTH_CLAMP);
+
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, m_volume->GetIndexCount(), GL_UNSIGNED_INT,
+        (const void*)(sizeof(uint32_t) * m_volume->GetFirstIndex()),
+        (GLsizei)lights.Size(), m_volume->GetBaseVertex());
+
+    glDisable(GL_DEPTH_CLAMP);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+    glCullFace(GL_BACK);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+}
+
+
+
+ClusteredLightsUPtr ClusteredLights::Create(int tileCountX, int tileCountY, int sliceCount) {
+    auto clusteredLights = ClusteredLightsUPtr(new ClusteredLights());
+    if (!clusteredLights->Init(tileCountX, tileCountY, sliceCount))
+        return nullptr;
+    return std::move(clusteredLights);
+}
+
+bool ClusteredLights::Init(int tileCountX, int tileCountY, int sliceCount) {
+    m_program = Program::Create("./shader/lighting-3-instanced.vs", "./shader/lighting-3-clustered.fs");
+    if (!m_program)
+        return false;
+
+    m_clusterTexture = BufferTexture::Create(GL_RG32UI, sizeof(LightListRange));
+    m_lightIndexTexture = BufferTexture::Create(GL_R32UI, sizeof(uint32_t));
+    if (!m_clusterTexture || !m_lightIndexTexture)
+        return false;
+
+    m_tileCountX = std::max(tileCountX, 1);
+    m_tileCountY = std::max(tileCountY, 1);
+    m_sliceCount = std::max(sliceCount, 1);
+    size_t clusterCount = (size_t)m_tileCountX * m_tileCountY * m_sliceCount;
+    m_columnRanges.resize(m_tileCountX * m_sliceCount);
+    m_rowRanges.resize(m_tileCountY * m_sliceCount);
+    m_sliceRanges.resize(m_sliceCount);
+    m_clusterLights.resize(clusterCount);
+    m_clusters.resize(clusterCount);
+    return true;
+}
+
+int ClusteredLights::GetSlice(float depth) const {
+    // slice z covers depths near * (far / near) ^ (z / sliceCount) and up
+    float slice = logf(depth / m_zNear) / logf(m_zFar / m_zNear) * (float)m_sliceCount;
+    return glm::clamp((int)floorf(slice), 0, m_sliceCount - 1);
+}
+
+void ClusteredLights::UpdateClusterBounds(const glm::mat4& projection,
+    float zNear, float zFar) {
+    if (projection == m_projection && zNear == m_zNear && zFar == m_zFar)
+        return;
+    m_projection = projection;
+    m_zNear = zNear;
+    m_zFar = zFar;
+
+    // view space extent of the tiles between ndc a and b over a depth range,
+    // the ray through ndc n is at (n + p2) * depth / p, see glm::perspective
+    auto tileRange = [](float ndcA, float ndcB, float p, float p2, const glm::vec2& depth) {
+        float a0 = (ndcA + p2) * depth.x / p, a1 = (ndcA + p2) * depth.y / p;
+        float b0 = (ndcB + p2) * depth.x / p, b1 = (ndcB + p2) * depth.y / p;
+        return glm::vec2(std::min(std::min(a0, a1), std::min(b0, b1)),
+            std::max(std::max(a0, a1), std::max(b0, b1)));
+    };
+
+    for (int z = 0; z < m_sliceCount; z++) {
+        auto depth = glm::vec2(
+            zNear * powf(zFar / zNear, (float)z / (float)m_sliceCount),
+            zNear * powf(zFar / zNear, (float)(z + 1) / (float)m_sliceCount));
+        m_sliceRanges[z] = glm::vec2(-depth.y, -depth.x);
+        for (int x = 0; x < m_tileCountX; x++) {
+            m_columnRanges[z * m_tileCountX + x] = tileRange(
+                2.0f * (float)x / (float)m_tileCountX - 1.0f,
+                2.0f * (float)(x + 1) / (float)m_tileCountX - 1.0f,
+                projection[0][0], projection[2][0], depth);
+        }
+        for (int y = 0; y < m_tileCountY; y++) {
+            m_rowRanges[z * m_tileCountY + y] = tileRange(
+                2.0f * (float)y / (float)m_tileCountY - 1.0f,
+                2.0f * (float)(y + 1) / (float)m_tileCountY - 1.0f,
+                projection[1][1], projection[2][1], depth);
+        }
+    }
+}
+
+void ClusteredLights::Build(const LightSet& lights,
+    const glm::mat4& view, const glm::mat4& projection, float zNear, float zFar) {
+    m_lightDataTexture = lights.GetDataTexture();
+    m_view = view;
+    UpdateClusterBounds(projection, zNear, zFar);
+
+    // view space spheres and the froxel range each one projects to
+    const size_t lightChunkSize = 256;
+    auto& spheres = lights.GetBounds();
+    m_lightBounds.resize(spheres.Size());
+    ParallelFor(spheres.Size(), lightChunkSize, [&](size_t chunkIndex) {
+        size_t begin = chunkIndex * lightChunkSize;
+        size_t end = std::min(begin + lightChunkSize, spheres.Size());
+        for (size_t i = begin; i < end; i++) {
+            auto& bounds = m_lightBounds[i];
+            bounds.center = glm::vec3(view * glm::vec4(
+                spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i], 1.0f));
+            bounds.radius = spheres.radius[i];
+            bounds.min = glm::ivec3(0, 0, 0);
+            bounds.max = glm::ivec3(-1, -1, -1);
+
+            float minDepth = -bounds.center.z - bounds.radius;
+            float maxDepth = -bounds.center.z + bounds.radius;
+            if (maxDepth < zNear || minDepth > zFar)
+                continue;
+
+            // a sphere reaching the near plane may cover the whole screen
+            glm::vec2 ndcMin = glm::vec2(-1.0f);
+            glm::vec2 ndcMax = glm::vec2(1.0f);
+            if (minDepth > zNear) {
+                ndcMin = glm::vec2(FLT_MAX);
+                ndcMax = glm::vec2(-FLT_MAX);
+                for (int corner = 0; corner < 8; corner++) {
+                    auto offset = glm::vec3(
+                        corner & 1 ? bounds.radius : -bounds.radius,
+                        corner & 2 ? bounds.radius : -bounds.radius,
+                        corner & 4 ? bounds.radius : -bounds.radius);
+                    auto clip = projection * glm::vec4(bounds.center + offset, 1.0f);
+                    auto ndc = glm::vec2(clip) / clip.w;
+                    ndcMin = glm::min(ndcMin, ndc);
+                    ndcMax = glm::max(ndcMax, ndc);
+                }
+                if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f)
+                    continue;
+            }
+
+            auto tile = [](float ndc, int tileCount) {
+                int tileIndex = (int)floorf((ndc * 0.5f + 0.5f) * (float)tileCount);
+                return glm::clamp(tileIndex, 0, tileCount - 1);
+            };
+            bounds.min = glm::ivec3(tile(ndcMin.x, m_tileCountX), tile(ndcMin.y, m_tileCountY),
+                GetSlice(std::max(minDepth, zNear)));
+            bounds.max = glm::ivec3(tile(ndcMax.x, m_tileCountX), tile(ndcMax.y, m_tileCountY),
+                GetSlice(std::min(maxDepth, zFar)));
+        }
+    });
+
+    // each slice fills its own froxels, in light order, after a sphere
+    // against froxel box test that trims the corners of the range. the
+    // squared distance is summed per axis, whole rows drop out early
+    ParallelFor(m_sliceCount, 1, [&](size_t z) {
+        size_t tileCount = m_tileCountX * m_tileCountY;
+        auto clusterLights = m_clusterLights.data() + z * tileCount;
+        auto columnRanges = m_columnRanges.data() + z * m_tileCountX;
+        auto rowRanges = m_rowRanges.data() + z * m_tileCountY;
+        for (size_t i = 0; i < tileCount; i++)
+            clusterLights[i].clear();
+
+        auto axisDistance = [](float center, const glm::vec2& range) {
+            float d = center - glm::clamp(center, range.x, range.y);
+            return d * d;
+        };
+        for (size_t i = 0; i < m_lightBounds.size(); i++) {
+            auto& bounds = m_lightBounds[i];
+            if ((int)z < bounds.min.z || (int)z > bounds.max.z)
+                continue;
+            float radius2 = bounds.radius * bounds.radius;
+            float distanceZ = axisDistance(bounds.center.z, m_sliceRanges[z]);
+            for (int y = bounds.min.y; y <= bounds.max.y; y++) {
+                float distanceYZ = distanceZ + axisDistance(bounds.center.y, rowRanges[y]);
+                if (distanceYZ > radius2)
+                    continue;
+                for (int x = bounds.min.x; x <= bounds.max.x; x++) {
+                    if (distanceYZ + axisDistance(bounds.center.x, columnRanges[x]) <= radius2)
+                        clusterLights[y * m_tileCountX + x].push_back((uint32_t)i);
+                }
+            }
+        }
+    });
+
+    m_lightIndices.clear();
+    m_maxClusterLightCount = 0;
+    for (size_t i = 0; i < m_clusters.size(); i++) {
+        auto& clusterLights = m_clusterLights[i];
+        m_clusters[i].offset = (uint32_t)m_lightIndices.size();
+        m_clusters[i].count = (uint32_t)clusterLights.size();
+        m_lightIndices.insert(m_lightIndices.end(), clusterLights.begin(), clusterLights.end());
+        m_maxClusterLightCount = std::max(m_maxClusterLightCount, m_clusters[i].count);
+    }
+
+    m_clusterTexture->UpdateData(m_clusters.data(), m_clusters.size());
+    m_lightIndexTexture->UpdateData(m_lightIndices.data(), m_lightIndices.size());
+}
+
+const Program* ClusteredLights::BeginForwardPass(int width, int height) {
+    glActiveTexture(GL_TEXTURE2);
+    m_lightDataTexture->Bind();
+    glActiveTexture(GL_TEXTURE3);
+    m_clusterTexture->Bind();
+    glActiveTexture(GL_TEXTURE4);
+    m_lightIndexTexture->Bind();
+    glActiveTexture(GL_TEXTURE0);
+
+    // froxel of a fragment: tile from gl_FragCoord, slice from log(depth)
+    float depthScale = (float)m_sliceCount / logf(m_zFar / m_zNear);
+    m_program->Use();
+    m_program->SetUniform("lightData", 2);
+    m_program->SetUniform("clusters", 3);
+    m_program->SetUniform("lightIndices", 4);
+    m_program->SetUniform("view", m_view);
+    m_program->SetUniform("clusterCount",
+        glm::vec3((float)m_tileCountX, (float)m_tileCountY, (float)m_sliceCount));
+    m_program->SetUniform("tileScale", glm::vec2(
+        (float)m_tileCountX / (float)std::max(width, 1),
+        (float)m_tileCountY / (float)std::max(height, 1)));
+    m_program->SetUniform("sliceScaleBias",
+        glm::vec2(depthScale, -logf(m_zNear) * depthScale));
+    return m_program.get();
+}
+
+
+
+ShadowMapsUPtr ShadowMaps::Create(int spotSize, int cascadeSize) {
+    auto shadowMaps = ShadowMapsUPtr(new ShadowMaps());
+    if (!shadowMaps->Init(spotSize, cascadeSize))
+        return nullptr;
+    return std::move(shadowMaps);
+}
+
+bool ShadowMaps::Init(int spotSize, int cascadeSize) {
+    m_depthProgram = Program::Create("./shader/shadow.vs", "./shader/shadow.fs");
+    if (!m_depthProgram)
+        return false;
+
+    // sampled maps compare against the depth with linear filtering, which
+    // gives 2x2 pcf, outside the map is lit
+    auto createDepth = [](int width, int height, bool sampled) {
+        TexturePtr texture = Texture::Create(width, height, GL_DEPTH_COMPONENT24, GL_UNSIGNED_INT);
+        if (sampled) {
+            texture->SetFilter(GL_LINEAR, GL_LINEAR);
+            texture->SetWrap(GL_CLAMP_TO_BORDER, GL_CLAMP_TO_BORDER);
+            float border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+            glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        }
+        return Framebuffer::Create({}, texture);
+    };
+    m_spotStatic = createDepth(spotSize, spotSize, false);
+    m_spot = createDepth(spotSize, spotSize, true);
+    m_sunStatic = createDepth(cascadeSize * CascadeCount, cascadeSize, false);
+    m_sun = createDepth(cascadeSize * CascadeCount, cascadeSize, true);
+    if (!m_spotStatic || !m_spot || !m_sunStatic || !m_sun)
+        return false;
+
+    m_maps[0].viewport = glm::ivec4(0, 0, spotSize, spotSize);
+    m_maps[0].staticFramebuffer = m_spotStatic.get();
+    m_maps[0].framebuffer = m_spot.get();
+    for (int i = 0; i < CascadeCount; i++) {
+        auto& map = m_maps[1 + i];
+        map.viewport = glm::ivec4(cascadeSize * i, 0, cascadeSize, cascadeSize);
+        map.staticFramebuffer = m_sunStatic.get();
+        map.framebuffer = m_sun.get();
+    }
+    Clear();
+    return true;
+}
+
+void ShadowMaps::SetSpotLight(const glm::vec3& position, const glm::vec3& direction,
+    float outerAngle, float range) {
+    auto forward = glm::normalize(direction);
+    auto up = fabsf(forward.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    float fov = glm::clamp(outerAngle * 2.0f, 1.0f, 160.0f);
+    m_maps[0].viewProjection =
+        glm::perspective(glm::radians(fov), 1.0f, 0.05f, std::max(range, 0.1f)) *
+        glm::lookAt(position, position + forward, up);
+}
+
+void ShadowMaps::SetSunLight(const glm::vec3& direction, const glm::mat4& view,
+    float fovY, float aspect, float zNear, float shadowDistance) {
+    auto forward = glm::normalize(direction);
+    auto up = fabsf(forward.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    auto sunView = glm::lookAt(glm::vec3(0.0f), forward, up);
+    auto inverseView = glm::inverse(view);
+    float tanY = tanf(fovY * 0.5f);
+    float tanX = tanY * aspect;
+
+    float splitNear = zNear;
+    for (int i = 0; i < CascadeCount; i++) {
+        // between logarithmic and uniform splits
+        float t = (float)(i + 1) / (float)CascadeCount;
+        float splitFar = glm::mix(zNear + (shadowDistance - zNear) * t,
+            zNear * powf(shadowDistance / zNear, t), 0.6f);
+
+        // a sphere around the slice keeps the size of the cascade fixed
+        // while the camera turns
+        glm::vec3 corners[8];
+        glm::vec3 center = glm::vec3(0.0f);
+        for (int c = 0; c < 8; c++) {
+            float depth = c & 4 ? splitFar : splitNear;
+            auto corner = glm::vec4(
+                (c & 1 ? tanX : -tanX) * depth, (c & 2 ? tanY : -tanY) * depth, -depth, 1.0f);
+            corners[c] = glm::vec3(inverseView * corner);
+            center += corners[c] * 0.125f;
+        }
+        float radius = 0.0f;
+        for (int c = 0; c < 8; c++)
+            radius = std::max(radius, glm::length(corners[c] - center));
+        radius = ceilf(radius * 16.0f) / 16.0f;
+
+        // moving the cascade in whole texels only keeps the cached
+        // depth valid and the edges from shimmering
+        auto& map = m_maps[1 + i];
+        float texel = 2.0f * radius / (float)map.viewport.z;
+        auto lightCenter = glm::vec3(sunView * glm::vec4(center, 1.0f));
+        lightCenter.x = floorf(lightCenter.x / texel) * texel;
+        lightCenter.y = floorf(lightCenter.y / texel) * texel;
+        map.viewProjection = glm::ortho(
+            lightCenter.x - radius, lightCenter.x + radius,
+            lightCenter.y - radius, lightCenter.y + radius,
+            -(lightCenter.z + radius + m_casterDistance), -(lightCenter.z - radius)) * sunView;
+        splitNear = splitFar;
+    }
+}
+
+bool ShadowMaps::IsStaticDirty(int map, uint32_t staticVersion) const {
+    auto& entry = m_maps[map];
+    return !entry.cached || entry.cachedVersion != staticVersion ||
+        entry.cachedViewProjection != entry.viewProjection;
+}
+
+void ShadowMaps::BindMap(int map, bool staticDepth) const {
+    auto& entry = m_maps[map];
+    (staticDepth ? entry.staticFramebuffer : entry.framebuffer)->Bind();
+    glViewport(entry.viewport.x, entry.viewport.y, entry.viewport.z, entry.viewport.w);
+    glScissor(entry.viewport.x, entry.viewport.y, entry.viewport.z, entry.viewport.w);
+    glEnable(GL_SCISSOR_TEST);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+    m_depthProgram->Use();
+}
+
+void ShadowMaps::BeginStaticPass(int map, uint32_t staticVersion) {
+    auto& entry = m_maps[map];
+    entry.cachedViewProjection = entry.viewProjection;
+    entry.cachedVersion = staticVersion;
+    entry.cached = true;
+    entry.staticUpdated = true;
+    m_staticPassCount++;
+
+    BindMap(map, true);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+bool ShadowMaps::BeginDynamicPass(int map, bool hasDynamicObjects) {
+    auto& entry = m_maps[map];
+    bool restore = entry.staticUpdated || entry.hadDynamicObjects || hasDynamicObjects;
+    entry.staticUpdated = false;
+    entry.hadDynamicObjects = hasDynamicObjects;
+    if (!restore)
+        return false;
+
+    auto& viewport = entry.viewport;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, entry.staticFramebuffer->Get());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, entry.framebuffer->Get());
+    glBlitFramebuffer(viewport.x, viewport.y, viewport.x + viewport.z, viewport.y + viewport.w,
+        viewport.x, viewport.y, viewport.x + viewport.z, viewport.y + viewport.w,
+        GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    if (!hasDynamicObjects)
+        return false;
+    m_dynamicPassCount++;
+    BindMap(map, false);
+    return true;
+}
+
+void ShadowMaps::EndPasses(int width, int height) {
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glDisable(GL_SCISSOR_TEST);
+    Framebuffer::BindToDefault();
+    glViewport(0, 0, width, height);
+}
+
+void ShadowMaps::Clear() {
+    for (auto framebuffer: { m_spotStatic.get(), m_spot.get(), m_sunStatic.get(), m_sun.get() }) {
+        framebuffer->Bind();
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+    Framebuffer::BindToDefault();
+    for (auto& map: m_maps) {
+        map.cached = false;
+        map.hadDynamicObjects = false;
+    }
+    m_staticPassCount = 0;
+    m_dynamicPassCount = 0;
+}
+
+void ShadowMaps::SetUniforms(const Program* program, int firstUnit) const {
+    // depth -1 ~ 1 to texture space 0 ~ 1
+    auto bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) *
+        glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+
+    glActiveTexture(GL_TEXTURE0 + firstUnit);
+    m_spot->GetDepthStencilAttachment()->Bind();
+    glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+    m_sun->GetDepthStencilAttachment()->Bind();
+    glActiveTexture(GL_TEXTURE0);
+
+    program->SetUniform("spotShadowMap", firstUnit);
+    program->SetUniform("spotShadowTransform", bias * m_maps[0].viewProjection);
+    program->SetUniform("sunShadowMap", firstUnit + 1);
+    FrameString name;
+    for (int i = 0; i < CascadeCount; i++) {
+        name.clear();
+        fmt::format_to(std::back_inserter(name), "sunShadowTransforms[{}]", i);
+        program->SetUniform(name.c_str(), bias * m_maps[1 + i].viewProjection);
+    }
+}
+
+
+
+ProfilerUPtr Profiler::Create() {
+    auto profiler = ProfilerUPtr(new Profiler());
+    profiler->m_frameHistory.resize(HistorySize, 0.0f);
+    profiler->m_gpuFrameHistory.resize(HistorySize, 0.0f);
+    return std::move(profiler);
+}
+
+Profiler::~Profiler() {
+    for (auto& queryFrame: m_queryFrames) {
+        if (!queryFrame.queries.empty())
+            glDeleteQueries((GLsizei)queryFrame.queries.size(), queryFrame.queries.data());
+    }
+}
+
+void Profiler::BeginFrame() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto now = Clock::now();
+    if (m_frameStarted)
+        CloseFrame(now);
+    m_frameStarted = true;
+    m_frameStart = now;
+
+    // the slot of this frame was last used QueryLatency frames ago
+    auto& queryFrame = m_queryFrames[m_frame % QueryLatency];
+    ResolveQueries(queryFrame);
+    queryFrame.frame = m_frame;
+}
+
+void Profiler::Flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_frameStarted)
+        CloseFrame(Clock::now());
+    m_frameStarted = false;
+    size_t first = m_frame > QueryLatency ? m_frame - QueryLatency : 0;
+    for (size_t frame = first; frame < m_frame; frame++) {
+        auto& queryFrame = m_queryFrames[frame % QueryLatency];
+        if (queryFrame.frame == frame)
+            ResolveQueries(queryFrame);
+    }
+}
+
+void Profiler::CloseFrame(Clock::time_point now) {
+    while (!m_zoneStack.empty())
+        PopZone();
+    for (auto& zone: m_zones) {
+        zone.cpuHistory[m_frame % HistorySize] = zone.cpuTime;
+        zone.cpuTotal += zone.cpuTime;
+        zone.cpuTime = 0.0f;
+    }
+    m_frameHistory[m_frame % HistorySize] =
+        std::chrono::duration<float, std::milli>(now - m_frameStart).count();
+    m_frame++;
+}
+
+void Profiler::ResetTotals() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& zone: m_zones) {
+        zone.cpuTotal = 0.0;
+        zone.gpuTotal = 0.0;
+    }
+    m_totalsFrame = m_frameStarted ? m_frame + 1 : m_frame;
+    m_totalGpuFrames = 0;
+}
+
+std::vector<Profiler::ZoneTotal> Profiler::GetTotals() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<ZoneTotal> totals;
+    for (auto zone: m_rootZones)
+        CollectTotals(zone, "", totals);
+    return totals;
+}
+
+void Profiler::CollectTotals(int index, const std::string& parentName,
+    std::vector<ZoneTotal>& totals) const {
+    auto& zone = m_zones[index];
+    auto name = parentName.empty() ? std::string(zone.name) : parentName + "/" + zone.name;
+    size_t frameCount = m_frame > m_totalsFrame ? m_frame - m_totalsFrame : 0;
+    totals.push_back({ name, zone.gpu,
+        frameCount ? (float)(zone.cpuTotal / (double)frameCount) : 0.0f,
+        m_totalGpuFrames ? (float)(zone.gpuTotal / (double)m_totalGpuFrames) : 0.0f });
+    for (auto child: zone.children)
+        CollectTotals(child, name, totals);
+}
+
+void Profiler::BeginZone(const char* name, bool gpu) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int parent = m_zoneStack.empty() ? -1 : m_zoneStack.back().zone;
+    int zone = FindZone(parent, name, gpu);
+    int timestamp = -1;
+    if (gpu) {
+        auto& queryFrame = m_queryFrames[m_frame % QueryLatency];
+        timestamp = (int)queryFrame.timestamps.size();
+        queryFrame.timestamps.push_back({ zone, NextQuery(queryFrame), 0 });
+        glQueryCounter(queryFrame.timestamps.back().beginQuery, GL_TIMESTAMP);
+    }
+    m_zoneStack.push_back({ zone, Clock::now(), timestamp });
+}
+
+void Profiler::EndZone() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    PopZone();
+}
+
+void Profiler::PopZone() {
+    if (m_zoneStack.empty())
+        return;
+    auto& active = m_zoneStack.back();
+    auto now = Clock::now();
+    m_zones[active.zone].cpuTime +=
+        std::chrono::duration<float, std::milli>(now - active.start).count();
+    TraceCapture::AddEvent(m_zones[active.zone].name, active.start, now);
+    if (active.timestamp >= 0) {
+        auto& queryFrame = m_queryFrames[m_frame % QueryLatency];
+        auto& timestamp = queryFrame.timestamps[active.timestamp];
+        timestamp.endQuery = NextQuery(queryFrame);
+        glQueryCounter(timestamp.endQuery, GL_TIMESTAMP);
+    }
+    m_zoneStack.pop_back();
+}
+
+int Profiler::FindZone(int parent, const char* name, bool gpu) {
+    auto& siblings = parent < 0 ? m_rootZones : m_zones[parent].children;
+    for (auto index: siblings) {
+        auto& zone = m_zones[index];
+        if (zone.gpu == gpu && strcmp(zone.name, name) == 0)
+            return index;
+    }
+
+    int index = (int)m_zones.size();
+    Zone zone;
+    zone.name = name;
+    zone.parent = parent;
+    zone.depth = parent < 0 ? 0 : m_zones[parent].depth + 1;
+    zone.gpu = gpu;
+    zone.firstFrame = m_frame;
+    zone.firstGpuFrame = m_frame;
+    zone.cpuHistory.resize(HistorySize, 0.0f);
+    zone.gpuHistory.resize(HistorySize, 0.0f);
+    m_zones.push_back(std::move(zone));
+    // siblings may have moved with m_zones
+    (parent < 0 ? m_rootZones : m_zones[parent].children).push_back(index);
+    return index;
+}
+
+GLuint Profiler::NextQuery(QueryFrame& queryFrame) {
+    if (queryFrame.usedQueries == queryFrame.queries.size()) {
+        GLuint query = 0;
+        glGenQueries(1, &query);
+        queryFrame.queries.push_back(query);
+    }
+    return queryFrame.queries[queryFrame.usedQueries++];
+}
+
+void Profiler::ResolveQueries(QueryFrame& queryFrame) {
+    if (queryFrame.usedQueries == 0)
+        return;
+
+    // the results were written frames ago, reading them does not stall
+    size_t slot = queryFrame.frame % HistorySize;
+    bool counted = queryFrame.frame >= m_totalsFrame;
+    for (auto& zone: m_zones) {
+        if (zone.gpu)
+            zone.gpuHistory[slot] = 0.0f;
+    }
+    GLuint64 frameBegin = ~(GLuint64)0;
+    GLuint64 frameEnd = 0;
+    for (auto& timestamp: queryFrame.timestamps) {
+        if (!timestamp.endQuery)
+            continue;
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(timestamp.beginQuery, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(timestamp.endQuery, GL_QUERY_RESULT, &end);
+        float time = (float)(end - begin) * 1e-6f;
+        m_zones[timestamp.zone].gpuHistory[slot] += time;
+        if (counted)
+            m_zones[timestamp.zone].gpuTotal += time;
+        frameBegin = std::min(frameBegin, begin);
+        frameEnd = std::max(frameEnd, end);
+    }
+    m_gpuFrameHistory[slot] = frameEnd > frameBegin ? (float)(frameEnd - frameBegin) * 1e-6f : 0.0f;
+    m_gpuFrame = queryFrame.frame + 1;
+    if (counted)
+        m_totalGpuFrames++;
+
+    queryFrame.usedQueries = 0;
+    queryFrame.timestamps.clear();
+}
+
+float Profiler::GetAverage(const std::vector<float>& history, size_t first, size_t end) const {
+    first = std::max(first, end > HistorySize ? end - HistorySize : 0);
+    if (first >= end)
+        return 0.0f;
+    float sum = 0.0f;
+    for (size_t frame = first; frame < end; frame++)
+        sum += history[frame % HistorySize];
+    return sum / (float)(end - first);
+}
+
+float Profiler::GetPercentile(float* samples, size_t count, float percentile) {
+    if (count == 0)
+        return 0.0f;
+    size_t index = std::min((size_t)(percentile * (float)count), count - 1);
+    std::nth_element(samples, samples + index, samples + count);
+    return samples[index];
+}
+
+void Profiler::DrawOverlay() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ImGui::SetNextWindowPos(ImVec2(360.0f, 10.0f), ImGuiCond_FirstUseEver);
+    if (ImGui::Begin("profiler")) {
+        size_t frameEnd = m_frame;
+        size_t frameFirst = frameEnd > HistorySize ? frameEnd - HistorySize : 0;
+        FrameVector<float> samples;
+        samples.reserve(HistorySize);
+        for (size_t frame = frameFirst; frame < frameEnd; frame++)
+            samples.push_back(m_frameHistory[frame % HistorySize]);
+        float average = GetAverage(m_frameHistory, frameFirst, frameEnd);
+        float p50 = GetPercentile(samples.data(), samples.size(), 0.50f);
+        float p95 = GetPercentile(samples.data(), samples.size(), 0.95f);
+        float p99 = GetPercentile(samples.data(), samples.size(), 0.99f);
+        ImGui::Text("frame: %.2f ms avg, p50 %.2f, p95 %.2f, p99 %.2f",
+            average, p50, p95, p99);
+
+        // from the first to the last timestamp of the frame
+        if (m_gpuFrame > 0) {
+            size_t gpuFirst = m_gpuFrame > HistorySize ? m_gpuFrame - HistorySize : 0;
+            samples.clear();
+            for (size_t frame = gpuFirst; frame < m_gpuFrame; frame++)
+                samples.push_back(m_gpuFrameHistory[frame % HistorySize]);
+            average = GetAverage(m_gpuFrameHistory, gpuFirst, m_gpuFrame);
+            p50 = GetPercentile(samples.data(), samples.size(), 0.50f);
+            p95 = GetPercentile(samples.data(), samples.size(), 0.95f);
+            p99 = GetPercentile(samples.data(), samples.size(), 0.99f);
+            ImGui::Text("gpu:   %.2f ms avg, p50 %.2f, p95 %.2f, p99 %.2f",
+                average, p50, p95, p99);
+        }
+
+        if (ImGui::Button("capture trace"))
+            TraceCapture::Start("./trace.json", 120);
+        ImGui::SameLine();
+        ImGui::Text("%s", TraceCapture::IsCapturing() ? "capturing" : "120 frames to trace.json");
+
+        ImGui::PlotLines("frame ms", m_frameHistory.data(), HistorySize,
+            (int)(frameEnd % HistorySize), nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+
+#if defined(USE_PROFILER)
+        if (ImGui::BeginTable("zones", 3)) {
+            ImGui::TableSetupColumn("zone");
+            ImGui::TableSetupColumn("cpu ms");
+            ImGui::TableSetupColumn("gpu ms");
+            ImGui::TableHeadersRow();
+            for (auto zone: m_rootZones)
+                DrawZone(zone);
+            ImGui::EndTable();
+        }
+#else
+        ImGui::Text("zones are compiled out, build with USE_PROFILER");
+#endif
+    }
+    ImGui::End();
+}
+
+void Profiler::DrawZone(int index) const {
+    auto& zone = m_zones[index];
+    ImGui::TableNextRow();
+    ImGui::TableNextColumn();
+    ImGui::Text("%*s%s", zone.depth * 2, "", zone.name);
+    ImGui::TableNextColumn();
+    ImGui::Text("%.3f", GetAverage(zone.cpuHistory, zone.firstFrame, m_frame));
+    ImGui::TableNextColumn();
+    if (zone.gpu)
+        ImGui::Text("%.3f", GetAverage(zone.gpuHistory, zone.firstGpuFrame, m_gpuFrame));
+    for (auto child: zone.children)
+        DrawZone(child);
+}
+
+
+
+ContextUPtr Context::Create(const std::string& modelFilename) {
+    auto context = ContextUPtr(new Context());
+    if (!context->Init(modelFilename))
+        return nullptr;
+    return std::move(context);
+}
+
+void Context::ProcessInput(GLFWwindow* window) {
+    m_cameraMove = glm::vec3(0.0f);
+    if (!m_cameraControl)
+        return;
+
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+        m_cameraMove.z += 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+        m_cameraMove.z -= 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+        m_cameraMove.x += 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+        m_cameraMove.x -= 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
+        m_cameraMove.y += 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
+        m_cameraMove.y -= 1.0f;
+}
+
+void Context::Simulate(float stepTime) {
+    m_prevSimulationTime = m_simulationTime;
+    m_simulationTime += stepTime;
+    m_prevCameraPos = m_cameraPos;
+    if (m_cameraMove == glm::vec3(0.0f))
+        return;
+
+    // 0.05 a step at 60 steps a second
+    const float cameraSpeed = 3.0f;
+    auto cameraRight = glm::normalize(glm::cross(m_cameraUp, -m_cameraFront));
+    auto cameraUp = glm::normalize(glm::cross(-m_cameraFront, cameraRight));
+    m_cameraPos += cameraSpeed * stepTime * (m_cameraMove.z * m_cameraFront +
+        m_cameraMove.x * cameraRight + m_cameraMove.y * cameraUp);
+}
+
+void Context::Reshape(int width, int height) {
+    // the viewport and the g-buffer follow in Render
+    m_state.width = width;
+    m_state.height = height;
+}
+
+void Context::MouseMove(double x, double y) {
+    if (!m_cameraControl)
+        return;
+    auto pos = glm::vec2((float)x, (float)y);
+    auto deltaPos = pos - m_prevMousePos;
+
+    const float cameraRotSpeed = 0.8f;
+    m_cameraYaw -= deltaPos.x * cameraRotSpeed;
+    m_cameraPitch -= deltaPos.y * cameraRotSpeed;
+
+    if (m_cameraYaw < 0.0f)   m_cameraYaw += 360.0f;
+    if (m_cameraYaw > 360.0f) m_cameraYaw -= 360.0f;
+
+    if (m_cameraPitch > 89.0f)  m_cameraPitch = 89.0f;
+    if (m_cameraPitch < -89.0f) m_cameraPitch = -89.0f;
+
+    m_prevMousePos = pos;    
+}
+
+void Context::MouseButton(int button, int action, double x, double y) {
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS &&
+        !ImGui::GetIO().WantCaptureMouse) {
+        m_state.pick = true;
+        m_state.pickPos = glm::vec2((float)x, (float)y);
+    }
+
+    if (button == GLFW_MOUSE_BUTTON_RIGHT) {
+        if (action == GLFW_PRESS) {
+            m_prevMousePos = glm::vec2((float)x, (float)y);
+            m_cameraControl = true;
+        }
+        else if (action == GLFW_RELEASE) {
+            m_cameraControl = false;
+        }
+    }
+}
+
+void Context::Update(FrameState& state) {
+    TRACE_SCOPE("Context::Update");
+    if (!m_fixedTime) {
+        TRACE_SCOPE("simulation");
+        m_cameraFront =
+            glm::rotate(glm::mat4(1.0f), glm::radians(m_cameraYaw), glm::vec3(0.0f, 1.0f, 0.0f)) *
+            glm::rotate(glm::mat4(1.0f), glm::radians(m_cameraPitch), glm::vec3(1.0f, 0.0f, 0.0f)) *
+            glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+        m_simulationSteps = m_frameClock.Advance(GetTime());
+        for (int i = 0; i < m_simulationSteps; i++)
+            Simulate((float)m_frameClock.GetStepTime());
+    }
+
+    FrameStats stats;
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        stats = m_stats;
+    }
+
+    if (ImGui::Begin("ui window")) {
+    
+        ImGui::ColorEdit4("clear color", glm::value_ptr(m_state.clearColor));
+
+        // camera
+        ImGui::Separator();
+        if (ImGui::DragFloat3("camera pos", glm::value_ptr(m_cameraPos), 0.01f))
+            m_prevCameraPos = m_cameraPos;
+        ImGui::DragFloat("camera yaw", &m_cameraYaw, 0.5f);
+        ImGui::DragFloat("camera pitch", &m_cameraPitch, 0.5f, -89.0f, 89.0f);
+        ImGui::Separator();
+
+        if (ImGui::Button("reset camera")) {
+            m_cameraYaw = 0.0f;
+            m_cameraPitch = 0.0f;
+            m_cameraPos = glm::vec3(0.0f, 0.0f, 3.0f);
+            m_prevCameraPos = m_cameraPos;
+        }
+        ImGui::Text("simulation: %d steps of %.1f ms", m_simulationSteps,
+            m_frameClock.GetStepTime() * 1000.0);
+
+
+        ImGui::Checkbox("animation", &m_state.animation);
+        ImGui::DragInt("cube count", &m_state.cubeCount, 10.0f, 0, 100000);
+        ImGui::DragFloat("model rotation", &m_state.modelRotation, 0.5f);
+        ImGui::Checkbox("frustum culling", &m_state.frustumCulling);
+        ImGui::Checkbox("bvh culling", &m_state.bvhCulling);
+        ImGui::Checkbox("occlusion culling", &m_state.occlusionCulling);
+        ImGui::DragInt("max occluders", &m_state.maxOccluders, 1.0f, 0, 1024);
+        ImGui::Text("occluders: %d, triangles: %d", stats.occluders, stats.occluderTriangles);
+        ImGui::Text("objects: %d, drawn: %d", stats.objects, stats.drawn);
+        ImGui::Text("picked object: %d", stats.pickedObject);
+        ImGui::Text("frame arena: %zu KB peak, %zu KB reserved",
+            stats.arenaPeak / 1024, stats.arenaCapacity / 1024);
+        ImGui::Text("stream buffer: %zu KB per frame, %zu stalls",
+            stats.streamRegionSize / 1024, stats.streamStalls);
+        ImGui::Text("geometry pool: %u / %u vertices, %u / %u indices",
+            stats.poolVertices, stats.poolVertexCapacity,
+            stats.poolIndices, stats.poolIndexCapacity);
+        const char* shadingPaths[] = {
+            "forward", "deferred", "clustered forward", "per-object forward" };
+        ImGui::Combo("shading", &m_state.shadingPath, shadingPaths, 4);
+        ImGui::DragInt("local lights", &m_state.sceneLightCount, 1.0f, 0, 4096);
+        ImGui::DragFloat("local light range", &m_state.sceneLightRange, 0.05f, 0.5f, 32.0f);
+        if (m_state.shadingPath == ClusteredShading) {
+            ImGui::Text("light indices: %d, max per cluster: %d",
+                stats.clusterLightIndices, stats.maxClusterLights);
+        }
+        if (m_state.shadingPath == ObjectLightShading)
+            ImGui::Text("object light indices: %d", stats.objectLightIndices);
+
+        ImGui::Checkbox("shadows", &m_state.shadows);
+        ImGui::Text("shadow passes: %d static, %d dynamic",
+            stats.staticShadowPasses, stats.dynamicShadowPasses);
+
+        auto& light = m_state.light;
+        if (ImGui::CollapsingHeader("light", ImGuiTreeNodeFlags_DefaultOpen)) {
+            ImGui::DragFloat3("l.position", glm::value_ptr(light.position), 0.01f);
+            ImGui::DragFloat3("l.direction", glm::value_ptr(light.direction), 0.01f);
+            // ImGui::DragFloat2("l.cutoff", &m_light.cutoff, 0.1f, 0.0f, 180.0f);
+            ImGui::DragFloat2("l.cutoff", glm::value_ptr(light.cutoff), 0.1f, 0.0f, 180.0f);
+            ImGui::DragFloat("l.distance", &light.distance, 0.5f, 0.0f, 1000.0f);
+            ImGui::ColorEdit3("l.ambient", glm::value_ptr(light.ambient));
+            ImGui::ColorEdit3("l.diffuse", glm::value_ptr(light.diffuse));
+            ImGui::ColorEdit3("l.specular", glm::value_ptr(light.specular));
+        }
+
+        if (ImGui::CollapsingHeader("sun")) {
+            ImGui::DragFloat3("s.direction", glm::value_ptr(m_state.sunDirection), 0.01f);
+            ImGui::ColorEdit3("s.color", glm::value_ptr(m_state.sunColor));
+            ImGui::DragFloat("s.shadow distance", &m_state.sunShadowDistance, 0.1f, 1.0f, 200.0f);
+        }
+
+        // material
+        if (ImGui::CollapsingHeader("material", ImGuiTreeNodeFlags_DefaultOpen)) {
+            // ImGui::ColorEdit3("m.ambient", glm::value_ptr(m_light.ambient));
+            // ImGui::ColorEdit3("m.diffuse", glm::value_ptr(m_light.diffuse));
+            // ImGui::ColorEdit3("m.specular", glm::value_ptr(m_light.specular));
+            ImGui::DragFloat("m.shininess", &m_state.shininess, 1.0f, 1.0f, 256.0f);
+        }
+    }
+    ImGui::End();
+    m_profiler->DrawOverlay();
+
+    // a fixed clock is rendered as it is, a live one between the last
+    // two simulation steps
+    float alpha = m_fixedTime ? 1.0f : m_frameClock.GetAlpha();
+    if (!m_fixedTime)
+        m_state.time = m_prevSimulationTime + (m_simulationTime - m_prevSimulationTime) * alpha;
+    m_state.cameraPos = glm::mix(m_prevCameraPos, m_cameraPos, alpha);
+    m_state.cameraYaw = m_cameraYaw;
+    m_state.cameraPitch = m_cameraPitch;
+    state = m_state;
+    // a click is picked in one frame
+    m_state.pick = false;
+    FrameArena::Get().Reset();
+}
+
+void Context::Render(const FrameState& state) {
+    m_profiler->BeginFrame();
+    PROFILE_SCOPE(m_profiler.get(), "render");
+    m_frameDrawCallCount = 0;
+    ApplyFrameState(state);
+    m_streamBuffer->BeginFrame();
+
+    // glClear(GL_COLOR_BUFFER_BIT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+
+    m_program->Use();
+
+    glm::vec3 cameraFront =
+        glm::rotate(glm::mat4(1.0f), glm::radians(m_frame.cameraYaw), glm::vec3(0.0f, 1.0f, 0.0f)) *
+        glm::rotate(glm::mat4(1.0f), glm::radians(m_frame.cameraPitch), glm::vec3(1.0f, 0.0f, 0.0f)) *
+        glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+    
+    // m_cameraFront = glm::rotate(glm::mat4(1.0f),
+    //     glm::radians(m_cameraYaw), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::rotate(glm::mat4(1.0f),
+    //     glm::radians(m_cameraPitch), glm::vec3(1.0f, 0.0f, 0.0f)) * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+
+    auto view = glm::lookAt( m_frame.cameraPos,
+        m_frame.cameraPos + cameraFront, m_cameraUp);
+
+    auto projection = glm::perspective(glm::radians(30.0f), 
+        // (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.01f, 10.0f);
+        (float)m_width / (float)m_height, m_cameraNear, m_cameraFar);
+    // auto view = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -5.0f));
+    // auto model = glm::rotate(glm::mat4(1.0f), glm::radians((float)glfwGetTime() * 60.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    // auto model = glm::rotate(glm::mat4(1.0f), glm::radians(60.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    // auto transform = projection * view * model;
+    // m_program->SetUniform("transform", transform);
+
+    // drawing a light emmiting object - didn;;t show -- fix it
+    auto lightModelTransform = glm::translate(glm::mat4(1.0), m_lightPos) *
+        glm::scale(glm::mat4(1.0), glm::vec3(0.1f));
+        
+    // m_program->Use();
+
+    // m_simpleProgram->SetUniform("color", glm::vec4(m_light.ambient + m_light.diffuse, 1.0f));
+    // m_simpleProgram->SetUniform("transform", projection * view * lightModelTransform);
+    
+    // // glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+    // m_box->Draw();
+
+    // the light box is now the first scene object, drawn with everything else
+    m_sceneObjects[0].modelTransform = lightModelTransform;
+    m_sceneObjects[0].color = glm::vec4(m_frame.light.ambient + m_frame.light.diffuse, 1.0f);
+
+    {
+        PROFILE_SCOPE(m_profiler.get(), "update");
+        UpdateCubes();
+        UpdateModel();
+        m_viewProjection = projection * view;
+
+        // per-object work runs on worker threads, GL calls stay on this thread
+        m_drawListBuilder->UpdateBounds(m_sceneObjects);
+        m_bvhStale = true;
+    }
+    // before any lighting uniforms, they take this frame's shadow matrices
+    if (m_frame.shadows) {
+        PROFILE_GPU_SCOPE(m_profiler.get(), "shadows");
+        RenderShadows(view);
+    }
+
+    m_program->Use();
+    m_program->SetUniform("viewPos", m_frame.cameraPos);
+    SetLightUniforms(m_program.get());
+
+    // m_program->SetUniform("material.ambient", m_material.ambient);
+    // m_program->SetUniform("material.diffuse", m_material.diffuse);
+    m_program->SetUniform("material.diffuse", 0);   // slut number 0
+    // m_program->SetUniform("material.specular", m_material.specular);
+    m_program->SetUniform("material.specular", 1);
+    m_program->SetUniform("material.shininess", m_frame.shininess);
+
+    glActiveTexture(GL_TEXTURE0);
+    m_material.diffuse->Bind();
+    glActiveTexture(GL_TEXTURE1);
+    m_material.specular->Bind();
+
+    auto frustum = Frustum::FromMatrix(m_viewProjection);
+    const std::vector<uint8_t>* visibility = nullptr;
+    {
+        PROFILE_SCOPE(m_profiler.get(), "culling");
+        if (m_frame.frustumCulling && m_frame.bvhCulling) {
+            UpdateBvh();
+            m_bvh->QueryFrustum(frustum, m_bvhResult);
+            m_visibility.assign(m_sceneObjects.size(), 0);
+            for (auto index: m_bvhResult)
+                m_visibility[index] = 1;
+            visibility = &m_visibility;
+        }
+        if (m_frame.occlusionCulling) {
+            if (!visibility) {
+                m_visibility.assign(m_sceneObjects.size(), 1);
+                visibility = &m_visibility;
+            }
+            CollectOccluders(frustum);
+            m_occlusionCuller->RenderOccluders(m_occluders, m_viewProjection);
+            m_occlusionCuller->TestBoxes(m_drawListBuilder->GetWorldBounds(),
+                0, m_sceneObjects.size(), m_visibility.data());
+        }
+        else {
+            m_occluders.clear();
+        }
+    }
+
+    const DrawList* drawListPtr = nullptr;
+    {
+        PROFILE_SCOPE(m_profiler.get(), "draw list");
+        m_drawListBuilder->SetFrustumCulling(m_frame.frustumCulling && !m_frame.bvhCulling);
+        drawListPtr = &m_drawListBuilder->Build(m_sceneObjects, m_viewProjection, visibility);
+    }
+    auto& drawList = *drawListPtr;
+    if (m_frame.shadingPath == DeferredShading) {
+        {
+            PROFILE_SCOPE(m_profiler.get(), "scene lights");
+            UpdateSceneLights();
+        }
+        {
+            PROFILE_GPU_SCOPE(m_profiler.get(), "geometry pass");
+            m_deferredRenderer->BeginGeometryPass(m_frame.clearColor);
+            auto geometryProgram = m_deferredRenderer->GetGeometryProgram();
+            geometryProgram->SetUniform("material.diffuse", 0);
+            geometryProgram->SetUniform("material.specular", 1);
+            SubmitDrawList(drawList);
+        }
+
+        PROFILE_GPU_SCOPE(m_profiler.get(), "lighting pass");
+        auto lightingProgram = m_deferredRenderer->BeginLightingPass(
+            m_viewProjection, m_frame.cameraPos, m_frame.shininess);
+        SetLightUniforms(lightingProgram);
+        m_deferredRenderer->DrawFullscreenLight();
+        m_deferredRenderer->DrawLightVolumes(*m_lightSet);
+    }
+    else if (m_frame.shadingPath == ClusteredShading) {
+        {
+            PROFILE_SCOPE(m_profiler.get(), "scene lights");
+            UpdateSceneLights();
+            m_clusteredLights->Build(*m_lightSet, view, projection, m_cameraNear, m_cameraFar);
+        }
+
+        PROFILE_GPU_SCOPE(m_profiler.get(), "forward pass");
+        auto clusteredProgram = m_clusteredLights->BeginForwardPass(m_width, m_height);
+        clusteredProgram->SetUniform("viewPos", m_frame.cameraPos);
+        SetLightUniforms(clusteredProgram);
+        clusteredProgram->SetUniform("material.diffuse", 0);
+        clusteredProgram->SetUniform("material.specular", 1);
+        clusteredProgram->SetUniform("material.shininess", m_frame.shininess);
+        SubmitDrawList(drawList);
+    }
+    else if (m_frame.shadingPath == ObjectLightShading) {
+        {
+            PROFILE_SCOPE(m_profiler.get(), "scene lights");
+            UpdateSceneLights();
+            m_lightSet->CullObjects(drawList, m_drawListBuilder->GetWorldBounds());
+        }
+
+        PROFILE_GPU_SCOPE(m_profiler.get(), "forward pass");
+        glActiveTexture(GL_TEXTURE2);
+        m_lightSet->GetDataTexture()->Bind();
+        glActiveTexture(GL_TEXTURE3);
+        m_lightSet->GetObjectLightIndexTexture()->Bind();
+        glActiveTexture(GL_TEXTURE0);
+
+        m_objectLightProgram->Use();
+        m_objectLightProgram->SetUniform("viewPos", m_frame.cameraPos);
+        SetLightUniforms(m_objectLightProgram.get());
+        m_objectLightProgram->SetUniform("material.diffuse", 0);
+        m_objectLightProgram->SetUniform("material.specular", 1);
+        m_objectLightProgram->SetUniform("material.shininess", m_frame.shininess);
+        m_objectLightProgram->SetUniform("lightData", 2);
+        m_objectLightProgram->SetUniform("lightIndices", 3);
+        SubmitDrawList(drawList, &m_lightSet->GetObjectLightRanges());
+    }
+    else {
+        PROFILE_GPU_SCOPE(m_profiler.get(), "forward pass");
+        SubmitDrawList(drawList);
+    }
+    // m_model->Draw(m_program.get());
+    // m_model->Draw();
+
+    // for (size_t i = 0; i < cubePositions.size(); i++){
+    //     auto& pos = cubePositions[i];
+    //     auto model = glm::translate(glm::mat4(1.0f), pos);
+    //     model = glm::rotate(model,
+    //         // glm::radians((float)glfwGetTime() * 60.0f + 20.0f * (float)i),
+    //         glm::radians((m_animation ? (float)glfwGetTime() : 0.0f)* 60.0f + 20.0f * (float)i),
+    //         glm::vec3(1.0f, 0.5f, 0.0f));
+    //     auto transform = projection * view * model;
+    //     m_program->SetUniform("transform", transform);
+    //     m_program->SetUniform("modelTransform", model);
+        
+    //     // glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+    //     m_box->Draw();
+    // }
+
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    m_stats.occluders = (int)m_occluders.size();
+    m_stats.occluderTriangles = (int)m_occlusionCuller->GetTriangleCount();
+    m_stats.objects = (int)m_sceneObjects.size();
+    m_stats.drawn = (int)drawList.Size();
+    m_stats.pickedObject = m_pickedObject;
+    m_stats.clusterLightIndices = (int)m_clusteredLights->GetLightIndexCount();
+    m_stats.maxClusterLights = (int)m_clusteredLights->GetMaxClusterLightCount();
+    m_stats.objectLightIndices = (int)m_lightSet->GetObjectLightIndexCount();
+    m_stats.staticShadowPasses = m_shadowMaps->GetStaticPassCount();
+    m_stats.dynamicShadowPasses = m_shadowMaps->GetDynamicPassCount();
+    m_streamBuffer->EndFrame();
+    m_stats.streamRegionSize = m_streamBuffer->GetRegionSize();
+    m_stats.streamStalls = m_streamBuffer->GetStallCount();
+    auto pool = GeometryPool::Get();
+    m_stats.poolVertices = pool->GetUsedVertexCount();
+    m_stats.poolVertexCapacity = pool->GetVertexCapacity();
+    m_stats.poolIndices = pool->GetUsedIndexCount();
+    m_stats.poolIndexCapacity = pool->GetIndexCapacity();
+
+    // the frame's transient allocations end here
+    auto& arena = FrameArena::Get();
+    arena.Reset();
+    m_stats.arenaPeak = arena.GetPeak();
+    m_stats.arenaCapacity = arena.GetCapacity();
+}
+
+void Context::SetCamera(const glm::vec3& position, float yaw, float pitch) {
+    m_cameraPos = position;
+    m_prevCameraPos = position;
+    m_cameraYaw = yaw;
+    m_cameraPitch = pitch;
+}
+
+void Context::SetCameraLookAt(const glm::vec3& position, const glm::vec3& target) {
+    auto direction = target - position;
+    SetCamera(position, glm::degrees(atan2f(-direction.x, -direction.z)),
+        glm::degrees(atan2f(direction.y,
+            sqrtf(direction.x * direction.x + direction.z * direction.z))));
+}
+
+void Context::SetSpotLight(const glm::vec3& position, const glm::vec3& direction,
+    const glm::vec2& cutoff) {
+    m_state.light.position = position;
+    m_state.light.direction = direction;
+    m_state.light.cutoff = cutoff;
+}
+
+void Context::SetSun(const glm::vec3& direction, const glm::vec3& color) {
+    m_state.sunDirection = direction;
+    m_state.sunColor = color;
+}
+
+void Context::ApplyFrameState(const FrameState& state) {
+    auto prev = m_frame;
+    m_frame = state;
+    if (m_frame.width != m_width || m_frame.height != m_height) {
+        m_width = m_frame.width;
+        m_height = m_frame.height;
+        glViewport(0, 0, m_width, m_height);
+        m_deferredRenderer->Resize(m_width, m_height);
+    }
+    if (m_frame.clearColor != prev.clearColor)
+        glClearColor(m_frame.clearColor.r, m_frame.clearColor.g, m_frame.clearColor.b, m_frame.clearColor.a);
+    if (m_frame.cubeCount != prev.cubeCount)
+        BuildScene();
+    if (m_frame.modelRotation != prev.modelRotation) {
+        m_model->GetSceneGraph()->SetLocalTransform(0,
+            glm::rotate(glm::mat4(1.0f), glm::radians(m_frame.modelRotation),
+                glm::vec3(0.0f, 1.0f, 0.0f)) * m_modelRootTransform);
+    }
+    if (!m_frame.shadows && prev.shadows)
+        m_shadowMaps->Clear();
+    if (m_frame.light.distance != prev.light.distance)
+        m_lightAttenuation = GetAttenuationCoeff(m_frame.light.distance);
+
+    // against the camera of the frame the click was made on
+    if (m_frame.pick)
+        PickObject(m_frame.pickPos.x, m_frame.pickPos.y);
+}
+
+void Context::BuildScene() {
+    m_bvhDirty = true;
+    m_staticVersion++;
+    m_cubesDynamic = m_frame.animation;
+    m_pickedObject = -1;
+    m_sceneObjects.clear();
+    m_sceneObjects.push_back({ m_box, glm::mat4(1.0f) });
+
+    m_modelObjectOffset = m_sceneObjects.size();
+    auto sceneGraph = m_model->GetSceneGraph();
+    for (int i = 0; i < m_model->GetMeshCount(); i++) {
+        m_sceneObjects.push_back({ m_model->GetMesh(i),
+            sceneGraph->GetWorldTransform(m_model->GetMeshNode(i)) });
+    }
+
+    m_cubeObjectOffset = m_sceneObjects.size();
+    m_sceneObjects.resize(m_cubeObjectOffset + m_frame.cubeCount);
+    for (int i = 0; i < m_frame.cubeCount; i++) {
+        auto& object = m_sceneObjects[m_cubeObjectOffset + i];
+        object.mesh = m_box;
+        object.occluder = m_boxOccluder;
+        object.dynamic = m_cubesDynamic;
+        object.color = glm::vec4(
+            0.5f + 0.5f * sinf((float)i * 0.7f),
+            0.5f + 0.5f * sinf((float)i * 1.3f + 2.0f),
+            0.5f + 0.5f * sinf((float)i * 1.9f + 4.0f), 1.0f);
+    }
+}
+
+void Context::UpdateModel() {
+    // world matrices are only copied on frames the hierarchy moved
+    auto sceneGraph = m_model->GetSceneGraph();
+    if (!sceneGraph->Update())
+        return;
+    m_staticVersion++;
+    for (int i = 0; i < m_model->GetMeshCount(); i++) {
+        m_sceneObjects[m_modelObjectOffset + i].modelTransform =
+            sceneGraph->GetWorldTransform(m_model->GetMeshNode(i));
+    }
+}
+
+void Context::UpdateCubes() {
+    // cubes are laid out on a grid behind the model
+    int side = (int)ceilf(sqrtf((float)m_frame.cubeCount));
+    float time = m_frame.animation ? (float)m_frame.time : 0.0f;
+    auto axis = glm::normalize(glm::vec3(1.0f, 0.5f, 0.0f));
+    m_cubeTransforms.Resize(m_frame.cubeCount);
+
+    // spinning cubes are drawn into the shadow maps every frame, still
+    // ones join the cached static depth
+    if (m_cubesDynamic != m_frame.animation) {
+        m_cubesDynamic = m_frame.animation;
+        for (int i = 0; i < m_frame.cubeCount; i++)
+            m_sceneObjects[m_cubeObjectOffset + i].dynamic = m_cubesDynamic;
+        m_staticVersion++;
+    }
+    for (int i = 0; i < m_frame.cubeCount; i++) {
+        auto pos = glm::vec3(
+            (float)(i % side - side / 2) * 2.0f,
+            -2.0f,
+            -(float)(i / side) * 2.0f - 3.0f);
+        m_cubeTransforms.Set(i, pos,
+            glm::angleAxis(glm::radians(time * 60.0f + 20.0f * (float)i), axis));
+    }
+    if (m_frame.cubeCount == 0)
+        return;
+
+    // matrices are written straight into the scene objects
+    const size_t chunkSize = 4096;
+    auto models = &m_sceneObjects[m_cubeObjectOffset].modelTransform;
+    ParallelFor(m_frame.cubeCount, chunkSize, [&](size_t chunkIndex) {
+        size_t begin = chunkIndex * chunkSize;
+        size_t end = std::min(begin + chunkSize, (size_t)m_frame.cubeCount);
+        ComputeTransforms(m_cubeTransforms, glm::mat4(1.0f), begin, end,
+            models, sizeof(SceneObject));
+    });
+}
+
+void Context::UpdateBvh() {
+    auto& worldBounds = m_drawListBuilder->GetWorldBounds();
+    if (m_bvhDirty)
+        m_bvh->Build(worldBounds);
+    else if (m_bvhStale)
+        m_bvh->Refit(worldBounds);
+    m_bvhDirty = false;
+    m_bvhStale = false;
+}
+
+void Context::SetLightUniforms(const Program* program) const {
+    program->SetUniform("light.position", m_frame.light.position);
+    program->SetUniform("light.attenuation", m_lightAttenuation);
+    // program->SetUniform("light.direction", m_light.direction);
+    program->SetUniform("light.direction", m_frame.light.direction);
+    // program->SetUniform("light.cutoff", cosf(glm::radians(m_light.cutoff)));
+    program->SetUniform("light.cutoff", glm::vec2(
+        cosf(glm::radians(m_frame.light.cutoff[0])),
+        cosf(glm::radians(m_frame.light.cutoff[0] + m_frame.light.cutoff[1]))));
+    program->SetUniform("light.ambient", m_frame.light.ambient);
+    program->SetUniform("light.diffuse", m_frame.light.diffuse);
+    program->SetUniform("light.specular", m_frame.light.specular);
+    program->SetUniform("sunDirection", glm::normalize(m_frame.sunDirection));
+    program->SetUniform("sunColor", m_frame.sunColor);
+    // texture units 0 ~ 4 are taken by materials, g-buffers and light lists
+    m_shadowMaps->SetUniforms(program, 5);
+}
+
+void Context::RenderShadows(const glm::mat4& view) {
+    if (m_casterMaskVersion != m_staticVersion) {
+        m_casterMaskVersion = m_staticVersion;
+        m_staticCasters.resize(m_sceneObjects.size());
+        m_dynamicCasters.resize(m_sceneObjects.size());
+        for (size_t i = 0; i < m_sceneObjects.size(); i++) {
+            m_staticCasters[i] = m_sceneObjects[i].dynamic ? 0 : 1;
+            m_dynamicCasters[i] = m_sceneObjects[i].dynamic ? 1 : 0;
+        }
+    }
+
+    m_shadowMaps->SetSpotLight(m_frame.light.position, m_frame.light.direction,
+        m_frame.light.cutoff[0] + m_frame.light.cutoff[1], GetAttenuationRadius(m_lightAttenuation, 1.0f));
+    m_shadowMaps->SetSunLight(m_frame.sunDirection, view, glm::radians(30.0f),
+        (float)m_width / (float)m_height, m_cameraNear, m_frame.sunShadowDistance);
+    bool sun = m_frame.sunColor.r > 0.0f || m_frame.sunColor.g > 0.0f || m_frame.sunColor.b > 0.0f;
+
+    // each map culls the casters against its own light frustum
+    for (int map = 0; map < (sun ? m_shadowMaps->GetMapCount() : 1); map++) {
+        auto& viewProjection = m_shadowMaps->GetViewProjection(map);
+        if (m_shadowMaps->IsStaticDirty(map, m_staticVersion)) {
+            auto& staticList = m_shadowDrawListBuilder->Build(m_sceneObjects,
+                viewProjection, &m_staticCasters);
+            m_shadowMaps->BeginStaticPass(map, m_staticVersion);
+            SubmitDrawList(staticList);
+        }
+        auto& dynamicList = m_shadowDrawListBuilder->Build(m_sceneObjects,
+            viewProjection, &m_dynamicCasters);
+        if (m_shadowMaps->BeginDynamicPass(map, dynamicList.Size() > 0))
+            SubmitDrawList(dynamicList);
+    }
+    m_shadowMaps->EndPasses(m_width, m_height);
+}
+
+void Context::UpdateSceneLights() {
+    // local lights circle over the cube field, every fourth one is a
+    // spot light pointing down
+    m_frame.sceneLightCount = std::max(m_frame.sceneLightCount, 0);
+    m_sceneLights.resize(m_frame.sceneLightCount);
+    float time = m_frame.animation ? (float)m_frame.time : 0.0f;
+    for (int i = 0; i < m_frame.sceneLightCount; i++) {
+        auto& light = m_sceneLights[i];
+        float radius = 1.0f + 0.6f * sqrtf((float)i);
+        float angle = 2.4f * (float)i + time * 0.3f;
+        light.position = glm::vec3(
+            cosf(angle) * radius,
+            -1.2f + 0.3f * sinf(time + (float)i),
+            -3.0f - sinf(angle) * radius);
+        light.distance = m_frame.sceneLightRange;
+        light.color = glm::vec3(
+            0.5f + 0.5f * sinf((float)i * 1.7f),
+            0.5f + 0.5f * sinf((float)i * 2.3f + 2.0f),
+            0.5f + 0.5f * sinf((float)i * 2.9f + 4.0f));
+        light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+        light.cutoff = i % 4 == 3 ? glm::vec2(25.0f, 10.0f) : glm::vec2(0.0f);
+    }
+    m_lightSet->Update(m_sceneLights);
+}
+
+void Context::CollectOccluders(const Frustum& frustum) {
+    // the objects covering the most screen area hide the most
+    auto& bounds = m_drawListBuilder->GetWorldBounds();
+    auto& candidates = m_occluderCandidates;
+    candidates.clear();
+    for (size_t i = 0; i < m_sceneObjects.size(); i++) {
+        if (!m_sceneObjects[i].occluder)
+            continue;
+        auto center = glm::vec3(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+        auto extent = glm::vec3(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+        if (ClassifyBox(frustum, BoundingBox { center - extent, center + extent }) == 0)
+            continue;
+        auto toCamera = center - m_frame.cameraPos;
+        float size = glm::dot(extent, extent) / std::max(glm::dot(toCamera, toCamera), 1e-4f);
+        candidates.push_back({ -size, i });
+    }
+    size_t count = std::min(candidates.size(), (size_t)std::max(m_frame.maxOccluders, 0));
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+
+    m_occluders.clear();
+    for (size_t i = 0; i < count; i++) {
+        auto& object = m_sceneObjects[candidates[i].second];
+        m_occluders.push_back({ object.occluder.get(), object.modelTransform });
+    }
+}
+
+void Context::PickObject(float x, float y) {
+    UpdateBvh();
+
+    // cursor ray from the near to the far plane of the last rendered frame
+    auto invViewProjection = glm::inverse(m_viewProjection);
+    float ndcX = 2.0f * x / (float)m_width - 1.0f;
+    float ndcY = 1.0f - 2.0f * y / (float)m_height;
+    auto nearPoint = invViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    auto farPoint = invViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    auto origin = glm::vec3(nearPoint) / nearPoint.w;
+    auto target = glm::vec3(farPoint) / farPoint.w;
+
+    uint32_t hitIndex = 0;
+    float hitDistance = 0.0f;
+    m_pickedObject = -1;
+    if (m_bvh->Raycast(origin, glm::normalize(target - origin),
+        glm::length(target - origin), hitIndex, hitDistance)) {
+        m_pickedObject = (int)hitIndex;
+    }
+}
+
+void Context::SubmitDrawList(const DrawList& drawList,
+    const std::vector<LightListRange>* lightRanges) {
+    // consecutive commands sharing a mesh become one instanced command,
+    // commands sharing a vertex layout are submitted as one multi draw
+    auto& commands = drawList.commands;
+    m_instances.resize(commands.size());
+    for (size_t i = 0; i < commands.size(); i++) {
+        m_instances[i].transform = commands[i].transform;
+        m_instances[i].modelTransform = commands[i].modelTransform;
+        m_instances[i].normalTransform = commands[i].normalTransform;
+        m_instances[i].color = (int)commands[i].objectIndex == m_pickedObject ?
+            glm::vec4(1.0f, 0.8f, 0.2f, 1.0f) : commands[i].color;
+        m_instances[i].lightRange = lightRanges ? (*lightRanges)[i] : LightListRange();
+    }
+    if (m_instances.empty())
+        return;
+
+    m_multiDrawBatch->Clear();
+    size_t first = 0;
+    while (first < commands.size()) {
+        size_t last = first + 1;
+        while (last < commands.size() && commands[last].mesh == commands[first].mesh)
+            last++;
+        m_multiDrawBatch->Add(commands[first].mesh,
+            (uint32_t)first, (uint32_t)(last - first));
+        first = last;
+    }
+
+    // instances and commands go to the same buffer, so they are reserved together
+    size_t instanceSize = m_instances.size() * sizeof(InstanceData);
+    m_streamBuffer->Reserve(instanceSize + m_multiDrawBatch->GetStreamSize() + 32);
+    size_t instanceOffset = m_streamBuffer->Write(m_instances.data(), instanceSize);
+    m_multiDrawBatch->Submit(m_streamBuffer.get(), instanceOffset);
+    m_frameDrawCallCount += m_multiDrawBatch->GetDrawCallCount();
+}
+
+bool Context::Init(const std::string& modelFilename) {
+    TRACE_SCOPE("Context::Init");
+
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(m_frame.clearColor.r, m_frame.clearColor.g, m_frame.clearColor.b, m_frame.clearColor.a);
+
+    m_box = Mesh::CreateBox();
+    m_boxOccluder = OccluderGeometry::CreateBox();
+    m_occlusionCuller = OcclusionCuller::Create();
+    m_streamBuffer = StreamBuffer::Create(1024 * 1024);
+    if (!m_streamBuffer)
+        return false;
+    m_multiDrawBatch = MultiDrawBatch::Create();
+
+    // m_model = Model::Load("./model/Ak-47.obj");
+    m_model = Model::Load(modelFilename);
+    if (!m_model) {
+        SPDLOG_ERROR("failed to load the scene model: {}", modelFilename);
+        return false;
+    }
+    m_modelRootTransform = m_model->GetSceneGraph()->GetLocalTransform(0);
+
+    BuildScene();
+    m_drawListBuilder = DrawListBuilder::Create();
+    m_shadowDrawListBuilder = DrawListBuilder::Create();
+    m_shadowDrawListBuilder->SetBoundsSource(m_drawListBuilder.get());
+    m_bvh = Bvh::Create();
+
+    m_simpleProgram = Program::Create("./shader/simple.vs", "./shader/simple.fs");
+    if (!m_simpleProgram)
+        return false;
+    SPDLOG_INFO("simple program id: {}", m_simpleProgram->Get());    
+
+    // m_program = Program::Create("./shader/lighting-1.vs", "./shader/lighting-1.fs");
+    // m_program = Program::Create("./shader/lighting-3.vs", "./shader/lighting-3.fs");
+    m_program = Program::Create("./shader/lighting-3-instanced.vs", "./shader/lighting-3-instanced.fs");
+    if (!m_program)
+        return false;
+    SPDLOG_INFO("program id: {}", m_program->Get());  
+
+    m_deferredRenderer = DeferredRenderer::Create(m_frame.width, m_frame.height);
+    if (!m_deferredRenderer)
+        return false;
+    m_clusteredLights = ClusteredLights::Create();
+    if (!m_clusteredLights)
+        return false;
+    m_objectLightProgram = Program::Create("./shader/lighting-3-objectlights.vs",
+        "./shader/lighting-3-objectlights.fs");
+    if (!m_objectLightProgram)
+        return false;
+    m_lightSet = LightSet::Create();
+    if (!m_lightSet)
+        return false;
+    m_lightAttenuation = GetAttenuationCoeff(m_frame.light.distance);
+    m_shadowMaps = ShadowMaps::Create();
+    if (!m_shadowMaps)
+        return false;
+    m_profiler = Profiler::Create();
+  
+    // m_material = Material::Create();
+    // m_material = Context::Create();
+    // m_material->diffuse = Texture::CreateFromImage(
+    m_material.diffuse = Texture::CreateFromImage(
+        Image::CreateSingleColorImage(4, 4,
+            glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)).get());
+
+    // m_material->specular = Texture::CreateFromImage(
+    m_material.specular = Texture::CreateFromImage(
+        Image::CreateSingleColorImage(4, 4,
+            glm::vec4(0.5f, 0.5f, 0.5f, 1.0f)).get());
+
+/*
+    glClearColor(0.1f, 0.2f, 0.3f, 0.0f);
+
+   
+    auto image = Image::Create(512, 512);
+    image->SetCheckImage(64, 64);
+
+    m_texture = Texture::CreateFromImage(image.get());
+    // m_material.specular = Texture::CreateFromImage(image.get());
+  
+    auto image2 = Image::Load("./image/face-3.jpg");
+    m_texture2 = Texture::CreateFromImage(image2.get());
+
+    m_material.diffuse = Texture::CreateFromImage(Image::Load("./image/face-4.jpg").get());
+    // m_material.specular = Texture::CreateFromImage(Image::Load("./image/metal_sp.png").get());
+    m_material.specular = Texture::CreateFromImage(image.get());
+*/
+/*
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_texture->Get());
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_texture2->Get());
+
+    m_program->Use();
+    // glUniform1i(glGetUniformLocation(m_program->Get(), "tex"), 0);
+    // glUniform1i(glGetUniformLocation(m_program->Get(), "tex2"), 1);
+
+    m_program->SetUniform("tex", 0);
+    m_program->SetUniform("tex2", 1);
+
+
+    // auto model = glm::rotate(glm::mat4(1.0f), glm::radians(30.0f), glm::vec3(1.0f, 1.0f, 0.0f));
+    // auto view = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f));
+    // auto projection = glm::perspective(glm::radians(30.0f), (float)WINDOW_WIDTH/(float)WINDOW_HEIGHT, 0.01f, 10.0f);
+
+    // auto transform = projection * view * model;
+
+    // // auto transformLoc = glGetUniformLocation(m_program->Get(), "transform");
+    // // glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(transform));
+    // m_program->SetUniform("transform", transform);
+*/
+
+    return true;
+}
+
+
+
+OffscreenContextUPtr OffscreenContext::Create(int width, int height) {
+    auto context = OffscreenContextUPtr(new OffscreenContext());
+    if (!context->Init(width, height))
+        return nullptr;
+    return std::move(context);
+}
+
+OffscreenContext::~OffscreenContext() {
+    m_framebuffer.reset();
+    Framebuffer::SetDefault(0);
+#if defined(USE_EGL)
+    if (m_eglContext != EGL_NO_CONTEXT) {
+        eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(m_display, m_eglContext);
+    }
+    if (m_display != EGL_NO_DISPLAY)
+        eglTerminate(m_display);
+#endif
+#if defined(USE_OSMESA)
+    if (m_osmesaContext)
+        OSMesaDestroyContext(m_osmesaContext);
+#endif
+}
+
+bool OffscreenContext::Init(int width, int height) {
+    GLADloadproc loader = nullptr;
+#if defined(USE_EGL)
+    if (!loader && CreateEglContext())
+        loader = (GLADloadproc)eglGetProcAddress;
+#endif
+#if defined(USE_OSMESA)
+    if (!loader && CreateOSMesaContext())
+        loader = (GLADloadproc)OSMesaGetProcAddress;
+#endif
+    if (!loader) {
+        SPDLOG_ERROR("no headless backend, build with USE_EGL or USE_OSMESA");
+        return false;
+    }
+    if (!gladLoadGLLoader(loader)) {
+        SPDLOG_ERROR("failed to initialize glad");
+        return false;
+    }
+    return Resize(width, height);
+}
+
+bool OffscreenContext::CreateEglContext() {
+#if defined(USE_EGL)
+    // the surfaceless platform needs no display server, otherwise the
+    // default display is tried
+    auto getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (m_display == EGL_NO_DISPLAY)
+        m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major = 0, minor = 0;
+    if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, &major, &minor)) {
+        SPDLOG_ERROR("failed to initialize egl");
+        m_display = EGL_NO_DISPLAY;
+        return false;
+    }
+    SPDLOG_INFO("egl version: {}.{}", major, minor);
+
+    EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(m_display, configAttribs, &config, 1, &configCount) || !configCount) {
+        SPDLOG_ERROR("no egl config for desktop gl");
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    m_eglContext = eglCreateContext(m_display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (m_eglContext == EGL_NO_CONTEXT) {
+        SPDLOG_ERROR("failed to create egl context: 0x{:04x}", eglGetError());
+        return false;
+    }
+    if (!eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_eglContext)) {
+        SPDLOG_ERROR("failed to make egl context current: 0x{:04x}", eglGetError());
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool OffscreenContext::CreateOSMesaContext() {
+#if defined(USE_OSMESA)
+    const int attribs[] = {
+        OSMESA_FORMAT, OSMESA_RGBA,
+        OSMESA_DEPTH_BITS, 24,
+        OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+        OSMESA_CONTEXT_MAJOR_VERSION, 3,
+        OSMESA_CONTEXT_MINOR_VERSION, 3,
+        0
+    };
+    m_osmesaContext = OSMesaCreateContextAttribs(attribs, nullptr);
+    if (!m_osmesaContext) {
+        SPDLOG_ERROR("failed to create osmesa context");
+        return false;
+    }
+    m_osmesaBuffer.resize(4);
+    if (!OSMesaMakeCurrent(m_osmesaContext, m_osmesaBuffer.data(), GL_UNSIGNED_BYTE, 1, 1)) {
+        SPDLOG_ERROR("failed to make osmesa context current");
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool OffscreenContext::Resize(int width, int height) {
+    TexturePtr color = Texture::Create(width, height, GL_RGBA);
+    auto framebuffer = Framebuffer::Create({ color });
+    if (!framebuffer)
+        return false;
+    m_framebuffer = std::move(framebuffer);
+    m_width = width;
+    m_height = height;
+    Framebuffer::SetDefault(m_framebuffer->Get());
+    Framebuffer::BindToDefault();
+    return true;
+}
+
+std::vector<uint8_t> OffscreenContext::ReadPixels() const {
+    std::vector<uint8_t> pixels((size_t)m_width * m_height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer->Get());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    Framebuffer::BindToDefault();
+    return pixels;
+}
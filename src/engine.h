@@ -0,0 +1,2090 @@
+#ifndef __ENGINE_H__
+#define __ENGINE_H__
+
+#include <spdlog/spdlog.h>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+// headless backends, the glfw window needs a display
+#if defined(USE_EGL)
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#if defined(USE_OSMESA)
+#include <GL/osmesa.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <iostream>
+#include <optional>
+#include <vector>
+#include <memory>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <functional>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define USE_SSE
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// profiling zones compile out of release builds unless asked for
+#if !defined(NDEBUG) && !defined(USE_PROFILER)
+#define USE_PROFILER
+#endif
+
+#include <imgui.h>
+#include <imgui_impl_glfw.h>
+#include <imgui_impl_opengl3.h>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+using namespace std;
+
+
+#define CLASS_PTR(klassName) \
+class klassName; \
+using klassName ## UPtr = std::unique_ptr<klassName>; \
+using klassName ## Ptr = std::shared_ptr<klassName>; \
+using klassName ## WPtr = std::weak_ptr<klassName>;
+
+
+
+// trace event capture, the json file opens in chrome://tracing and
+// perfetto. scopes on any thread record complete events while a capture
+// runs, each thread on its own track. outside a capture a scope costs
+// one atomic load
+class TraceCapture {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // records until frameCount frames have ended and writes filename then
+    static void Start(const std::string& filename, int frameCount);
+    static void EndFrame();
+    static void Stop();
+    static bool IsCapturing() {
+        return GetState().capturing.load(std::memory_order_relaxed);
+    }
+    static void AddEvent(const char* name, Clock::time_point begin, Clock::time_point end);
+
+private:
+    struct Event {
+        const char* name;
+        Clock::time_point begin;
+        Clock::time_point end;
+        int thread;
+    };
+    struct State {
+        std::atomic<bool> capturing { false };
+        std::mutex mutex;
+        std::string filename;
+        int framesLeft { 0 };
+        Clock::time_point start;
+        std::vector<Event> events;
+        // the thread that started the capture is track 0
+        std::unordered_map<std::thread::id, int> threads;
+    };
+    static State& GetState() {
+        static State state;
+        return state;
+    }
+};
+
+// records the enclosing scope while a capture runs, name must be a
+// string literal
+class TraceScope {
+public:
+    TraceScope(const char* name) : m_name(name), m_capturing(TraceCapture::IsCapturing()) {
+        if (m_capturing)
+            m_begin = TraceCapture::Clock::now();
+    }
+    ~TraceScope() {
+        if (m_capturing)
+            TraceCapture::AddEvent(m_name, m_begin, TraceCapture::Clock::now());
+    }
+
+private:
+    const char* m_name;
+    bool m_capturing;
+    TraceCapture::Clock::time_point m_begin;
+};
+
+#define SCOPE_CONCAT_INNER(a, b) a ## b
+#define SCOPE_CONCAT(a, b) SCOPE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope SCOPE_CONCAT(traceScope, __LINE__)(name)
+
+
+
+// bump allocator for data that lives no longer than a frame, one per
+// thread. the render loop resets its thread's arena at the end of every
+// frame and a job's allocations are released when the job returns.
+// blocks are kept across resets, so once the peak frame has been seen
+// allocating from the arena no longer touches the heap
+class FrameArena {
+public:
+    // arena of the calling thread
+    static FrameArena& Get();
+
+    void* Allocate(size_t size, size_t alignment);
+    void Reset();
+
+    struct Marker {
+        size_t block;
+        size_t offset;
+    };
+    Marker GetMarker() const { return { m_block, m_offset }; }
+    // releases everything allocated after marker was taken
+    void Rewind(const Marker& marker) {
+        m_block = marker.block;
+        m_offset = marker.offset;
+    }
+
+    size_t GetUsed() const;
+    size_t GetCapacity() const;
+    // most used between two resets
+    size_t GetPeak() const { return m_peak; }
+
+private:
+    FrameArena() {}
+    static const size_t BlockSize = 256 * 1024;
+
+    struct Block {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size;
+    };
+    std::vector<Block> m_blocks;
+    size_t m_block { 0 };
+    size_t m_offset { 0 };
+    size_t m_peak { 0 };
+};
+
+// stl allocator drawing from a frame arena, the arena of the thread that
+// created it by default. deallocate does nothing, the memory comes back
+// with the arena's reset, so containers using it must not outlive the frame
+template <typename T>
+class FrameAllocator {
+public:
+    using value_type = T;
+
+    FrameAllocator() : m_arena(&FrameArena::Get()) {}
+    FrameAllocator(FrameArena& arena) : m_arena(&arena) {}
+    template <typename U>
+    FrameAllocator(const FrameAllocator<U>& other) : m_arena(other.GetArena()) {}
+
+    T* allocate(size_t count) {
+        return (T*)m_arena->Allocate(count * sizeof(T), alignof(T));
+    }
+    void deallocate(T*, size_t) {}
+    FrameArena* GetArena() const { return m_arena; }
+
+    template <typename U>
+    bool operator==(const FrameAllocator<U>& other) const { return m_arena == other.GetArena(); }
+    template <typename U>
+    bool operator!=(const FrameAllocator<U>& other) const { return m_arena != other.GetArena(); }
+
+private:
+    FrameArena* m_arena;
+};
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+using FrameString = std::basic_string<char, std::char_traits<char>, FrameAllocator<char>>;
+
+
+
+// seconds since the first call, glfw's timer is not there without a window
+double GetTime();
+
+// fixed step simulation clock. real time goes in, whole steps come out
+// and what is left over is how far rendering sits past the last step.
+// a frame runs at most maxSteps steps, the time beyond them is dropped
+// so a slow frame can not snowball into slower ones
+class FrameClock {
+public:
+    FrameClock(double stepTime = 1.0 / 60.0, int maxSteps = 8)
+        : m_stepTime(stepTime), m_maxSteps(maxSteps) {}
+
+    // number of steps to simulate up to time
+    int Advance(double time);
+    double GetStepTime() const { return m_stepTime; }
+    // 0 renders the previous step, 1 the last one
+    float GetAlpha() const { return (float)(m_accumulator / m_stepTime); }
+
+private:
+    double m_stepTime;
+    int m_maxSteps;
+    double m_lastTime { -1.0 };
+    double m_accumulator { 0.0 };
+};
+
+// optional is not to assign a memory for the empty file
+optional<string> LoadTextFile(const string& filename);
+
+glm::vec3 GetAttenuationCoeff(float distance);
+
+struct Vertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoord;
+};
+
+// axis aligned bounding box, empty until something is added
+struct BoundingBox {
+    glm::vec3 min { glm::vec3(FLT_MAX) };
+    glm::vec3 max { glm::vec3(-FLT_MAX) };
+
+    bool IsValid() const { return min.x <= max.x; }
+    glm::vec3 GetCenter() const { return (min + max) * 0.5f; }
+    glm::vec3 GetExtent() const { return (max - min) * 0.5f; }
+
+    void Expand(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+    void Expand(const BoundingBox& box) {
+        if (!box.IsValid())
+            return;
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+
+    // box enclosing this box after transform (Arvo's method)
+    BoundingBox Transform(const glm::mat4& m) const {
+        if (!IsValid())
+            return *this;
+        auto center = glm::vec3(m * glm::vec4(GetCenter(), 1.0f));
+        auto extent = GetExtent();
+        auto newExtent = glm::vec3(
+            fabsf(m[0][0]) * extent.x + fabsf(m[1][0]) * extent.y + fabsf(m[2][0]) * extent.z,
+            fabsf(m[0][1]) * extent.x + fabsf(m[1][1]) * extent.y + fabsf(m[2][1]) * extent.z,
+            fabsf(m[0][2]) * extent.x + fabsf(m[1][2]) * extent.y + fabsf(m[2][2]) * extent.z);
+        return BoundingBox { center - newExtent, center + newExtent };
+    }
+};
+
+struct BoundingSphere {
+    glm::vec3 center { glm::vec3(0.0f) };
+    float radius { 0.0f };
+};
+
+BoundingBox ComputeBoundingBox(const Vertex* vertices, size_t count);
+inline BoundingBox ComputeBoundingBox(const std::vector<Vertex>& vertices) {
+    return ComputeBoundingBox(vertices.data(), vertices.size());
+}
+
+// centered on the box, tighter than the box's circumscribed sphere
+BoundingSphere ComputeBoundingSphere(const Vertex* vertices, size_t count,
+    const BoundingBox& box);
+inline BoundingSphere ComputeBoundingSphere(const std::vector<Vertex>& vertices,
+    const BoundingBox& box) {
+    return ComputeBoundingSphere(vertices.data(), vertices.size(), box);
+}
+
+// inverse transpose of the model matrix' upper 3x3 for transforming normals.
+// rotation with uniform scale skips the inverse: (s * R)^-T == (s * R) / s^2
+glm::mat3 ComputeNormalMatrix(const glm::mat4& m);
+
+// offset and count into a light index list
+struct LightListRange {
+    uint32_t offset { 0 };
+    uint32_t count { 0 };
+};
+
+// per-instance vertex stream, attribute locations 3 ~ 15
+struct InstanceData {
+    glm::mat4 transform { glm::mat4(1.0f) };        // projection * view * model
+    glm::mat4 modelTransform { glm::mat4(1.0f) };
+    glm::vec4 color { glm::vec4(1.0f) };
+    glm::mat3 normalTransform { glm::mat3(1.0f) };
+    LightListRange lightRange;                      // lights reaching the object
+};
+
+// layout fixed by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    uint32_t count;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t baseVertex;
+    uint32_t baseInstance;
+};
+
+// base instance in indirect commands is what selects per-draw instance data
+bool IsMultiDrawIndirectSupported();
+
+// immutable storage that can stay mapped while the gpu reads it
+bool IsBufferStorageSupported();
+
+
+
+CLASS_PTR(Shader);
+class Shader {
+public:
+    static ShaderUPtr CreateFromFile(const std::string& filename, GLenum shaderType);
+
+    ~Shader();
+    uint32_t Get() const { return m_shader; }    
+private:
+    Shader() {}
+    bool LoadFile(const std::string& filename, GLenum shaderType);
+    uint32_t m_shader { 0 };
+};
+
+
+
+CLASS_PTR(Program)
+class Program {
+public:
+    static ProgramUPtr Create(const std::vector<ShaderPtr>& shaders);
+    static ProgramUPtr Create(const std::string& vertShaderFilename,
+        const std::string& fragShaderFilename);
+
+    ~Program();
+    uint32_t Get() const { return m_program; }
+    void Use() const;
+
+    // names are c strings so literals do not build a std::string per call
+    void SetUniform(const char* name, int value) const;
+    void SetUniform(const char* name, const glm::mat4& value) const;
+    void SetUniform(const char* name, const glm::mat3& value) const;
+    
+    void SetUniform(const char* name, float value) const;
+    void SetUniform(const char* name, const glm::vec2& value) const;
+    void SetUniform(const char* name, const glm::vec3& value) const;
+    void SetUniform(const char* name, const glm::vec4& value) const;
+ 
+private:
+    Program() {}
+    bool Link(const std::vector<ShaderPtr>& shaders);
+    uint32_t m_program { 0 };
+};
+
+
+
+CLASS_PTR(Buffer)
+class Buffer {
+public:
+    static BufferUPtr CreateWithData(uint32_t bufferType, uint32_t usage,
+        // const void* data, size_t dataSize);
+        const void* data, size_t stride, size_t count);
+    ~Buffer();
+    uint32_t Get() const { return m_buffer; }
+    void Bind() const;
+    void UpdateData(const void* data, size_t count);
+
+    size_t GetStride() const { return m_stride; }
+    size_t GetCount() const { return m_count; }
+
+private:
+    Buffer() {}
+    bool Init(
+        uint32_t bufferType, uint32_t usage,
+        // const void* data, size_t dataSize);
+        const void* data, size_t stride, size_t count);
+    uint32_t m_buffer { 0 };
+    uint32_t m_bufferType { 0 };
+    uint32_t m_usage { 0 };
+
+    size_t m_stride { 0 };
+    size_t m_count { 0 };
+};
+
+
+
+// buffer for data written every frame, sub-allocated front to back.
+// with buffer storage it is a ring of RegionCount regions mapped
+// persistent and coherent once, a frame writes its own region and a
+// fence keeps it from coming back to one the gpu may still read.
+// otherwise a frame orphans one region's worth of storage and maps the
+// ranges it writes unsynchronized. a buffer of any target can read it
+CLASS_PTR(StreamBuffer)
+class StreamBuffer {
+public:
+    static const int RegionCount = 3;
+
+    static StreamBufferUPtr Create(size_t regionSize);
+    ~StreamBuffer();
+
+    // changes when the buffer grows, read it after the frame's writes
+    uint32_t Get() const { return m_buffer; }
+    bool IsPersistent() const { return m_persistent; }
+    size_t GetRegionSize() const { return m_regionSize; }
+    // frames that had to wait for the gpu to release their region
+    size_t GetStallCount() const { return m_stallCount; }
+
+    // waits for the gpu to be done with the frame's region
+    void BeginFrame();
+    // makes room for size bytes of writes in the frame. growing replaces
+    // the buffer, offsets written before it point into the old one, so
+    // writes read by the same draw are reserved together
+    void Reserve(size_t size);
+    // copies data into the frame's region, returns its offset in the buffer
+    size_t Write(const void* data, size_t size, size_t alignment = 16);
+    // fences the draws reading the frame's region
+    void EndFrame();
+
+private:
+    StreamBuffer() {}
+    bool Init(size_t regionSize);
+    void Release();
+
+    uint32_t m_buffer { 0 };
+    bool m_persistent { false };
+    size_t m_regionSize { 0 };
+    uint8_t* m_mapped { nullptr };
+    GLsync m_fences[RegionCount] {};
+    int m_region { 0 };
+    // write position inside the region
+    size_t m_offset { 0 };
+    size_t m_stallCount { 0 };
+};
+
+
+CLASS_PTR(VertexLayout)
+class VertexLayout {
+public:
+    static VertexLayoutUPtr Create();
+    ~VertexLayout();
+
+    uint32_t Get() const { return m_vertexArrayObject; }
+    void Bind() const;
+    void SetAttrib(
+        uint32_t attribIndex, int count,
+        uint32_t type, bool normalized,
+        size_t stride, uint64_t offset) const;
+    // integer attribute, read as int / uint in the shader
+    void SetIntAttrib(
+        uint32_t attribIndex, int count, uint32_t type,
+        size_t stride, uint64_t offset) const;
+    void SetAttribDivisor(uint32_t attribIndex, uint32_t divisor) const;
+    void DisableAttrib(int attribIndex) const;
+
+private:
+    VertexLayout() {}
+    void Init();
+    uint32_t m_vertexArrayObject { 0 };
+};
+
+// per-vertex attributes of Vertex, locations 0 ~ 2, read from the bound array buffer
+void SetVertexAttribs(const VertexLayout* layout);
+
+// points the instance attributes of a bound vertex layout at the instances
+// of instanceBuffer from byte offset on, which works without base instance support
+void SetInstanceAttribs(const VertexLayout* layout,
+    uint32_t instanceBuffer, uint64_t offset);
+
+
+
+CLASS_PTR(Image)
+class Image {
+public:
+    static ImageUPtr Load(const std::string& filepath);
+    static ImageUPtr Create(int width, int height, int channelCount = 4);
+    static ImageUPtr CreateSingleColorImage(int width, int height, const glm::vec4& color);
+    ~Image();
+
+    const uint8_t* GetData() const { return m_data; }
+    int GetWidth() const { return m_width; }
+    int GetHeight() const { return m_height; }
+    int GetChannelCount() const { return m_channelCount; }
+
+    void SetCheckImage(int gridX, int gridY);
+    
+private:
+    Image() {};
+    bool LoadWithStb(const std::string& filepath);
+    bool Allocate(int width, int height, int channelCount);
+    int m_width { 0 };
+    int m_height { 0 };
+    int m_channelCount { 0 };
+    uint8_t* m_data { nullptr };
+};
+
+
+
+CLASS_PTR(Texture)
+class Texture {
+public:
+    static TextureUPtr CreateFromImage(const Image* image);
+    // empty texture to render into, format is the internal format
+    static TextureUPtr Create(int width, int height,
+        uint32_t format, uint32_t type = GL_UNSIGNED_BYTE);
+    ~Texture();
+
+    const uint32_t Get() const { return m_texture; }
+    void Bind() const;
+    void SetFilter(uint32_t minFilter, uint32_t magFilter) const;
+    void SetWrap(uint32_t sWrap, uint32_t tWrap) const;
+
+    int GetWidth() const { return m_width; }
+    int GetHeight() const { return m_height; }
+    uint32_t GetFormat() const { return m_format; }
+    
+private:
+    Texture() {}
+    void CreateTexture();
+    void SetTextureFromImage(const Image* image);
+    void SetTextureFormat(int width, int height, uint32_t format, uint32_t type);
+
+    uint32_t m_texture { 0 };
+    int m_width { 0 };
+    int m_height { 0 };
+    uint32_t m_format { GL_RGBA };
+};
+
+
+
+// buffer object read from shaders through a samplerBuffer, how gl 3.3
+// hands large arrays (light lists) to a shader without ssbo
+CLASS_PTR(BufferTexture)
+class BufferTexture {
+public:
+    // format is the texel format, e.g. GL_RGBA32F or GL_R32UI
+    static BufferTextureUPtr Create(uint32_t format, size_t stride);
+    ~BufferTexture();
+
+    const uint32_t Get() const { return m_texture; }
+    void Bind() const;
+    // re-specifies the whole buffer, the texture keeps pointing at it
+    void UpdateData(const void* data, size_t count);
+    size_t GetCount() const { return m_buffer->GetCount(); }
+    const Buffer* GetBuffer() const { return m_buffer.get(); }
+
+private:
+    BufferTexture() {}
+    bool Init(uint32_t format, size_t stride);
+    uint32_t m_texture { 0 };
+    BufferUPtr m_buffer;
+};
+
+
+
+// render target made of textures, e.g. a g-buffer
+CLASS_PTR(Framebuffer)
+class Framebuffer {
+public:
+    // a null depth attachment gets a depth-stencil renderbuffer
+    static FramebufferUPtr Create(const std::vector<TexturePtr>& colorAttachments,
+        TexturePtr depthStencilAttachment = nullptr);
+    // binds the window's framebuffer, or the one set in its place when
+    // rendering offscreen
+    static void BindToDefault();
+    static void SetDefault(uint32_t framebuffer) { s_defaultFramebuffer = framebuffer; }
+    static uint32_t GetDefault() { return s_defaultFramebuffer; }
+    ~Framebuffer();
+
+    const uint32_t Get() const { return m_framebuffer; }
+    void Bind() const;
+    int GetColorAttachmentCount() const { return (int)m_colorAttachments.size(); }
+    const TexturePtr GetColorAttachment(int index = 0) const { return m_colorAttachments[index]; }
+    const TexturePtr GetDepthStencilAttachment() const { return m_depthStencilAttachment; }
+
+private:
+    Framebuffer() {}
+    bool InitWithAttachments(const std::vector<TexturePtr>& colorAttachments,
+        TexturePtr depthStencilAttachment);
+
+    static inline uint32_t s_defaultFramebuffer { 0 };
+
+    uint32_t m_framebuffer { 0 };
+    uint32_t m_depthStencilBuffer { 0 };
+    std::vector<TexturePtr> m_colorAttachments;
+    TexturePtr m_depthStencilAttachment;
+};
+
+
+
+// two level segregated fit allocator of ranges in [0, size), the
+// bookkeeping of GeometryPool. free ranges sit in bins by size, a first
+// level per power of two split into SubBinCount linear steps, and two
+// bitmasks find the first bin whose ranges all fit in constant time.
+// a freed range merges with free neighbors right away
+class OffsetAllocator {
+public:
+    static const uint32_t InvalidNode = 0xffffffff;
+
+    OffsetAllocator(uint32_t size = 0) { Reset(size); }
+    void Reset(uint32_t size);
+
+    // node of the range, InvalidNode when no free range is large enough
+    uint32_t Allocate(uint32_t size);
+    void Free(uint32_t node);
+    uint32_t GetOffset(uint32_t node) const { return m_nodes[node].offset; }
+
+    // adds space at the end, it merges with a free range ending there
+    void Grow(uint32_t size);
+    // moves every range to the front in address order, keeping the nodes.
+    // move gets the old offset, the new one and the size of every range
+    void Compact(const std::function<void(uint32_t, uint32_t, uint32_t)>& move);
+
+    uint32_t GetSize() const { return m_size; }
+    uint32_t GetFreeSize() const { return m_freeSize; }
+    uint32_t GetLargestFree() const;
+
+private:
+    static const uint32_t SubBinShift = 3;
+    static const uint32_t SubBinCount = 1 << SubBinShift;
+    static const uint32_t LevelCount = 32;
+
+    struct Node {
+        uint32_t offset { 0 };
+        uint32_t size { 0 };
+        bool used { false };
+        // neighbors in address order
+        uint32_t prev { InvalidNode };
+        uint32_t next { InvalidNode };
+        // free ranges of the same bin
+        uint32_t binPrev { InvalidNode };
+        uint32_t binNext { InvalidNode };
+    };
+
+    static uint32_t GetBin(uint32_t size);
+    uint32_t NewNode(uint32_t offset, uint32_t size);
+    void InsertFree(uint32_t node);
+    void RemoveFree(uint32_t node);
+
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_unusedNodes;
+    uint32_t m_firstLevelMask { 0 };
+    uint32_t m_secondLevelMasks[LevelCount] {};
+    uint32_t m_bins[LevelCount * SubBinCount];
+    // the range at offset 0
+    uint32_t m_head { InvalidNode };
+    uint32_t m_size { 0 };
+    uint32_t m_freeSize { 0 };
+};
+
+
+
+CLASS_PTR(GeometryPool)
+CLASS_PTR(GeometryAllocation)
+
+// vertex and index ranges of one upload into the pool, handed back when
+// the last mesh drawing from it is gone. the ranges move when the pool
+// compacts, so offsets are read when draws are built
+class GeometryAllocation {
+public:
+    ~GeometryAllocation();
+    int32_t GetBaseVertex() const;
+    uint32_t GetFirstIndex() const;
+    uint32_t GetVertexCount() const { return m_vertexCount; }
+    uint32_t GetIndexCount() const { return m_indexCount; }
+    GeometryPool* GetPool() const { return m_pool.get(); }
+
+private:
+    friend class GeometryPool;
+    GeometryAllocation() {}
+    GeometryPoolPtr m_pool;
+    uint32_t m_vertexNode { OffsetAllocator::InvalidNode };
+    uint32_t m_indexNode { OffsetAllocator::InvalidNode };
+    uint32_t m_vertexCount { 0 };
+    uint32_t m_indexCount { 0 };
+};
+
+// static geometry of every mesh in one vertex and one index buffer read
+// through one vertex layout, so thousands of meshes are two buffer
+// objects and draws of different meshes batch into one multi draw.
+// when no free range fits, the live ranges are copied packed into larger
+// buffers on the gpu, and freeing compacts the same way once the free
+// space is split up too much
+class GeometryPool : public std::enable_shared_from_this<GeometryPool> {
+public:
+    // the pool meshes are created in, it lives as long as their geometry
+    static GeometryPoolPtr Get();
+
+    GeometryAllocationPtr Allocate(const Vertex* vertices, uint32_t vertexCount,
+        const uint32_t* indices, uint32_t indexCount);
+
+    const VertexLayoutPtr& GetVertexLayout() const { return m_vertexLayout; }
+    // changes whenever ranges have moved
+    uint32_t GetVersion() const { return m_version; }
+    uint32_t GetVertexCapacity() const { return m_vertexAllocator.GetSize(); }
+    uint32_t GetIndexCapacity() const { return m_indexAllocator.GetSize(); }
+    uint32_t GetUsedVertexCount() const {
+        return m_vertexAllocator.GetSize() - m_vertexAllocator.GetFreeSize();
+    }
+    uint32_t GetUsedIndexCount() const {
+        return m_indexAllocator.GetSize() - m_indexAllocator.GetFreeSize();
+    }
+
+private:
+    friend class GeometryAllocation;
+    GeometryPool() {}
+    static GeometryPoolUPtr Create(uint32_t vertexCapacity, uint32_t indexCapacity);
+    bool Init(uint32_t vertexCapacity, uint32_t indexCapacity);
+    void Free(uint32_t vertexNode, uint32_t indexNode);
+    // copies the live ranges packed into new buffers of the given capacity
+    void Relocate(uint32_t vertexCapacity, uint32_t indexCapacity);
+    void BindBuffers() const;
+
+    VertexLayoutPtr m_vertexLayout;
+    BufferUPtr m_vertexBuffer;
+    BufferUPtr m_indexBuffer;
+    OffsetAllocator m_vertexAllocator;
+    OffsetAllocator m_indexAllocator;
+    uint32_t m_version { 0 };
+};
+
+
+
+CLASS_PTR(Mesh);
+class Mesh {
+public:
+    static MeshUPtr Create( const std::vector<Vertex>& vertices,
+        const std::vector<uint32_t>& indices, uint32_t primitiveType);
+    static MeshUPtr CreateBox();
+    static MeshUPtr CreatePlane();
+    // a mesh drawing a sub range of an allocation shared with other
+    // meshes, firstIndex and baseVertex count from the allocation's start
+    static MeshUPtr CreateFromRange(GeometryAllocationPtr geometry,
+        uint32_t firstIndex, uint32_t indexCount, int32_t baseVertex,
+        uint32_t primitiveType,
+        const BoundingBox& boundingBox, const BoundingSphere& boundingSphere);
+
+    const VertexLayout* GetVertexLayout() const { return m_vertexLayout.get(); }
+
+    const BoundingBox& GetBoundingBox() const { return m_boundingBox; }
+    const BoundingSphere& GetBoundingSphere() const { return m_boundingSphere; }
+
+    uint32_t GetPrimitiveType() const { return m_primitiveType; }
+    // in the pool's buffers
+    uint32_t GetFirstIndex() const { return m_geometry->GetFirstIndex() + m_firstIndex; }
+    uint32_t GetIndexCount() const { return m_indexCount; }
+    int32_t GetBaseVertex() const { return m_geometry->GetBaseVertex() + m_baseVertex; }
+
+    // void SetMaterial(MaterialPtr material) { m_material = material; }
+    // MaterialPtr GetMaterial() const { return m_material; }
+
+    void Draw() const;
+    // void Draw(const Program* program) const;
+    void DrawInstanced(const Buffer* instanceBuffer,
+        size_t firstInstance, int instanceCount) const;
+
+private:
+    Mesh() {}
+    void Init( const std::vector<Vertex>& vertices,
+        const std::vector<uint32_t>& indices, uint32_t primitiveType);
+
+    uint32_t m_primitiveType { GL_TRIANGLES };
+
+    // the pool's layout, the mesh's ranges in it
+    VertexLayoutPtr m_vertexLayout;
+    GeometryAllocationPtr m_geometry;
+
+    // index range inside the (possibly shared) allocation
+    uint32_t m_firstIndex { 0 };
+    uint32_t m_indexCount { 0 };
+    int32_t m_baseVertex { 0 };
+
+    // local space bounds, used for culling
+    BoundingBox m_boundingBox;
+    BoundingSphere m_boundingSphere;
+    
+    // MaterialPtr m_material;
+};
+
+
+
+CLASS_PTR(MultiDrawBatch)
+class MultiDrawBatch {
+public:
+    static MultiDrawBatchUPtr Create();
+
+    void Clear();
+    void Add(const Mesh* mesh, uint32_t baseInstance, uint32_t instanceCount);
+
+    // one glMultiDrawElementsIndirect per run of meshes sharing a vertex layout,
+    // or the same command buffer looped on the CPU when MDI is not available.
+    // instances start at instanceOffset of the stream, commands are
+    // written behind them
+    void Submit(StreamBuffer* streamBuffer, size_t instanceOffset);
+    // bytes Submit writes to the stream
+    size_t GetStreamSize() const {
+        return m_multiDraw ? m_commands.size() * sizeof(DrawElementsIndirectCommand) : 0;
+    }
+
+    size_t GetCommandCount() const { return m_commands.size(); }
+    size_t GetDrawCallCount() const { return m_drawCallCount; }
+
+private:
+    MultiDrawBatch() {}
+
+    struct Run {
+        const VertexLayout* vertexLayout;
+        uint32_t primitiveType;
+        size_t first;
+        size_t count;
+    };
+
+    bool m_multiDraw { false };
+    std::vector<DrawElementsIndirectCommand> m_commands;
+    std::vector<Run> m_runs;
+    size_t m_drawCallCount { 0 };
+};
+
+
+
+// jobs left to finish, to wait on a group of jobs or start jobs after
+// them. a counter must outlive its jobs and the JobSystem::Wait on it
+class JobCounter {
+private:
+    friend class JobSystem;
+    std::atomic<int> m_count { 0 };
+    // jobs queued by JobSystem::RunAfter once the count reaches zero
+    std::mutex m_mutex;
+    // signalled under m_mutex when the count reaches zero, for waiters
+    // with nothing left to run
+    std::condition_variable m_done;
+    std::vector<std::pair<std::function<void()>, JobCounter*>> m_continuations;
+};
+
+
+
+// work stealing job scheduler shared by the engine. there is a worker
+// less than hardware threads, a thread waiting on jobs runs them as the
+// last one. every worker pops the jobs it queued from the back of its
+// own queue while idle workers steal from the front of the others,
+// jobs queued by other threads go to one shared queue
+CLASS_PTR(JobSystem)
+class JobSystem {
+public:
+    using Job = std::function<void()>;
+
+    static JobSystemUPtr Create(size_t workerCount);
+    // the engine's scheduler, created on first use
+    static JobSystem* Get();
+    ~JobSystem();
+
+    size_t GetWorkerCount() const { return m_workers.size(); }
+    // counter, if given, counts the job until it has run
+    void Run(Job job, JobCounter* counter = nullptr);
+    // queues job once dependency has reached zero
+    void RunAfter(JobCounter& dependency, Job job, JobCounter* counter = nullptr);
+    // runs jobs on the calling thread until counter reaches zero
+    void Wait(JobCounter& counter);
+
+private:
+    JobSystem() {}
+    void Init(size_t workerCount);
+    void WorkerLoop(size_t index);
+    size_t GetQueueIndex() const;
+    void Push(Job job, JobCounter* counter);
+    // runs a job of the given queue, or one stolen from another
+    bool RunOne(size_t queueIndex);
+    void Finish(JobCounter* counter);
+
+    struct QueuedJob {
+        Job job;
+        JobCounter* counter;
+    };
+    // ring buffer that only grows, a steady job load allocates nothing
+    struct Queue {
+        std::mutex mutex;
+        std::vector<QueuedJob> jobs;
+        size_t head { 0 };
+        size_t count { 0 };
+
+        void PushBack(QueuedJob&& job);
+        QueuedJob PopBack();
+        QueuedJob PopFront();
+    };
+
+    // a queue per worker, the last one for the other threads
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::atomic<size_t> m_queuedJobs { 0 };
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeUp;
+    bool m_quit { false };
+};
+
+// runs func(chunkIndex) for every chunk of itemCount items split by chunkSize,
+// spread over the job system's workers with the calling thread taking part
+template <typename Func>
+void ParallelFor(size_t itemCount, size_t chunkSize, Func&& func) {
+    size_t chunkCount = (itemCount + chunkSize - 1) / chunkSize;
+    if (chunkCount == 0)
+        return;
+
+    // jobs pull chunk indices until none are left
+    auto jobSystem = JobSystem::Get();
+    size_t jobCount = std::min(jobSystem->GetWorkerCount() + 1, chunkCount);
+
+    std::atomic<size_t> nextChunk { 0 };
+    auto worker = [&]() {
+        TRACE_SCOPE("ParallelFor");
+        size_t chunkIndex;
+        while ((chunkIndex = nextChunk.fetch_add(1)) < chunkCount)
+            func(chunkIndex);
+    };
+
+    // the job captures only a reference to stay within std::function's
+    // small buffer, no allocation per job
+    JobCounter counter;
+    for (size_t i = 1; i < jobCount; i++)
+        jobSystem->Run([&worker]() { worker(); }, &counter);
+    worker();
+    jobSystem->Wait(counter);
+}
+
+
+
+// transform hierarchy stored as flat arrays in parent-before-child order,
+// nodes are appended depth first so every subtree is a contiguous range.
+// world matrices are recomputed only below nodes whose local matrix changed
+CLASS_PTR(SceneGraph)
+class SceneGraph {
+public:
+    static SceneGraphUPtr Create();
+
+    // parent is -1 for a root, otherwise a node on the current append path
+    int AddNode(int parent, const glm::mat4& localTransform);
+    void SetLocalTransform(int node, const glm::mat4& localTransform);
+
+    // returns true if any world matrix changed
+    bool Update();
+
+    int GetNodeCount() const { return (int)m_parents.size(); }
+    int GetParent(int node) const { return m_parents[node]; }
+    const glm::mat4& GetLocalTransform(int node) const { return m_localTransforms[node]; }
+    const glm::mat4& GetWorldTransform(int node) const { return m_worldTransforms[node]; }
+    size_t GetUpdatedNodeCount() const { return m_updatedNodeCount; }
+
+private:
+    SceneGraph() {}
+    void MarkDirty(int node);
+    size_t UpdateSubtree(int root);
+
+    std::vector<int> m_parents;
+    std::vector<int> m_subtreeEnds;     // one past the last descendant
+    std::vector<glm::mat4> m_localTransforms;
+    std::vector<glm::mat4> m_worldTransforms;
+    std::vector<uint8_t> m_dirty;       // local transform changed
+    std::vector<uint8_t> m_dirtyBelow;  // the node or a descendant is dirty
+    std::vector<uint8_t> m_changed;     // world matrix rewritten in this update
+    std::vector<int> m_roots;
+    // scratch of Update, the roots with dirty nodes and their updated counts
+    std::vector<int> m_dirtyRoots;
+    std::vector<size_t> m_updatedCounts;
+    size_t m_updatedNodeCount { 0 };
+};
+
+
+
+// vertices and triangle indices of a triangulated assimp mesh, the cpu
+// side of Model::ProcessMesh. vertices takes mNumVertices and indices
+// three per face
+void ConvertMesh(const aiMesh* mesh, Vertex* vertices, uint32_t* indices);
+
+CLASS_PTR(Model);
+class Model {
+public:
+    static ModelUPtr Load(const std::string& filename);
+
+    int GetMeshCount() const { return (int)m_meshes.size(); }
+    MeshPtr GetMesh(int index) const { return m_meshes[index]; }
+    // node hierarchy of the file, every mesh hangs off one node
+    SceneGraph* GetSceneGraph() const { return m_sceneGraph.get(); }
+    int GetMeshNode(int index) const { return m_meshNodes[index]; }
+    const BoundingBox& GetBoundingBox() const { return m_boundingBox; }
+    // void Draw(const Program* program) const;
+    void Draw() const;
+
+private:
+    Model() {}
+    bool LoadByAssimp(const std::string& filename);
+    void ProcessNode(aiNode* node, const aiScene* scene, int parentNode);
+    void ProcessMeshes();
+    void CreateSharedGeometry();
+
+    std::vector<MeshPtr> m_meshes;
+    std::vector<int> m_meshNodes;
+    SceneGraphUPtr m_sceneGraph;
+    // std::vector<MaterialPtr> m_materials;
+
+    // every mesh of the model lives in one allocation of the geometry
+    // pool. the indirect commands are rewritten when the pool has moved it
+    GeometryAllocationPtr m_geometry;
+    BufferUPtr m_indirectBuffer;
+    mutable uint32_t m_poolVersion { 0 };
+    void UpdateIndirectBuffer() const;
+
+    // geometry gathered while loading, released after upload. meshes
+    // are converted on the job system straight into their range
+    struct MeshRange {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        int32_t baseVertex;
+        BoundingBox boundingBox;
+        BoundingSphere boundingSphere;
+    };
+    std::vector<Vertex> m_vertices;
+    std::vector<uint32_t> m_indices;
+    std::vector<MeshRange> m_ranges;
+    std::vector<const aiMesh*> m_sourceMeshes;
+    void ProcessMesh(const aiMesh* mesh, MeshRange& range);
+
+    BoundingBox m_boundingBox;
+};
+
+
+
+// view frustum planes, xyz is the inward normal and w the distance
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Gribb / Hartmann plane extraction from a projection * view matrix
+    static Frustum FromMatrix(const glm::mat4& m) {
+        Frustum frustum;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 2; j++) {
+                float sign = j == 0 ? 1.0f : -1.0f;
+                glm::vec4 plane(
+                    m[0][3] + sign * m[0][i],
+                    m[1][3] + sign * m[1][i],
+                    m[2][3] + sign * m[2][i],
+                    m[3][3] + sign * m[3][i]);
+                frustum.planes[i * 2 + j] = plane / glm::length(glm::vec3(plane));
+            }
+        }
+        return frustum;
+    }
+};
+
+// world space boxes of the scene as center / extent arrays
+// so they can be tested several at a time
+struct BoundsSoA {
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+
+    size_t Size() const { return centerX.size(); }
+    void Resize(size_t count) {
+        for (auto array: { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+            array->resize(count, 0.0f);
+    }
+    void Set(size_t index, const BoundingBox& box) {
+        // an empty box is never culled
+        auto center = box.IsValid() ? box.GetCenter() : glm::vec3(0.0f);
+        auto extent = box.IsValid() ? box.GetExtent() : glm::vec3(1e30f);
+        centerX[index] = center.x; centerY[index] = center.y; centerZ[index] = center.z;
+        extentX[index] = extent.x; extentY[index] = extent.y; extentZ[index] = extent.z;
+    }
+};
+
+// writes 1 to visible[i] for every box in [begin, end) touching the frustum
+void CullBoxes(const Frustum& frustum, const BoundsSoA& bounds,
+    size_t begin, size_t end, uint8_t* visible);
+
+
+
+// object transforms as position, rotation and scale arrays, the layout the
+// batch kernel below reads four objects at a time
+struct TransformSoA {
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+    std::vector<float> scaleX, scaleY, scaleZ;
+
+    size_t Size() const { return positionX.size(); }
+    void Resize(size_t count) {
+        for (auto array: { &positionX, &positionY, &positionZ,
+            &rotationX, &rotationY, &rotationZ, &rotationW })
+            array->resize(count, 0.0f);
+        for (auto array: { &scaleX, &scaleY, &scaleZ })
+            array->resize(count, 1.0f);
+    }
+    // rotation must be a unit quaternion
+    void Set(size_t index, const glm::vec3& position, const glm::quat& rotation,
+        const glm::vec3& scale = glm::vec3(1.0f)) {
+        positionX[index] = position.x; positionY[index] = position.y; positionZ[index] = position.z;
+        rotationX[index] = rotation.x; rotationY[index] = rotation.y;
+        rotationZ[index] = rotation.z; rotationW[index] = rotation.w;
+        scaleX[index] = scale.x; scaleY[index] = scale.y; scaleZ[index] = scale.z;
+    }
+};
+
+// writes the model matrix (translate * rotate * scale) and, if mvp is given,
+// viewProjection * model for the transforms in [begin, end). outputs are
+// strided in bytes so they can point into scene objects or instance data
+void ComputeTransforms(const TransformSoA& transforms, const glm::mat4& viewProjection,
+    size_t begin, size_t end, glm::mat4* model, size_t modelStride,
+    glm::mat4* mvp = nullptr, size_t mvpStride = sizeof(glm::mat4));
+
+// a * b with one sse multiply-add per column element of b
+inline glm::mat4 MultiplyMatrix(const glm::mat4& a, const glm::mat4& b) {
+#if defined(USE_SSE)
+    __m128 a0 = _mm_loadu_ps(&a[0][0]);
+    __m128 a1 = _mm_loadu_ps(&a[1][0]);
+    __m128 a2 = _mm_loadu_ps(&a[2][0]);
+    __m128 a3 = _mm_loadu_ps(&a[3][0]);
+    glm::mat4 result;
+    for (int c = 0; c < 4; c++) {
+        __m128 column = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(b[c][0])), _mm_mul_ps(a1, _mm_set1_ps(b[c][1]))),
+            _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(b[c][2])), _mm_mul_ps(a3, _mm_set1_ps(b[c][3]))));
+        _mm_storeu_ps(&result[c][0], column);
+    }
+    return result;
+#else
+    return a * b;
+#endif
+}
+
+
+
+// bounding volume hierarchy over a set of boxes (scene objects or triangles),
+// built with binned SAH and refittable when the boxes move
+CLASS_PTR(Bvh)
+class Bvh {
+public:
+    static BvhUPtr Create();
+
+    // nodes are stored depth first: the left child directly follows its parent
+    struct Node {
+        BoundingBox box;
+        uint32_t first { 0 };   // leaf: first entry of the index list, inner: right child
+        uint32_t count { 0 };   // primitive count, 0 for inner nodes
+    };
+
+    void Build(const BoundsSoA& bounds);
+    // updates node boxes bottom up, the tree topology is kept
+    void Refit(const BoundsSoA& bounds);
+
+    // indices of every primitive whose box touches the frustum
+    void QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& result) const;
+    // closest primitive box hit by the ray, false if nothing is hit
+    bool Raycast(const glm::vec3& origin, const glm::vec3& direction,
+        float maxDistance, uint32_t& hitIndex, float& hitDistance) const;
+
+    size_t GetPrimitiveCount() const { return m_boxes.size(); }
+    size_t GetNodeCount() const { return m_nodes.size(); }
+
+private:
+    Bvh() {}
+    uint32_t BuildNode(uint32_t first, uint32_t count, int depth);
+    void LoadBoxes(const BoundsSoA& bounds);
+
+    static const int kBinCount { 16 };
+    static const uint32_t kMaxLeafSize { 4 };
+
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_indices;        // primitive indices referenced by the leaves
+    std::vector<BoundingBox> m_boxes;       // primitive boxes
+    std::vector<glm::vec3> m_centers;       // used only while building
+};
+
+
+
+// triangle soup used to rasterize an object into the occlusion buffer
+CLASS_PTR(OccluderGeometry)
+struct OccluderGeometry {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+
+    // matches the geometry of Mesh::CreateBox()
+    static OccluderGeometryPtr CreateBox() {
+        auto box = std::make_shared<OccluderGeometry>();
+        for (int i = 0; i < 8; i++) {
+            box->positions.push_back(glm::vec3(
+                (i & 1) ? 0.5f : -0.5f, (i & 2) ? 0.5f : -0.5f, (i & 4) ? 0.5f : -0.5f));
+        }
+        box->indices = {
+            0, 2, 1, 1, 2, 3,   4, 5, 6, 5, 7, 6,
+            0, 1, 4, 1, 5, 4,   2, 6, 3, 3, 6, 7,
+            0, 4, 2, 2, 4, 6,   1, 3, 5, 3, 7, 5,
+        };
+        return box;
+    }
+};
+
+
+
+// software occlusion culling: occluders are rasterized into a small depth
+// buffer on the CPU, object boxes are tested against its max depth pyramid
+CLASS_PTR(OcclusionCuller)
+class OcclusionCuller {
+public:
+    static OcclusionCullerUPtr Create(int width = 256, int height = 128);
+
+    struct Occluder {
+        const OccluderGeometry* geometry;
+        glm::mat4 modelTransform;
+    };
+
+    // rasterizes the occluders, one horizontal band per job, then builds hi-z
+    void RenderOccluders(const std::vector<Occluder>& occluders,
+        const glm::mat4& viewProjection);
+
+    // clears visible[i] for every box in [begin, end) hidden behind the occluders
+    void TestBoxes(const BoundsSoA& bounds, size_t begin, size_t end,
+        uint8_t* visible) const;
+    bool IsVisible(const BoundingBox& box) const;
+
+    int GetWidth() const { return m_width; }
+    int GetHeight() const { return m_height; }
+    const float* GetDepth() const { return m_levels[0].data(); }
+    size_t GetTriangleCount() const { return m_triangles.size(); }
+
+private:
+    OcclusionCuller() {}
+
+    // x, y in pixels, z is ndc depth
+    struct ScreenTriangle {
+        glm::vec3 v[3];
+    };
+
+    void RasterizeBand(int minY, int maxY);
+    void RasterizeTriangle(const ScreenTriangle& triangle, int minY, int maxY);
+    void BuildHiZ();
+
+    static const int kBandHeight { 16 };
+
+    int m_width { 0 };
+    int m_height { 0 };
+    glm::mat4 m_viewProjection { glm::mat4(1.0f) };
+    std::vector<ScreenTriangle> m_triangles;
+    // clip space positions of the occluder being set up
+    std::vector<glm::vec4> m_clipPositions;
+
+    // level 0 is the depth buffer, every level keeps the max depth of 2x2 texels
+    std::vector<std::vector<float>> m_levels;
+    std::vector<glm::ivec2> m_levelSizes;
+};
+
+
+
+// scene object: what to draw and where, owned by the context
+struct SceneObject {
+    MeshPtr mesh;
+    glm::mat4 modelTransform { glm::mat4(1.0f) };
+    glm::vec4 color { glm::vec4(1.0f) };
+    OccluderGeometryPtr occluder;   // null if the object hides nothing
+    bool dynamic { false };         // moves every frame, not in cached shadows
+};
+
+// API-agnostic draw command: filled by the frame preparation jobs,
+// replayed on the GL thread
+struct DrawCommand {
+    const Mesh* mesh { nullptr };
+    uint32_t objectIndex { 0 };
+    glm::mat4 modelTransform { glm::mat4(1.0f) };
+    glm::mat4 transform { glm::mat4(1.0f) };    // projection * view * model
+    glm::mat3 normalTransform { glm::mat3(1.0f) };
+    glm::vec4 color { glm::vec4(1.0f) };
+};
+
+struct DrawList {
+    std::vector<DrawCommand> commands;
+
+    void Clear() { commands.clear(); }
+    size_t Size() const { return commands.size(); }
+    void Append(const DrawList& other) {
+        commands.insert(commands.end(), other.commands.begin(), other.commands.end());
+    }
+};
+
+
+
+CLASS_PTR(DrawListBuilder)
+class DrawListBuilder {
+public:
+    static DrawListBuilderUPtr Create(size_t chunkSize = 256);
+
+    // computes the world space box of every object, one job per chunk
+    const BoundsSoA& UpdateBounds(const std::vector<SceneObject>& objects);
+
+    // splits the scene into chunks, fills one draw list per chunk in parallel
+    // and merges them in chunk order so the result is deterministic.
+    // needs UpdateBounds() on the same objects first. a visibility mask,
+    // e.g. from a Bvh query or occlusion test, is combined with the
+    // builder's own frustum culling
+    const DrawList& Build(const std::vector<SceneObject>& objects,
+        const glm::mat4& viewProjection,
+        const std::vector<uint8_t>* visibility = nullptr);
+
+    const DrawList& GetDrawList() const { return m_drawList; }
+    size_t GetChunkCount() const { return m_chunkLists.size(); }
+
+    void SetFrustumCulling(bool enable) { m_frustumCulling = enable; }
+    const BoundsSoA& GetWorldBounds() const {
+        return m_boundsSource ? m_boundsSource->GetWorldBounds() : m_worldBounds;
+    }
+    // culls with the boxes another builder computed for the same objects,
+    // so UpdateBounds() runs once per frame however many views are built
+    void SetBoundsSource(const DrawListBuilder* builder) { m_boundsSource = builder; }
+
+private:
+    DrawListBuilder() {}
+    void BuildChunk(size_t chunkIndex, const std::vector<SceneObject>& objects,
+        const glm::mat4& viewProjection, const Frustum& frustum,
+        const std::vector<uint8_t>* visibility);
+
+    size_t m_chunkSize { 256 };
+    std::vector<DrawList> m_chunkLists;     // reused every frame
+    DrawList m_drawList;
+
+    // indexed by scene object, each chunk writes its own slice
+    bool m_frustumCulling { true };
+    BoundsSoA m_worldBounds;
+    const DrawListBuilder* m_boundsSource { nullptr };
+    std::vector<uint8_t> m_visible;
+};
+
+
+
+// point or spot light with a limited range, many of them light the scene
+struct SceneLight {
+    glm::vec3 position { glm::vec3(0.0f) };
+    float distance { 8.0f };                    // range fed to GetAttenuationCoeff()
+    glm::vec3 color { glm::vec3(1.0f) };
+    glm::vec3 direction { glm::vec3(0.0f, -1.0f, 0.0f) };
+    glm::vec2 cutoff { glm::vec2(0.0f) };       // degrees, x == 0 for a point light
+};
+
+// scene light as the shaders read it, four vec4s per light
+struct SceneLightData {
+    glm::vec4 positionRadius;       // w: radius from GetAttenuationRadius()
+    glm::vec4 color;
+    glm::vec4 directionInner;       // w: cos of the inner cone angle
+    glm::vec4 attenuationOuter;     // w: cos of the outer cone angle
+};
+
+// distance where a light of the given peak intensity falls under 1/256,
+// the smallest step an 8 bit target shows, from 1 / (kc + kl d + kq d^2)
+float GetAttenuationRadius(const glm::vec3& attenuation, float intensity);
+
+// light bounding spheres, one array per component
+struct LightBoundsSoA {
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> radius;
+
+    size_t Size() const { return centerX.size(); }
+    void Resize(size_t count) {
+        for (auto array: { &centerX, &centerY, &centerZ, &radius })
+            array->resize(count, 0.0f);
+    }
+    void Set(size_t index, const glm::vec3& center, float r) {
+        centerX[index] = center.x; centerY[index] = center.y; centerZ[index] = center.z;
+        radius[index] = r;
+    }
+};
+
+// appends the index of every light in [begin, end) whose sphere touches box
+void QueryLights(const LightBoundsSoA& bounds, const BoundingBox& box,
+    size_t begin, size_t end, std::vector<uint32_t>& result);
+
+
+
+// the local lights of a frame in compact arrays: the packed records the
+// shaders read and the bounding spheres. a light's attenuation and radius
+// are derived only when its range or brightness changes. it also builds
+// per draw command light lists for forward shading
+CLASS_PTR(LightSet)
+class LightSet {
+public:
+    static LightSetUPtr Create();
+
+    // copies the lights and uploads the records to GetDataTexture()
+    void Update(const std::vector<SceneLight>& lights);
+
+    size_t Size() const { return m_data.size(); }
+    const std::vector<SceneLightData>& GetData() const { return m_data; }
+    const LightBoundsSoA& GetBounds() const { return m_bounds; }
+    const BufferTexture* GetDataTexture() const { return m_dataTexture.get(); }
+    size_t GetRecomputedCount() const { return m_recomputedCount; }
+
+    // the lights touching each command's object box, ranges follow the
+    // command order and index GetObjectLightIndexTexture()
+    void CullObjects(const DrawList& drawList, const BoundsSoA& objectBounds);
+    const std::vector<LightListRange>& GetObjectLightRanges() const { return m_objectLightRanges; }
+    const BufferTexture* GetObjectLightIndexTexture() const { return m_objectLightIndexTexture.get(); }
+    size_t GetObjectLightIndexCount() const { return m_objectLightIndices.size(); }
+
+private:
+    LightSet() {}
+    bool Init();
+
+    // range and peak intensity the attenuation below was derived from
+    std::vector<glm::vec2> m_attenuationKeys;
+    std::vector<glm::vec4> m_attenuations;      // kc, kl, kq, radius
+    size_t m_recomputedCount { 0 };
+
+    std::vector<SceneLightData> m_data;
+    LightBoundsSoA m_bounds;
+    BufferTextureUPtr m_dataTexture;
+
+    // commands are culled in chunks, first against the chunk's box
+    struct CullChunk {
+        std::vector<uint32_t> candidates;
+        LightBoundsSoA candidateBounds;
+        std::vector<uint32_t> matches;
+        std::vector<uint32_t> indices;
+    };
+    std::vector<CullChunk> m_cullChunks;
+    std::vector<LightListRange> m_objectLightRanges;
+    std::vector<uint32_t> m_objectLightIndices;
+    BufferTextureUPtr m_objectLightIndexTexture;
+};
+
+
+
+// deferred shading: the scene is drawn once into a g-buffer
+// (albedo + specular, normal, depth), lights are then accumulated per pixel,
+// a full screen pass for the main light and instanced boxes around the
+// local lights, so the cost follows lit pixels instead of objects * lights
+CLASS_PTR(DeferredRenderer)
+class DeferredRenderer {
+public:
+    static DeferredRendererUPtr Create(int width, int height);
+
+    bool Resize(int width, int height);
+
+    // binds and clears the g-buffer, the scene is then drawn with the
+    // geometry program, which takes the forward program's vertex stream
+    void BeginGeometryPass(const glm::vec4& clearColor);
+    const Program* GetGeometryProgram() const { return m_geometryProgram.get(); }
+
+    // back on the default framebuffer with the g-buffer depth copied over,
+    // returns the full screen program in use for the main light uniforms
+    const Program* BeginLightingPass(const glm::mat4& viewProjection,
+        const glm::vec3& viewPos, float shininess);
+    void DrawFullscreenLight();
+    void DrawLightVolumes(const LightSet& lights);
+
+    const Framebuffer* GetGBuffer() const { return m_gBuffer.get(); }
+
+private:
+    DeferredRenderer() {}
+    bool Init(int width, int height);
+    void BindGBufferTextures(const Program* program) const;
+
+    int m_width { 0 };
+    int m_height { 0 };
+    FramebufferUPtr m_gBuffer;
+
+    ProgramUPtr m_geometryProgram;
+    ProgramUPtr m_fullscreenProgram;
+    ProgramUPtr m_volumeProgram;
+    MeshUPtr m_plane;
+    MeshUPtr m_volume;
+
+    glm::mat4 m_viewProjection { glm::mat4(1.0f) };
+    glm::vec3 m_viewPos { glm::vec3(0.0f) };
+    float m_shininess { 32.0f };
+};
+
+
+
+// clustered forward shading: the view frustum is cut into froxels, screen
+// tiles times exponentially growing depth slices, and the bounding sphere
+// of every light is binned into the froxels it touches on worker threads.
+// the forward shader finds its froxel and only loops over that light list
+CLASS_PTR(ClusteredLights)
+class ClusteredLights {
+public:
+    static ClusteredLightsUPtr Create(int tileCountX = 16, int tileCountY = 9,
+        int sliceCount = 24);
+
+    // bins the lights against this frame's camera and uploads the lists
+    void Build(const LightSet& lights, const glm::mat4& view,
+        const glm::mat4& projection, float zNear, float zFar);
+
+    // binds the light lists to texture units 2 ~ 4 and returns the forward
+    // program in use, material and main light uniforms are left to the caller
+    const Program* BeginForwardPass(int width, int height);
+
+    size_t GetClusterCount() const { return m_clusters.size(); }
+    size_t GetLightIndexCount() const { return m_lightIndices.size(); }
+    uint32_t GetMaxClusterLightCount() const { return m_maxClusterLightCount; }
+
+private:
+    ClusteredLights() {}
+    bool Init(int tileCountX, int tileCountY, int sliceCount);
+    void UpdateClusterBounds(const glm::mat4& projection, float zNear, float zFar);
+    int GetSlice(float depth) const;
+
+    // view space sphere and the froxel range it overlaps, empty if minZ > maxZ
+    struct LightBounds {
+        glm::vec3 center;
+        float radius;
+        glm::ivec3 min;
+        glm::ivec3 max;
+    };
+
+    int m_tileCountX { 16 };
+    int m_tileCountY { 9 };
+    int m_sliceCount { 24 };
+
+    // view space froxel boxes, rebuilt when the projection changes. a box
+    // is separable, its x range only depends on the tile column and slice,
+    // y on the row and slice, z on the slice
+    glm::mat4 m_view { glm::mat4(1.0f) };
+    glm::mat4 m_projection { glm::mat4(0.0f) };
+    float m_zNear { 0.0f };
+    float m_zFar { 0.0f };
+    std::vector<glm::vec2> m_columnRanges;
+    std::vector<glm::vec2> m_rowRanges;
+    std::vector<glm::vec2> m_sliceRanges;
+
+    std::vector<LightBounds> m_lightBounds;
+    // per froxel light lists, a slice only writes its own froxels
+    std::vector<std::vector<uint32_t>> m_clusterLights;
+    std::vector<LightListRange> m_clusters;
+    std::vector<uint32_t> m_lightIndices;
+    uint32_t m_maxClusterLightCount { 0 };
+
+    ProgramUPtr m_program;
+    const BufferTexture* m_lightDataTexture { nullptr };
+    BufferTextureUPtr m_clusterTexture;
+    BufferTextureUPtr m_lightIndexTexture;
+};
+
+
+
+// shadow maps of the main spot light and of the sun, whose cascades sit
+// side by side in one atlas. the depth of the static objects is cached
+// per map and re-rendered only when the map's light matrix or the static
+// scene changes, moving objects are drawn over a copy of it every frame.
+// a still scene re-renders nothing
+CLASS_PTR(ShadowMaps)
+class ShadowMaps {
+public:
+    static const int CascadeCount = 3;
+    static ShadowMapsUPtr Create(int spotSize = 1024, int cascadeSize = 1024);
+
+    // outerAngle is the half angle of the cone in degrees
+    void SetSpotLight(const glm::vec3& position, const glm::vec3& direction,
+        float outerAngle, float range);
+    // fits the cascades to the camera frustum up to shadowDistance
+    void SetSunLight(const glm::vec3& direction, const glm::mat4& view,
+        float fovY, float aspect, float zNear, float shadowDistance);
+
+    // map 0 is the spot light, 1 ~ CascadeCount the sun cascades
+    int GetMapCount() const { return 1 + CascadeCount; }
+    const glm::mat4& GetViewProjection(int map) const { return m_maps[map].viewProjection; }
+
+    // the cached static depth is stale after the light matrix or the
+    // static scene, counted by staticVersion, changed
+    bool IsStaticDirty(int map, uint32_t staticVersion) const;
+    // both passes leave the depth program in use, the caller submits the
+    // casters. the dynamic pass restores the static depth when it changed
+    // or moving objects were drawn last frame, and returns false when no
+    // moving objects need drawing
+    void BeginStaticPass(int map, uint32_t staticVersion);
+    bool BeginDynamicPass(int map, bool hasDynamicObjects);
+    void EndPasses(int width, int height);
+    // clears the maps to fully lit and forgets the cache
+    void Clear();
+
+    // binds the maps to texture units firstUnit, firstUnit + 1
+    void SetUniforms(const Program* program, int firstUnit) const;
+
+    int GetStaticPassCount() const { return m_staticPassCount; }
+    int GetDynamicPassCount() const { return m_dynamicPassCount; }
+
+private:
+    ShadowMaps() {}
+    bool Init(int spotSize, int cascadeSize);
+    void BindMap(int map, bool staticDepth) const;
+
+    struct Map {
+        glm::mat4 viewProjection { glm::mat4(1.0f) };
+        glm::ivec4 viewport;                // x, y, width, height in its texture
+        Framebuffer* staticFramebuffer { nullptr };
+        Framebuffer* framebuffer { nullptr };
+
+        glm::mat4 cachedViewProjection { glm::mat4(0.0f) };
+        uint32_t cachedVersion { 0 };
+        bool cached { false };
+        bool staticUpdated { false };
+        bool hadDynamicObjects { false };
+    };
+    Map m_maps[1 + CascadeCount];
+
+    // static depth and static + moving depth, the latter is sampled
+    FramebufferUPtr m_spotStatic;
+    FramebufferUPtr m_spot;
+    FramebufferUPtr m_sunStatic;
+    FramebufferUPtr m_sun;
+    ProgramUPtr m_depthProgram;
+
+    // extra depth towards the sun for casters outside the view frustum
+    float m_casterDistance { 20.0f };
+    int m_staticPassCount { 0 };
+    int m_dynamicPassCount { 0 };
+};
+
+
+
+// frame profiler. zones are named scopes entered on the render thread,
+// nested by the order they are entered. every zone is timed on the cpu,
+// gpu zones also write GL_TIMESTAMP queries that are read back
+// QueryLatency frames later, when the gpu is long done with them.
+// timestamps are used instead of GL_TIME_ELAPSED, which can not nest
+CLASS_PTR(Profiler)
+class Profiler {
+public:
+    static const int HistorySize = 240;
+    static const int QueryLatency = 4;
+    static ProfilerUPtr Create();
+    ~Profiler();
+
+    // closes the previous frame, its time includes the ui and the swap
+    void BeginFrame();
+    // name must outlive the profiler, a string literal
+    void BeginZone(const char* name, bool gpu);
+    void EndZone();
+
+    // closes the frame being recorded and reads back every pending query,
+    // waiting for the gpu. the next BeginFrame starts a fresh frame
+    void Flush();
+
+    // per-zone averages and frame time percentiles over the history, may
+    // run on another thread than the one recording zones
+    void DrawOverlay() const;
+
+    // per-frame zone averages over all frames closed since ResetTotals
+    struct ZoneTotal {
+        std::string name;           // path from the root zone, "render/update"
+        bool gpu;
+        float cpuTime;
+        float gpuTime;
+    };
+    void ResetTotals();
+    std::vector<ZoneTotal> GetTotals() const;
+
+    static float GetPercentile(float* samples, size_t count, float percentile);
+    static float GetPercentile(std::vector<float>& samples, float percentile) {
+        return GetPercentile(samples.data(), samples.size(), percentile);
+    }
+
+private:
+    Profiler() {}
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Zone {
+        const char* name;
+        int parent;
+        int depth;
+        bool gpu;
+        std::vector<int> children;
+        size_t firstFrame;
+        size_t firstGpuFrame;
+        float cpuTime { 0.0f };     // ms spent in this frame so far
+        std::vector<float> cpuHistory;
+        std::vector<float> gpuHistory;
+        double cpuTotal { 0.0 };
+        double gpuTotal { 0.0 };
+    };
+    struct ActiveZone {
+        int zone;
+        Clock::time_point start;
+        int timestamp;              // index into the frame's timestamps, -1 on cpu
+    };
+    struct GpuTimestamp {
+        int zone;
+        GLuint beginQuery;
+        GLuint endQuery;
+    };
+    struct QueryFrame {
+        size_t frame;
+        std::vector<GLuint> queries;
+        size_t usedQueries { 0 };
+        std::vector<GpuTimestamp> timestamps;
+    };
+
+    void CloseFrame(Clock::time_point now);
+    void PopZone();
+    int FindZone(int parent, const char* name, bool gpu);
+    GLuint NextQuery(QueryFrame& queryFrame);
+    void ResolveQueries(QueryFrame& queryFrame);
+    float GetAverage(const std::vector<float>& history, size_t first, size_t end) const;
+    void DrawZone(int zone) const;
+    void CollectTotals(int zone, const std::string& parentName,
+        std::vector<ZoneTotal>& totals) const;
+
+    // guards everything below, zones are recorded on the render thread
+    mutable std::mutex m_mutex;
+    std::vector<Zone> m_zones;
+    std::vector<int> m_rootZones;
+    std::vector<ActiveZone> m_zoneStack;
+    QueryFrame m_queryFrames[QueryLatency];
+
+    // m_frame is the frame being recorded, gpu times are known for the
+    // frames before m_gpuFrame
+    size_t m_frame { 0 };
+    size_t m_gpuFrame { 0 };
+    bool m_frameStarted { false };
+    Clock::time_point m_frameStart;
+    std::vector<float> m_frameHistory;
+    std::vector<float> m_gpuFrameHistory;
+
+    // totals count the frames from m_totalsFrame on
+    size_t m_totalsFrame { 0 };
+    size_t m_totalGpuFrames { 0 };
+};
+
+// times the enclosing scope as a zone of the profiler
+class ProfileScope {
+public:
+    ProfileScope(Profiler* profiler, const char* name, bool gpu) : m_profiler(profiler) {
+        m_profiler->BeginZone(name, gpu);
+    }
+    ~ProfileScope() { m_profiler->EndZone(); }
+
+private:
+    Profiler* m_profiler;
+};
+
+// without the profiler the zones still show up in trace captures
+#if defined(USE_PROFILER)
+#define PROFILE_SCOPE(profiler, name) \
+    ProfileScope SCOPE_CONCAT(profileScope, __LINE__)(profiler, name, false)
+#define PROFILE_GPU_SCOPE(profiler, name) \
+    ProfileScope SCOPE_CONCAT(profileScope, __LINE__)(profiler, name, true)
+#else
+#define PROFILE_SCOPE(profiler, name) TRACE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(profiler, name) TRACE_SCOPE(name)
+#endif
+
+
+
+CLASS_PTR(Context)
+class Context {
+public:
+    // modelFilename is the model drawn at the scene's center
+    static ContextUPtr Create(const std::string& modelFilename = "./model/backpack.obj");
+
+    // how the main light plus many local lights are shaded, plain forward
+    // only takes the main light, per-object forward takes the lights
+    // touching each object's box
+    enum ShadingPath {
+        ForwardShading = 0, DeferredShading, ClusteredShading, ObjectLightShading
+    };
+
+    // light parameter
+    struct Light {
+        glm::vec3 position { glm::vec3(2.0f, 2.0f, 2.0f) };
+        glm::vec3 direction { glm::vec3(-0.2f, -1.0f, -0.3f) };
+        glm::vec2 cutoff { glm::vec2(20.0f, 5.0f) };
+        // float cutoff { 20.0f };
+        float distance { 32.0f };
+        glm::vec3 ambient { glm::vec3(0.1f, 0.1f, 0.1f) };
+        glm::vec3 diffuse { glm::vec3(0.8f, 0.8f, 0.8f) };
+        glm::vec3 specular { glm::vec3(1.0f, 1.0f, 1.0f) };
+    };
+
+    // everything a frame is drawn from: the ui settings, the window size
+    // and the clock and camera interpolated between simulation steps.
+    // Update fills it in on the main thread and Render draws a copy of
+    // it, nothing the main thread edits changes under a frame being drawn
+    struct FrameState {
+        double time { 0.0 };
+        bool animation { true };
+        glm::vec3 cameraPos { glm::vec3(0.0f, 0.0f, 7.0f) };
+        float cameraYaw { 0.0f };
+        float cameraPitch { 0.0f };
+        glm::vec4 clearColor { glm::vec4(0.1f, 0.2f, 0.3f, 0.0f) };
+        int width { WINDOW_WIDTH };
+        int height { WINDOW_HEIGHT };
+
+        int cubeCount { 0 };
+        float modelRotation { 0.0f };
+        bool frustumCulling { true };
+        bool bvhCulling { false };
+        bool occlusionCulling { false };
+        int maxOccluders { 64 };
+
+        int shadingPath { ForwardShading };
+        int sceneLightCount { 128 };
+        float sceneLightRange { 4.0f };
+        bool shadows { true };
+        Light light;
+        // directional light with cascaded shadows, black turns it off
+        glm::vec3 sunDirection { glm::vec3(-0.4f, -1.0f, -0.3f) };
+        glm::vec3 sunColor { glm::vec3(0.0f) };
+        float sunShadowDistance { 20.0f };
+        float shininess { 32.0f };
+
+        // a click to pick the object under, in window coordinates
+        bool pick { false };
+        glm::vec2 pickPos { glm::vec2(0.0f) };
+    };
+
+    // main thread, between ImGui::NewFrame and ImGui::Render: runs the
+    // simulation steps due by now and the ui window, then writes the
+    // frame to draw to state
+    void Update(FrameState& state);
+    // on the thread owning the gl context, may run while the main thread
+    // updates the next frame
+    void Render(const FrameState& state);
+
+    // input and window events, on the main thread. the movement keys are
+    // sampled once a frame, the camera moves in simulation steps
+    void ProcessInput(GLFWwindow* window);
+    void Reshape(int width, int height);
+    void MouseMove(double x, double y);
+    void MouseButton(int button, int action, double x, double y);
+
+    // a fixed clock in seconds and camera replace the live ones, for
+    // repeatable benchmark frames
+    void SetFixedTime(double time) { m_state.time = time; m_fixedTime = true; }
+    void SetCamera(const glm::vec3& position, float yaw, float pitch);
+    void SetCameraLookAt(const glm::vec3& position, const glm::vec3& target);
+    void SetCubeCount(int cubeCount) { m_state.cubeCount = std::max(cubeCount, 0); }
+    Profiler* GetProfiler() const { return m_profiler.get(); }
+
+    // scene settings of the ui, for the golden image scenes
+    void SetAnimation(bool animation) { m_state.animation = animation; }
+    void SetShadingPath(ShadingPath shadingPath) { m_state.shadingPath = shadingPath; }
+    void SetShadows(bool shadows) { m_state.shadows = shadows; }
+    void SetSpotLight(const glm::vec3& position, const glm::vec3& direction,
+        const glm::vec2& cutoff);
+    void SetSun(const glm::vec3& direction, const glm::vec3& color);
+    // draw calls of the scene passes in the last frame, shadows included
+    size_t GetDrawCallCount() const { return m_frameDrawCallCount; }
+ 
+private:
+    Context() {}
+    bool Init(const std::string& modelFilename);
+    void BuildScene();
+    void UpdateCubes();
+    void UpdateModel();
+    void UpdateBvh();
+    void CollectOccluders(const Frustum& frustum);
+    void PickObject(float x, float y);
+    // light ranges, when given, are per command lists of the lights set
+    void SubmitDrawList(const DrawList& drawList,
+        const std::vector<LightListRange>* lightRanges = nullptr);
+    void UpdateSceneLights();
+    void RenderShadows(const glm::mat4& view);
+    void SetLightUniforms(const Program* program) const;
+    void Simulate(float stepTime);
+    // gl state and scene structure follow the settings that changed
+    // since the last frame
+    void ApplyFrameState(const FrameState& state);
+
+    ProgramUPtr m_program;
+    ProgramUPtr m_simpleProgram;
+
+    MeshPtr m_box;
+    ModelUPtr m_model;
+
+    // the ui's settings on the main thread and the frame being drawn on
+    // the render thread. the render side members below belong to the
+    // render thread
+    FrameState m_state;
+    FrameState m_frame;
+
+    // render thread results shown in the ui, a frame or two late
+    struct FrameStats {
+        int occluders { 0 };
+        int occluderTriangles { 0 };
+        int objects { 0 };
+        int drawn { 0 };
+        int pickedObject { -1 };
+        int clusterLightIndices { 0 };
+        int maxClusterLights { 0 };
+        int objectLightIndices { 0 };
+        int staticShadowPasses { 0 };
+        int dynamicShadowPasses { 0 };
+        size_t arenaPeak { 0 };
+        size_t arenaCapacity { 0 };
+        size_t streamRegionSize { 0 };
+        size_t streamStalls { 0 };
+        uint32_t poolVertices { 0 };
+        uint32_t poolVertexCapacity { 0 };
+        uint32_t poolIndices { 0 };
+        uint32_t poolIndexCapacity { 0 };
+    };
+    std::mutex m_statsMutex;
+    FrameStats m_stats;
+
+    // scene objects and the per-frame draw list built from them
+    std::vector<SceneObject> m_sceneObjects;
+    DrawListBuilderUPtr m_drawListBuilder;
+
+    // object bvh, rebuilt when the scene changes and refitted only when
+    // used, it culls when bvh culling is on and picks objects under the cursor
+    BvhUPtr m_bvh;
+    bool m_bvhDirty { true };
+    bool m_bvhStale { true };
+    std::vector<uint32_t> m_bvhResult;
+    std::vector<uint8_t> m_visibility;
+    glm::mat4 m_viewProjection { glm::mat4(1.0f) };
+    int m_pickedObject { -1 };
+
+    // software occlusion culling against the largest occluders on screen
+    OccluderGeometryPtr m_boxOccluder;
+    OcclusionCullerUPtr m_occlusionCuller;
+    std::vector<OcclusionCuller::Occluder> m_occluders;
+    // screen size and index of every occluder in the frustum
+    std::vector<std::pair<float, size_t>> m_occluderCandidates;
+
+    // instances and indirect commands of every instanced draw in a frame
+    std::vector<InstanceData> m_instances;
+    StreamBufferUPtr m_streamBuffer;
+    MultiDrawBatchUPtr m_multiDrawBatch;
+    size_t m_frameDrawCallCount { 0 };
+
+    // scene object 0 is the light box, followed by the model meshes
+    // and the instanced cube field
+    size_t m_modelObjectOffset { 1 };
+    size_t m_cubeObjectOffset { 0 };
+    TransformSoA m_cubeTransforms;
+
+    DeferredRendererUPtr m_deferredRenderer;
+    ClusteredLightsUPtr m_clusteredLights;
+    ProgramUPtr m_objectLightProgram;
+    std::vector<SceneLight> m_sceneLights;
+    LightSetUPtr m_lightSet;
+
+    // shadows of the main light and the sun. the cached static depth is
+    // kept until m_staticVersion changes, which counts edits to the
+    // objects that are not dynamic
+    ShadowMapsUPtr m_shadowMaps;
+    DrawListBuilderUPtr m_shadowDrawListBuilder;
+    uint32_t m_staticVersion { 0 };
+    uint32_t m_casterMaskVersion { 0 };
+    std::vector<uint8_t> m_staticCasters;
+    std::vector<uint8_t> m_dynamicCasters;
+    bool m_cubesDynamic { false };
+
+    ProfilerUPtr m_profiler;
+
+    // spins the model's root node, only the model subtree is updated
+    glm::mat4 m_modelRootTransform { glm::mat4(1.0f) };
+
+    // frame size the viewport and the g-buffer are set up for, none
+    // before the first frame
+    int m_width { 0 };
+    int m_height { 0 };
+
+    // uint32_t m_vertexArrayObject;
+    // uint32_t m_vertexBuffer;
+    // uint32_t m_indexBuffer;
+
+    // VertexLayoutUPtr m_vertexLayout;
+    // BufferUPtr m_vertexBuffer;
+    // BufferUPtr m_indexBuffer;
+
+    // uint32_t m_texture;
+    TextureUPtr m_texture;
+    TextureUPtr m_texture2;
+
+    // the frame's animation clock is the simulation clock interpolated
+    // to the frame unless fixed
+    bool m_fixedTime { false };
+
+    // the camera position and the simulation clock advance in fixed
+    // steps, frames render in between the last two of them
+    FrameClock m_frameClock;
+    int m_simulationSteps { 0 };
+    double m_simulationTime { 0.0 };
+    double m_prevSimulationTime { 0.0 };
+    glm::vec3 m_prevCameraPos { glm::vec3(0.0f, 0.0f, 7.0f) };
+    // held movement keys, x right, y up and z forward
+    glm::vec3 m_cameraMove { glm::vec3(0.0f) };
+
+    // camera parameter
+    bool m_cameraControl { false };
+    glm::vec2 m_prevMousePos { glm::vec2(0.0f) };
+
+    float m_cameraPitch { 0.0f };
+    float m_cameraYaw { 0.0f };
+
+    glm::vec3 m_cameraFront { glm::vec3(0.0f, 0.0f, -1.0f) };
+    glm::vec3 m_cameraPos { glm::vec3(0.0f, 0.0f, 7.0f) };
+    glm::vec3 m_cameraUp { glm::vec3(0.0f, 1.0f, 0.0f) };
+    float m_cameraNear { 0.01f };
+    float m_cameraFar { 20.0f };
+
+    glm::vec3 m_lightAttenuation { glm::vec3(1.0f, 0.0f, 0.0f) };   // of the light's distance
+
+    glm::vec3 m_lightPos { glm::vec3(3.0f, 3.0f, 3.0f) };
+    glm::vec3 m_lightColor { glm::vec3(1.0f, 1.0f, 1.0f) };
+    glm::vec3 m_objectColor { glm::vec3(1.0f, 1.0f, 1.0f) };
+    float m_ambientStrength { 0.3f };
+
+    float m_specularStrength { 0.5f };
+    float m_specularShininess { 32.0f };
+
+    // material parameter
+    struct Material {
+        // glm::vec3 position { glm::vec3(2.0f, 2.0f, 2.0f) };
+        // glm::vec3 direction { glm::vec3(-1.0f, -1.0f, -1.0f) };
+        // glm::vec2 cutoff { glm::vec2(20.0f, 5.0f) };
+        // float distance { 32.0f };
+        TextureUPtr diffuse;
+        TextureUPtr specular;
+        // glm::vec3 ambient { glm::vec3(0.1f, 0.5f, 0.3f) };
+        // glm::vec3 diffuse { glm::vec3(0.8f, 0.5f, 0.3f) };
+        // glm::vec3 specular { glm::vec3(0.5f, 0.5f, 0.5f) };
+    };
+    Material m_material;
+
+};
+
+
+
+// a gl context without a window or a display: egl surfaceless when
+// built with USE_EGL, osmesa when built with USE_OSMESA, the former is
+// tried first. frames are rendered into a framebuffer of any size that
+// stands in for the window's
+CLASS_PTR(OffscreenContext)
+class OffscreenContext {
+public:
+    static OffscreenContextUPtr Create(int width, int height);
+    ~OffscreenContext();
+
+    bool Resize(int width, int height);
+    int GetWidth() const { return m_width; }
+    int GetHeight() const { return m_height; }
+    const Framebuffer* GetFramebuffer() const { return m_framebuffer.get(); }
+    // rgba rows from the bottom up, as glReadPixels returns them
+    std::vector<uint8_t> ReadPixels() const;
+
+private:
+    OffscreenContext() {}
+    bool Init(int width, int height);
+    bool CreateEglContext();
+    bool CreateOSMesaContext();
+
+#if defined(USE_EGL)
+    EGLDisplay m_display { EGL_NO_DISPLAY };
+    EGLContext m_eglContext { EGL_NO_CONTEXT };
+#endif
+#if defined(USE_OSMESA)
+    OSMesaContext m_osmesaContext { nullptr };
+    // osmesa is only current with a buffer, the framebuffer is drawn instead
+    std::vector<uint8_t> m_osmesaBuffer;
+#endif
+    int m_width { 0 };
+    int m_height { 0 };
+    FramebufferUPtr m_framebuffer;
+};
+
+#endif // __ENGINE_H__
@@ -1,1135 +1,651 @@
+#include "engine.h"
 
+#include <stb/stb_image_write.h>
 
-#include <spdlog/spdlog.h>
 
-#include <glad/glad.h>
-#include <GLFW/glfw3.h>
 
-#include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtc/type_ptr.hpp>
-
-#include <iostream>
-#include <optional>
-#include <vector>
-#include <memory>
-
-#include <fstream>
-#include <sstream>
-#include <string>
-
-#define STB_IMAGE_IMPLEMENTATION    // added for link error
-#include <stb/stb_image.h>
-
-#include <imgui.h>
-#include <imgui_impl_glfw.h>
-#include <imgui_impl_opengl3.h>
-
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
-
-using namespace std;
-
-
-#define CLASS_PTR(klassName) \
-class klassName; \
-using klassName ## UPtr = std::unique_ptr<klassName>; \
-using klassName ## Ptr = std::shared_ptr<klassName>; \
-using klassName ## WPtr = std::weak_ptr<klassName>;
-
-
-
-// optional is not to assign a memory for the empty file
-optional<string> LoadTextFile(const string& filename) {
-    ifstream fin(filename);
-    if (!fin.is_open()) {
-        SPDLOG_ERROR("failed to open file: {}", filename);
-        return {};
-    }
-
-    stringstream text;
-    text << fin.rdbuf();
-    return text.str();
-}
-
-glm::vec3 GetAttenuationCoeff(float distance) {
-    const auto linear_coeff = glm::vec4(
-        8.4523112e-05,
-        4.4712582e+00,
-        -1.8516388e+00,
-        3.3955811e+01
-    );
-    const auto quad_coeff = glm::vec4(
-        -7.6103583e-04,
-        9.0120201e+00,
-        -1.1618500e+01,
-        1.0000464e+02
-    );
-
-    float kc = 1.0f;
-    float d = 1.0f / distance;
-    auto dvec = glm::vec4(1.0f, d, d*d, d*d*d);
-    float kl = glm::dot(linear_coeff, dvec);
-    float kq = glm::dot(quad_coeff, dvec);
-    
-    return glm::vec3(kc, glm::max(kl, 0.0f), glm::max(kq*kq, 0.0f));
-}
-
-struct Vertex {
-    glm::vec3 position;
-    glm::vec3 normal;
-    glm::vec2 texCoord;
-};
-
-
-
-CLASS_PTR(Shader);
-class Shader {
-public:
-    static ShaderUPtr CreateFromFile(const std::string& filename, GLenum shaderType);
-
-    ~Shader();
-    uint32_t Get() const { return m_shader; }    
-private:
-    Shader() {}
-    bool LoadFile(const std::string& filename, GLenum shaderType);
-    uint32_t m_shader { 0 };
-};
-
-ShaderUPtr Shader::CreateFromFile(const std::string& filename, GLenum shaderType) {
-    auto shader = std::unique_ptr<Shader>(new Shader());
-    if (!shader->LoadFile(filename, shaderType))
-        return nullptr;
-    return std::move(shader);
-}
-
-bool Shader::LoadFile(const std::string& filename, GLenum shaderType) {
-    auto result = LoadTextFile(filename);
-    if (!result.has_value()) {
-        return false;
-    }
-
-    auto& code = result.value();
-    const char* codePtr = code.c_str();
-    int32_t codeLength = (int32_t)code.length();
-
-    // create and compile shader
-    m_shader = glCreateShader(shaderType);
-    glShaderSource(m_shader, 1, (const GLchar* const*)&codePtr, &codeLength);
-    glCompileShader(m_shader);
-
-    // check compile error
-    int success = 0;
-    glGetShaderiv(m_shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        char infoLog[1024];
-        glGetShaderInfoLog(m_shader, 1024, nullptr, infoLog);
-        SPDLOG_ERROR("failed to compile shader: \"{}\"", filename);
-        SPDLOG_ERROR("reason: {}", infoLog);
-        return false;
-    }
-    return true;
-}
-
-Shader::~Shader() {
-    if (m_shader) {
-        glDeleteShader(m_shader);
-    }
-}
-
-
-
-CLASS_PTR(Program)
-class Program {
-public:
-    static ProgramUPtr Create(const std::vector<ShaderPtr>& shaders);
-    static ProgramUPtr Create(const std::string& vertShaderFilename,
-        const std::string& fragShaderFilename);
-
-    ~Program();
-    uint32_t Get() const { return m_program; }
-    void Use() const;
-
-    void SetUniform(const std::string& name, int value) const;
-    void SetUniform(const std::string& name, const glm::mat4& value) const;
-    
-    void SetUniform(const std::string& name, float value) const;
-    void SetUniform(const std::string& name, const glm::vec2& value) const;
-    void SetUniform(const std::string& name, const glm::vec3& value) const;
-    void SetUniform(const std::string& name, const glm::vec4& value) const;
- 
-private:
-    Program() {}
-    bool Link(const std::vector<ShaderPtr>& shaders);
-    uint32_t m_program { 0 };
-};
-
-ProgramUPtr Program::Create(const std::vector<ShaderPtr>& shaders) {
-    auto program = ProgramUPtr(new Program());
-    if (!program->Link(shaders))
-        return nullptr;
-    return std::move(program);
-}
-
-ProgramUPtr Program::Create(const std::string& vertShaderFilename,
-    const std::string& fragShaderFilename) {
-    ShaderPtr vs = Shader::CreateFromFile(vertShaderFilename, GL_VERTEX_SHADER);
-    ShaderPtr fs = Shader::CreateFromFile(fragShaderFilename, GL_FRAGMENT_SHADER);
-    if (!vs || !fs)
-        return nullptr;
-    return std::move(Create({vs, fs}));
-}
-
-bool Program::Link(const std::vector<ShaderPtr>& shaders) {
-    m_program = glCreateProgram();
-    for (auto& shader: shaders)
-        glAttachShader(m_program, shader->Get());
-    glLinkProgram(m_program);
-
-    int success = 0;
-    glGetProgramiv(m_program, GL_LINK_STATUS, &success);
-    if (!success) {
-        char infoLog[1024];
-        glGetProgramInfoLog(m_program, 1024, nullptr, infoLog);
-        SPDLOG_ERROR("failed to link program: {}", infoLog);
-        return false;
-    }
-
-    return true;
-}
-
-Program::~Program() {
-    if (m_program) {
-        glDeleteProgram(m_program);
-    }
-}
-
-void Program::Use() const {
-    glUseProgram(m_program);
-}
-
-void Program::SetUniform(const std::string& name, int value) const {
-    auto loc = glGetUniformLocation(m_program, name.c_str());
-    glUniform1i(loc, value);
-}
-
-void Program::SetUniform(const std::string& name, const glm::mat4& value) const {
-    auto loc = glGetUniformLocation(m_program, name.c_str());
-    glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(value));
-}
-
-void Program::SetUniform(const std::string& name, float value) const {
-    auto loc = glGetUniformLocation(m_program, name.c_str());
-    glUniform1f(loc, value);
-}
-
-void Program::SetUniform(const std::string& name, const glm::vec2& value) const {
-    auto loc = glGetUniformLocation(m_program, name.c_str());
-    glUniform2fv(loc, 1, glm::value_ptr(value));
-}
-
-void Program::SetUniform(const std::string& name, const glm::vec3& value) const {
-    auto loc = glGetUniformLocation(m_program, name.c_str());
-    glUniform3fv(loc, 1, glm::value_ptr(value));
-}
-
-void Program::SetUniform(const std::string& name, const glm::vec4& value) const {
-    auto loc = glGetUniformLocation(m_program, name.c_str());
-    glUniform4fv(loc, 1, glm::value_ptr(value));
-}
-
-
-
-CLASS_PTR(Buffer)
-class Buffer {
+// --benchmark runs a fixed number of frames on a fixed clock and camera
+// path and reports the frame times as json. warmup frames run first and
+// are not counted
+CLASS_PTR(Benchmark)
+class Benchmark {
 public:
-    static BufferUPtr CreateWithData(uint32_t bufferType, uint32_t usage,
-        // const void* data, size_t dataSize);
-        const void* data, size_t stride, size_t count);
-    ~Buffer();
-    uint32_t Get() const { return m_buffer; }
-    void Bind() const;
+    static BenchmarkUPtr Create(int frameCount, int warmupFrameCount);
+    ~Benchmark();
 
-    size_t GetStride() const { return m_stride; }
-    size_t GetCount() const { return m_count; }
+    int GetTotalFrameCount() const { return m_warmupFrameCount + m_frameCount; }
+    // sets the clock and the camera of frame, before Context::Update
+    void BeginFrame(Context* context, int frame);
+    // after the swap
+    void EndFrame(int frame);
+    // waits for the gpu
+    void WriteReport(Context* context, std::ostream& out, int width, int height);
 
 private:
-    Buffer() {}
-    bool Init(
-        uint32_t bufferType, uint32_t usage,
-        // const void* data, size_t dataSize);
-        const void* data, size_t stride, size_t count);
-    uint32_t m_buffer { 0 };
-    uint32_t m_bufferType { 0 };
-    uint32_t m_usage { 0 };
-
-    size_t m_stride { 0 };
-    size_t m_count { 0 };
+    Benchmark() {}
+    using Clock = std::chrono::steady_clock;
+
+    int m_frameCount { 0 };
+    int m_warmupFrameCount { 0 };
+    // one GL_TIME_ELAPSED query per counted frame, read at the end
+    std::vector<GLuint> m_queries;
+    std::vector<float> m_frameTimes;
+    Clock::time_point m_frameStart;
 };
 
-BufferUPtr Buffer::CreateWithData( uint32_t bufferType, uint32_t usage,
-    // const void* data, size_t dataSize) {
-    const void* data, size_t stride, size_t count) {
-    
-    auto buffer = BufferUPtr(new Buffer());
-    // if (!buffer->Init(bufferType, usage, data, dataSize))
-    if (!buffer->Init(bufferType, usage, data, stride, count))
-        return nullptr;
-    return std::move(buffer);
-}
-
-Buffer::~Buffer() {
-    if (m_buffer) {
-        glDeleteBuffers(1, &m_buffer);
+BenchmarkUPtr Benchmark::Create(int frameCount, int warmupFrameCount) {
+    auto benchmark = BenchmarkUPtr(new Benchmark());
+    benchmark->m_frameCount = frameCount;
+    benchmark->m_warmupFrameCount = warmupFrameCount;
+    benchmark->m_queries.resize(frameCount);
+    glGenQueries(frameCount, benchmark->m_queries.data());
+    benchmark->m_frameTimes.reserve(frameCount);
+    return std::move(benchmark);
+}
+
+Benchmark::~Benchmark() {
+    glDeleteQueries((GLsizei)m_queries.size(), m_queries.data());
+}
+
+void Benchmark::BeginFrame(Context* context, int frame) {
+    // 60 steps a second whatever the frame rate, the camera circles the
+    // model and looks into the cube field
+    const float timeStep = 1.0f / 60.0f;
+    float time = (float)frame * timeStep;
+    context->SetFixedTime(time);
+    float angle = time * 0.4f;
+    auto position = glm::vec3(2.5f * sinf(angle), 0.5f + 0.3f * sinf(angle * 2.0f),
+        5.0f + 2.0f * cosf(angle));
+    context->SetCameraLookAt(position, glm::vec3(0.0f, -0.5f, -3.0f));
+
+    if (frame == m_warmupFrameCount) {
+        auto profiler = context->GetProfiler();
+        profiler->Flush();
+        profiler->ResetTotals();
     }
+    if (frame >= m_warmupFrameCount)
+        glBeginQuery(GL_TIME_ELAPSED, m_queries[frame - m_warmupFrameCount]);
+    m_frameStart = Clock::now();
 }
 
-void Buffer::Bind() const {
-    glBindBuffer(m_bufferType, m_buffer);
-}
-
-bool Buffer::Init(
-    uint32_t bufferType, uint32_t usage,
-    // const void* data, size_t dataSize) {
-    const void* data, size_t stride, size_t count) {
-        
-    m_bufferType = bufferType;
-    m_usage = usage;
-
-    m_stride = stride;
-    m_count = count;
-
-    glGenBuffers(1, &m_buffer);
-    Bind();
-    // glBufferData(m_bufferType, dataSize, data, usage);
-    glBufferData(m_bufferType, m_stride * m_count, data, usage);
-    return true;
-}
-
-
-CLASS_PTR(VertexLayout)
-class VertexLayout {
-public:
-    static VertexLayoutUPtr Create();
-    ~VertexLayout();
-
-    uint32_t Get() const { return m_vertexArrayObject; }
-    void Bind() const;
-    void SetAttrib(
-        uint32_t attribIndex, int count,
-        uint32_t type, bool normalized,
-        size_t stride, uint64_t offset) const;
-    void DisableAttrib(int attribIndex) const;
-
-private:
-    VertexLayout() {}
-    void Init();
-    uint32_t m_vertexArrayObject { 0 };
-};
-
-VertexLayoutUPtr VertexLayout::Create() {
-    auto vertexLayout = VertexLayoutUPtr(new VertexLayout());
-    vertexLayout->Init();
-    return std::move(vertexLayout);
-}
-
-VertexLayout::~VertexLayout() {
-    if (m_vertexArrayObject) {
-        glDeleteVertexArrays(1, &m_vertexArrayObject);
+void Benchmark::EndFrame(int frame) {
+    if (frame < m_warmupFrameCount)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    m_frameTimes.push_back(
+        std::chrono::duration<float, std::milli>(Clock::now() - m_frameStart).count());
+}
+
+void Benchmark::WriteReport(Context* context, std::ostream& out, int width, int height) {
+    auto profiler = context->GetProfiler();
+    profiler->Flush();
+    std::vector<float> gpuTimes;
+    for (size_t i = 0; i < m_frameTimes.size(); i++) {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(m_queries[i], GL_QUERY_RESULT, &elapsed);
+        gpuTimes.push_back((float)elapsed * 1e-6f);
     }
-}
-
-void VertexLayout::Bind() const {
-    glBindVertexArray(m_vertexArrayObject);
-}
 
-void VertexLayout::SetAttrib(
-    uint32_t attribIndex, int count,
-    uint32_t type, bool normalized,
-    size_t stride, uint64_t offset) const {
-        
-    glEnableVertexAttribArray(attribIndex);
-    glVertexAttribPointer(attribIndex, count,
-        type, normalized, stride, (const void*)offset);
-}
-
-void VertexLayout::Init() {
-    glGenVertexArrays(1, &m_vertexArrayObject);
-    Bind();
-}
-
-
-
-CLASS_PTR(Image)
-class Image {
-public:
-    static ImageUPtr Load(const std::string& filepath);
-    static ImageUPtr Create(int width, int height, int channelCount = 4);
-    static ImageUPtr CreateSingleColorImage(int width, int height, const glm::vec4& color);
-    ~Image();
-
-    const uint8_t* GetData() const { return m_data; }
-    int GetWidth() const { return m_width; }
-    int GetHeight() const { return m_height; }
-    int GetChannelCount() const { return m_channelCount; }
-
-    void SetCheckImage(int gridX, int gridY);
-    
-private:
-    Image() {};
-    bool LoadWithStb(const std::string& filepath);
-    bool Allocate(int width, int height, int channelCount);
-    int m_width { 0 };
-    int m_height { 0 };
-    int m_channelCount { 0 };
-    uint8_t* m_data { nullptr };
-};
-
-ImageUPtr Image::Load(const std::string& filepath) {
-    auto image = ImageUPtr(new Image());
-    if (!image->LoadWithStb(filepath))
-        return nullptr;
-    return std::move(image);
-}
-
-ImageUPtr Image::Create(int width, int height, int channelCount) {
-    auto image = ImageUPtr(new Image());
-    if (!image->Allocate(width, height, channelCount))
-        return nullptr;
-    return std::move(image);
-}
-
-ImageUPtr Image::CreateSingleColorImage(int width, int height, const glm::vec4& color) {
-    glm::vec4 clamped = glm::clamp(color * 255.0f, 0.0f, 255.0f);
-    uint8_t rgba[4] = {
-        (uint8_t)clamped.r, 
-        (uint8_t)clamped.g, 
-        (uint8_t)clamped.b, 
-        (uint8_t)clamped.a, 
+    auto summary = [](std::vector<float> samples) {
+        float sum = 0.0f, maxTime = 0.0f;
+        for (auto sample: samples) {
+            sum += sample;
+            maxTime = std::max(maxTime, sample);
+        }
+        float mean = samples.empty() ? 0.0f : sum / (float)samples.size();
+        float p50 = Profiler::GetPercentile(samples, 0.50f);
+        float p95 = Profiler::GetPercentile(samples, 0.95f);
+        float p99 = Profiler::GetPercentile(samples, 0.99f);
+        return fmt::format(
+            "{{\"mean\": {:.3f}, \"p50\": {:.3f}, \"p95\": {:.3f}, \"p99\": {:.3f}, \"max\": {:.3f}}}",
+            mean, p50, p95, p99, maxTime);
     };
-    auto image = Create(width, height, 4);
-    for (int i = 0; i < width * height; i++) {
-        memcpy(image->m_data + 4 * i, rgba, 4);
-    }
-    return std::move(image);
-}
 
-Image::~Image() {
-    if (m_data) {
-        stbi_image_free(m_data);
+    // times are in ms, zones are per-frame averages and only there when
+    // built with the profiler
+    out << "{\n";
+    out << fmt::format("  \"renderer\": \"{}\",\n",
+        reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    out << fmt::format("  \"width\": {},\n  \"height\": {},\n", width, height);
+    out << fmt::format("  \"frames\": {},\n  \"warmupFrames\": {},\n",
+        m_frameTimes.size(), m_warmupFrameCount);
+    out << "  \"cpuFrameTime\": " << summary(m_frameTimes) << ",\n";
+    out << "  \"gpuFrameTime\": " << summary(gpuTimes) << ",\n";
+    out << "  \"zones\": [";
+    auto totals = profiler->GetTotals();
+    for (size_t i = 0; i < totals.size(); i++) {
+        auto& zone = totals[i];
+        out << (i ? ",\n    " : "\n    ");
+        out << fmt::format("{{\"name\": \"{}\", \"cpu\": {:.3f}", zone.name, zone.cpuTime);
+        if (zone.gpu)
+            out << fmt::format(", \"gpu\": {:.3f}", zone.gpuTime);
+        out << "}";
     }
-}
-
-void Image::SetCheckImage(int gridX, int gridY) {
-    for (int j = 0; j < m_height; j++) {
-        for (int i = 0; i < m_width; i++) {
-            int pos = (j * m_width + i) * m_channelCount;
-            bool even = ((i / gridX) + (j / gridY)) % 2 == 0;
-            uint8_t value = even ? 255 : 0;
-            for (int k = 0; k < m_channelCount; k++)
-                m_data[pos + k] = value;
-            if (m_channelCount > 3)
-                m_data[3] = 255;
+    out << (totals.empty() ? "]\n" : "\n  ]\n");
+    out << "}" << std::endl;
+}
+
+
+// image metrics of the golden image check, over rgba8 images with rows
+// of the same length. alpha is ignored
+float ComputePsnr(const uint8_t* a, const uint8_t* b, int width, int height) {
+    size_t count = (size_t)width * (size_t)height;
+    uint64_t sum = 0;
+    size_t i = 0;
+#if defined(USE_SSE)
+    const __m128i rgbMask = _mm_set1_epi32(0x00ffffff);
+    const __m128i zero = _mm_setzero_si128();
+    size_t end4 = count & ~(size_t)3;
+    while (i < end4) {
+        // a lane gains at most 4 * 255^2 a step, 4096 steps stay in 32 bits
+        size_t end = std::min(end4, i + 4 * 4096);
+        __m128i acc = _mm_setzero_si128();
+        for (; i < end; i += 4) {
+            __m128i pa = _mm_and_si128(_mm_loadu_si128((const __m128i*)(a + 4 * i)), rgbMask);
+            __m128i pb = _mm_and_si128(_mm_loadu_si128((const __m128i*)(b + 4 * i)), rgbMask);
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(pa, zero), _mm_unpacklo_epi8(pb, zero));
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(pa, zero), _mm_unpackhi_epi8(pb, zero));
+            acc = _mm_add_epi32(acc,
+                _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
         }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
     }
-}
-
-bool Image::LoadWithStb(const std::string& filepath) {
-    stbi_set_flip_vertically_on_load(true);
-    m_data = stbi_load(filepath.c_str(), &m_width, &m_height, &m_channelCount, 0);
-    if (!m_data) {
-        SPDLOG_ERROR("failed to load image: {}", filepath);
-        return false;
+#endif
+    for (; i < count; i++) {
+        for (int c = 0; c < 3; c++) {
+            int d = (int)a[4 * i + c] - (int)b[4 * i + c];
+            sum += (uint64_t)(d * d);
+        }
     }
-    return true;
-}
-
-bool Image::Allocate(int width, int height, int channelCount) {
-    m_width = width;
-    m_height = height;
-    m_channelCount = channelCount;
-    m_data = (uint8_t*)malloc(m_width * m_height * m_channelCount);
-    return m_data ? true : false;
-}
-
-
-
-CLASS_PTR(Texture)
-class Texture {
-public:
-    static TextureUPtr CreateFromImage(const Image* image);
-    ~Texture();
-
-    const uint32_t Get() const { return m_texture; }
-    void Bind() const;
-    void SetFilter(uint32_t minFilter, uint32_t magFilter) const;
-    void SetWrap(uint32_t sWrap, uint32_t tWrap) const;
-    
-private:
-    Texture() {}
-    void CreateTexture();
-    void SetTextureFromImage(const Image* image);
-
-    uint32_t m_texture { 0 };
-};
-
-TextureUPtr Texture::CreateFromImage(const Image* image) {
-    auto texture = TextureUPtr(new Texture());
-    texture->CreateTexture();
-    texture->SetTextureFromImage(image);
-    return std::move(texture);
-}
-
-Texture::~Texture() {
-    if (m_texture) {
-        glDeleteTextures(1, &m_texture);
+    // identical images are capped instead of infinite
+    if (sum == 0 || count == 0)
+        return 100.0f;
+    double mse = (double)sum / (double)(count * 3);
+    return (float)std::min(10.0 * log10(255.0 * 255.0 / mse), 100.0);
+}
+
+// luma ssim averaged over 8x8 blocks
+float ComputeSsim(const uint8_t* a, const uint8_t* b, int width, int height) {
+    const int blockSize = 8;
+    const float c1 = (0.01f * 255.0f) * (0.01f * 255.0f);
+    const float c2 = (0.03f * 255.0f) * (0.03f * 255.0f);
+    size_t count = (size_t)width * (size_t)height;
+    std::vector<float> lumaA(count), lumaB(count);
+    for (size_t i = 0; i < count; i++) {
+        lumaA[i] = 0.299f * a[4 * i] + 0.587f * a[4 * i + 1] + 0.114f * a[4 * i + 2];
+        lumaB[i] = 0.299f * b[4 * i] + 0.587f * b[4 * i + 1] + 0.114f * b[4 * i + 2];
     }
-}
-
-void Texture::Bind() const {
-    glBindTexture(GL_TEXTURE_2D, m_texture);
-}
-
-void Texture::SetFilter(uint32_t minFilter, uint32_t magFilter) const {
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
-}
-
-void Texture::SetWrap(uint32_t sWrap, uint32_t tWrap) const {
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sWrap);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, tWrap);
-}
-    
-void Texture::CreateTexture() {
-    glGenTextures(1, &m_texture);
-    // bind and set default filter and wrap option
-    Bind();
-    SetFilter(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR);
-    SetWrap(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
-}
 
-void Texture::SetTextureFromImage(const Image* image) {
-    GLenum format = GL_RGBA;
-    switch (image->GetChannelCount()) {
-        default: break;
-        case 1: format = GL_RED; break;
-        case 2: format = GL_RG; break;
-        case 3: format = GL_RGB; break;
+    double total = 0.0;
+    int blockCount = 0;
+    for (int by = 0; by + blockSize <= height; by += blockSize) {
+        for (int bx = 0; bx + blockSize <= width; bx += blockSize) {
+            float sumX = 0.0f, sumY = 0.0f, sumXX = 0.0f, sumYY = 0.0f, sumXY = 0.0f;
+#if defined(USE_SSE)
+            __m128 sx = _mm_setzero_ps(), sy = _mm_setzero_ps();
+            __m128 sxx = _mm_setzero_ps(), syy = _mm_setzero_ps(), sxy = _mm_setzero_ps();
+            for (int y = 0; y < blockSize; y++) {
+                const float* rowA = &lumaA[(size_t)(by + y) * width + bx];
+                const float* rowB = &lumaB[(size_t)(by + y) * width + bx];
+                for (int x = 0; x < blockSize; x += 4) {
+                    __m128 va = _mm_loadu_ps(rowA + x);
+                    __m128 vb = _mm_loadu_ps(rowB + x);
+                    sx = _mm_add_ps(sx, va);
+                    sy = _mm_add_ps(sy, vb);
+                    sxx = _mm_add_ps(sxx, _mm_mul_ps(va, va));
+                    syy = _mm_add_ps(syy, _mm_mul_ps(vb, vb));
+                    sxy = _mm_add_ps(sxy, _mm_mul_ps(va, vb));
+                }
+            }
+            float lanes[5][4];
+            _mm_storeu_ps(lanes[0], sx);
+            _mm_storeu_ps(lanes[1], sy);
+            _mm_storeu_ps(lanes[2], sxx);
+            _mm_storeu_ps(lanes[3], syy);
+            _mm_storeu_ps(lanes[4], sxy);
+            for (int k = 0; k < 4; k++) {
+                sumX += lanes[0][k];
+                sumY += lanes[1][k];
+                sumXX += lanes[2][k];
+                sumYY += lanes[3][k];
+                sumXY += lanes[4][k];
+            }
+#else
+            for (int y = 0; y < blockSize; y++) {
+                for (int x = 0; x < blockSize; x++) {
+                    float va = lumaA[(size_t)(by + y) * width + bx + x];
+                    float vb = lumaB[(size_t)(by + y) * width + bx + x];
+                    sumX += va;
+                    sumY += vb;
+                    sumXX += va * va;
+                    sumYY += vb * vb;
+                    sumXY += va * vb;
+                }
+            }
+#endif
+            float n = (float)(blockSize * blockSize);
+            float meanX = sumX / n;
+            float meanY = sumY / n;
+            float varX = std::max(sumXX / n - meanX * meanX, 0.0f);
+            float varY = std::max(sumYY / n - meanY * meanY, 0.0f);
+            float cov = sumXY / n - meanX * meanY;
+            total += ((2.0f * meanX * meanY + c1) * (2.0f * cov + c2)) /
+                ((meanX * meanX + meanY * meanY + c1) * (varX + varY + c2));
+            blockCount++;
+        }
     }
-    
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-        image->GetWidth(), image->GetHeight(), 0,
-        format, GL_UNSIGNED_BYTE,
-        image->GetData());
-
-    glGenerateMipmap(GL_TEXTURE_2D);
+    return blockCount ? (float)(total / blockCount) : 1.0f;
 }
 
 
 
-CLASS_PTR(Mesh);
-class Mesh {
+// --golden renders a fixed set of scenes and compares each to its png in
+// a directory, --golden-update writes the pngs instead. every scene also
+// has a frame time and a draw call budget. frame times depend on the gpu,
+// budgets.txt next to the pngs overrides them per renderer
+CLASS_PTR(GoldenImages)
+class GoldenImages {
 public:
-    static MeshUPtr Create( const std::vector<Vertex>& vertices,
-        const std::vector<uint32_t>& indices, uint32_t primitiveType);
-    static MeshUPtr CreateBox();
-
-    const VertexLayout* GetVertexLayout() const { return m_vertexLayout.get(); }
-    BufferPtr GetVertexBuffer() const { return m_vertexBuffer; }
-    BufferPtr GetIndexBuffer() const { return m_indexBuffer; }
+    static GoldenImagesUPtr Create(const std::string& directory, bool update,
+        float budgetScale);
 
-    // void SetMaterial(MaterialPtr material) { m_material = material; }
-    // MaterialPtr GetMaterial() const { return m_material; }
-
-    void Draw() const;
-    // void Draw(const Program* program) const;
+    int GetTotalFrameCount() const { return (int)m_scenes.size() * FramesPerScene; }
+    // sets up the scene of frame, before Context::Update
+    void BeginFrame(Context* context, int frame);
+    // after Context::Render, before the ui and the swap
+    void EndFrame(Context* context, int frame, int width, int height);
+    // a line per scene, false if any of them failed
+    bool WriteReport(std::ostream& out) const;
 
 private:
-    Mesh() {}
-    void Init( const std::vector<Vertex>& vertices,
-        const std::vector<uint32_t>& indices, uint32_t primitiveType);
-
-    uint32_t m_primitiveType { GL_TRIANGLES };
-
-    VertexLayoutUPtr m_vertexLayout;
-    BufferPtr m_vertexBuffer;
-    BufferPtr m_indexBuffer;
-    
-    // MaterialPtr m_material;
-};
-
-MeshUPtr Mesh::CreateBox() {
-    std::vector<Vertex> vertices = {
-        Vertex { glm::vec3(-0.5f, -0.5f, -0.5f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec2(0.0f, 0.0f) },
-        Vertex { glm::vec3( 0.5f, -0.5f, -0.5f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec2(1.0f, 0.0f) },
-        Vertex { glm::vec3( 0.5f,  0.5f, -0.5f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec2(1.0f, 1.0f) },
-        Vertex { glm::vec3(-0.5f,  0.5f, -0.5f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec2(0.0f, 1.0f) },
-
-        Vertex { glm::vec3(-0.5f, -0.5f,  0.5f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec2(0.0f, 0.0f) },
-        Vertex { glm::vec3( 0.5f, -0.5f,  0.5f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec2(1.0f, 0.0f) },
-        Vertex { glm::vec3( 0.5f,  0.5f,  0.5f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec2(1.0f, 1.0f) },
-        Vertex { glm::vec3(-0.5f,  0.5f,  0.5f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec2(0.0f, 1.0f) },
-
-        Vertex { glm::vec3(-0.5f,  0.5f,  0.5f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec2(1.0f, 0.0f) },
-        Vertex { glm::vec3(-0.5f,  0.5f, -0.5f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec2(1.0f, 1.0f) },
-        Vertex { glm::vec3(-0.5f, -0.5f, -0.5f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec2(0.0f, 1.0f) },
-        Vertex { glm::vec3(-0.5f, -0.5f,  0.5f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec2(0.0f, 0.0f) },
-
-        Vertex { glm::vec3( 0.5f,  0.5f,  0.5f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec2(1.0f, 0.0f) },
-        Vertex { glm::vec3( 0.5f,  0.5f, -0.5f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec2(1.0f, 1.0f) },
-        Vertex { glm::vec3( 0.5f, -0.5f, -0.5f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec2(0.0f, 1.0f) },
-        Vertex { glm::vec3( 0.5f, -0.5f,  0.5f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec2(0.0f, 0.0f) },
-
-        Vertex { glm::vec3(-0.5f, -0.5f, -0.5f), glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec2(0.0f, 1.0f) },
-        Vertex { glm::vec3( 0.5f, -0.5f, -0.5f), glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec2(1.0f, 1.0f) },
-        Vertex { glm::vec3( 0.5f, -0.5f,  0.5f), glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec2(1.0f, 0.0f) },
-        Vertex { glm::vec3(-0.5f, -0.5f,  0.5f), glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec2(0.0f, 0.0f) },
-
-        Vertex { glm::vec3(-0.5f,  0.5f, -0.5f), glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec2(0.0f, 1.0f) },
-        Vertex { glm::vec3( 0.5f,  0.5f, -0.5f), glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec2(1.0f, 1.0f) },
-        Vertex { glm::vec3( 0.5f,  0.5f,  0.5f), glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec2(1.0f, 0.0f) },
-        Vertex { glm::vec3(-0.5f,  0.5f,  0.5f), glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec2(0.0f, 0.0f) },
+    GoldenImages() {}
+    using Clock = std::chrono::steady_clock;
+
+    // the first frames fill the shadow caches and the gpu queues, the
+    // image is read from the last one
+    static const int WarmupFrames = 4;
+    static const int FramesPerScene = 16;
+
+    struct Scene {
+        const char* name;
+        std::function<void(Context*)> setup;
+        float minPsnr;
+        float minSsim;
+        float maxFrameTime;     // ms, of the median frame
+        size_t maxDrawCalls;
     };
-
-    std::vector<uint32_t> indices = {
-         0,  2,  1,  2,  0,  3,
-         4,  5,  6,  6,  7,  4,
-         8,  9, 10, 10, 11,  8,
-        12, 14, 13, 14, 12, 15,
-        16, 17, 18, 18, 19, 16,
-        20, 22, 21, 22, 20, 23,
+    struct Result {
+        float psnr { 0.0f };
+        float ssim { 0.0f };
+        float frameTime { 0.0f };
+        size_t drawCalls { 0 };
+        std::string error;
     };
 
-    return Create(vertices, indices, GL_TRIANGLES);
-}
-
-MeshUPtr Mesh::Create( const std::vector<Vertex>& vertices,
-    const std::vector<uint32_t>& indices, uint32_t primitiveType) { 
-
-    auto mesh = MeshUPtr(new Mesh());
-    mesh->Init(vertices, indices, primitiveType);
-    return std::move(mesh);
-}
-
-void Mesh::Init( const std::vector<Vertex>& vertices,
-    const std::vector<uint32_t>& indices, uint32_t primitiveType) {
-
-    m_vertexLayout = VertexLayout::Create();
-    m_vertexBuffer = Buffer::CreateWithData( GL_ARRAY_BUFFER, GL_STATIC_DRAW,
-        vertices.data(), sizeof(Vertex), vertices.size());
-    m_indexBuffer = Buffer::CreateWithData( GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW,
-        indices.data(), sizeof(uint32_t), indices.size());
-
-    m_vertexLayout->SetAttrib(0, 3, GL_FLOAT, false, sizeof(Vertex), 0);
-    m_vertexLayout->SetAttrib(1, 3, GL_FLOAT, false, sizeof(Vertex), 
-        offsetof(Vertex, normal));
-    m_vertexLayout->SetAttrib(2, 2, GL_FLOAT, false, sizeof(Vertex), 
-        offsetof(Vertex, texCoord));
-}
-
-void Mesh::Draw() const {
-    m_vertexLayout->Bind();
-    // if (m_material) {
-    //     m_material->SetToProgram(program);
-    // }
-    glDrawElements(m_primitiveType, m_indexBuffer->GetCount(), GL_UNSIGNED_INT, 0);
-}
-
-
-
-CLASS_PTR(Model);
-class Model {
-public:
-    static ModelUPtr Load(const std::string& filename);
-
-    int GetMeshCount() const { return (int)m_meshes.size(); }
-    MeshPtr GetMesh(int index) const { return m_meshes[index]; }
-    // void Draw(const Program* program) const;
-    void Draw() const;
-
-private:
-    Model() {}
-    bool LoadByAssimp(const std::string& filename);
-    void ProcessMesh(aiMesh* mesh, const aiScene* scene);
-    void ProcessNode(aiNode* node, const aiScene* scene);
-
-    std::vector<MeshPtr> m_meshes;
-    // std::vector<MaterialPtr> m_materials;
+    void CheckImage(const Scene& scene, Result& result,
+        const std::vector<uint8_t>& pixels, int width, int height) const;
+    // the frame time budgets of the first profile of budgets.txt whose
+    // name is part of renderer
+    void LoadBudgets(const std::string& renderer);
+
+    std::string m_directory;
+    std::string m_budgetProfile { "built-in" };
+    bool m_update { false };
+    float m_budgetScale { 1.0f };
+    std::vector<Scene> m_scenes;
+    std::vector<Result> m_results;
+    std::vector<float> m_frameTimes;
+    Clock::time_point m_frameStart;
 };
 
+GoldenImagesUPtr GoldenImages::Create(const std::string& directory, bool update,
+    float budgetScale) {
+    auto golden = GoldenImagesUPtr(new GoldenImages());
+    golden->m_directory = directory;
+    golden->m_update = update;
+    golden->m_budgetScale = budgetScale;
+
+    // every scene sets all it depends on, the scenes before it leave
+    // their settings behind
+    auto base = [](Context* context, int cubeCount, Context::ShadingPath shadingPath) {
+        context->SetFixedTime(0.0);
+        context->SetAnimation(false);
+        context->SetCubeCount(cubeCount);
+        context->SetShadingPath(shadingPath);
+        context->SetShadows(true);
+        context->SetSpotLight(glm::vec3(2.0f, 2.0f, 2.0f),
+            glm::vec3(-0.2f, -1.0f, -0.3f), glm::vec2(20.0f, 5.0f));
+        context->SetSun(glm::vec3(-0.4f, -1.0f, -0.3f), glm::vec3(0.0f));
+    };
+    golden->m_scenes = {
+        { "box", [=](Context* context) {
+            base(context, 1, Context::ForwardShading);
+            context->SetSpotLight(glm::vec3(1.0f, 0.0f, -2.0f),
+                glm::vec3(-1.0f, -2.0f, -1.0f), glm::vec2(30.0f, 5.0f));
+            context->SetCameraLookAt(glm::vec3(1.5f, -1.0f, -0.5f), glm::vec3(0.0f, -2.0f, -3.0f));
+        }, 40.0f, 0.98f, 8.0f, 4 },
+        { "backpack", [=](Context* context) {
+            base(context, 0, Context::ForwardShading);
+            context->SetSpotLight(glm::vec3(2.0f, 2.0f, 2.0f),
+                glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec2(20.0f, 5.0f));
+            context->SetCameraLookAt(glm::vec3(0.0f, 0.5f, 4.0f), glm::vec3(0.0f));
+        }, 40.0f, 0.98f, 8.0f, 8 },
+        { "spot-light", [=](Context* context) {
+            base(context, 64, Context::ForwardShading);
+            context->SetSpotLight(glm::vec3(5.0f, 2.0f, 0.0f),
+                glm::vec3(-1.0f, -0.5f, 0.0f), glm::vec2(40.0f, 5.0f));
+            context->SetCameraLookAt(glm::vec3(0.0f, 1.0f, 6.0f), glm::vec3(0.0f, -1.0f, -3.0f));
+        }, 40.0f, 0.98f, 8.0f, 12 },
+        { "sun", [=](Context* context) {
+            base(context, 256, Context::ForwardShading);
+            context->SetSun(glm::vec3(-1.0f, -0.4f, 0.0f), glm::vec3(0.6f));
+            context->SetCameraLookAt(glm::vec3(0.0f, 1.0f, 6.0f), glm::vec3(0.0f, -1.0f, -3.0f));
+        }, 40.0f, 0.98f, 12.0f, 24 },
+        { "deferred", [=](Context* context) {
+            base(context, 256, Context::DeferredShading);
+            context->SetCameraLookAt(glm::vec3(0.0f, 1.0f, 6.0f), glm::vec3(0.0f, -1.0f, -3.0f));
+        }, 40.0f, 0.98f, 12.0f, 12 },
+        { "clustered", [=](Context* context) {
+            base(context, 256, Context::ClusteredShading);
+            context->SetCameraLookAt(glm::vec3(0.0f, 1.0f, 6.0f), glm::vec3(0.0f, -1.0f, -3.0f));
+        }, 40.0f, 0.98f, 12.0f, 12 },
+        { "per-object", [=](Context* context) {
+            base(context, 256, Context::ObjectLightShading);
+            context->SetCameraLookAt(glm::vec3(0.0f, 1.0f, 6.0f), glm::vec3(0.0f, -1.0f, -3.0f));
+        }, 40.0f, 0.98f, 12.0f, 12 },
+    };
+    golden->m_results.resize(golden->m_scenes.size());
+    golden->m_frameTimes.reserve(FramesPerScene);
+    golden->LoadBudgets(reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    return std::move(golden);
+}
+
+void GoldenImages::LoadBudgets(const std::string& renderer) {
+    // "[profile]" starts the budgets of a renderer, then "<scene> <ms>"
+    // per line, # comments
+    auto filename = fmt::format("{}/budgets.txt", m_directory);
+    std::ifstream file(filename);
+    if (!file)
+        return;
 
-ModelUPtr Model::Load(const std::string& filename) {
-    auto model = ModelUPtr(new Model());
-    if (!model->LoadByAssimp(filename))
-        return nullptr;
-    return std::move(model);
+    bool active = false;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream in(line.substr(0, line.find('#')));
+        std::string word;
+        if (!(in >> word))
+            continue;
+        if (word.front() == '[' && word.back() == ']') {
+            // the first matching profile applies
+            if (active)
+                break;
+            auto profile = word.substr(1, word.size() - 2);
+            active = renderer.find(profile) != std::string::npos;
+            if (active)
+                m_budgetProfile = profile;
+            continue;
+        }
+        if (!active)
+            continue;
+        float frameTime = 0.0f;
+        auto scene = std::find_if(m_scenes.begin(), m_scenes.end(),
+            [&](const Scene& scene) { return word == scene.name; });
+        if (!(in >> frameTime) || scene == m_scenes.end()) {
+            SPDLOG_ERROR("invalid budget in {}: {}", filename, line);
+            continue;
+        }
+        scene->maxFrameTime = frameTime;
+    }
 }
 
-bool Model::LoadByAssimp(const std::string& filename) {
-    Assimp::Importer importer;
-    auto scene = importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs);
-
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-        SPDLOG_ERROR("failed to load model: {}", filename);
-        return false;
+void GoldenImages::BeginFrame(Context* context, int frame) {
+    if (frame % FramesPerScene == 0) {
+        m_scenes[frame / FramesPerScene].setup(context);
+        m_frameTimes.clear();
     }
-
-    // auto dirname = filename.substr(0, filename.find_last_of("/"));
-    // auto LoadTexture = [&](aiMaterial* material, aiTextureType type) -> TexturePtr {
-    //     if (material->GetTextureCount(type) <= 0)
-    //         return nullptr;
-    //     aiString filepath;
-    //     material->GetTexture(aiTextureType_DIFFUSE, 0, &filepath);
-    //     auto image = Image::Load(fmt::format("{}/{}", dirname, filepath.C_Str()));
-    //     if (!image)
-    //         return nullptr;
-    //     return Texture::CreateFromImage(image.get());
-    // };
-    
-    // for (uint32_t i = 0; i < scene->mNumMaterials; i++) {
-    //     auto material = scene->mMaterials[i];
-    //     auto glMaterial = Material::Create();
-    //     glMaterial->diffuse = LoadTexture(material, aiTextureType_DIFFUSE);
-    //     glMaterial->specular = LoadTexture(material, aiTextureType_SPECULAR);
-    //     m_materials.push_back(std::move(glMaterial));
-    // }
-
-    ProcessNode(scene->mRootNode, scene);
-    return true;
+    m_frameStart = Clock::now();
 }
 
-void Model::ProcessMesh(aiMesh* mesh, const aiScene* scene) {
-    SPDLOG_INFO("process mesh: {}, #vert: {}, #face: {}",
-        mesh->mName.C_Str(), mesh->mNumVertices, mesh->mNumFaces);
-
-    std::vector<Vertex> vertices;
-    vertices.resize(mesh->mNumVertices);
-    for (uint32_t i = 0; i < mesh->mNumVertices; i++) {
-        auto& v = vertices[i];
-        v.position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
-        v.normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
-        v.texCoord = glm::vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
-    }
+void GoldenImages::EndFrame(Context* context, int frame, int width, int height) {
+    // frames are timed up to the gpu finishing them
+    glFinish();
+    float frameTime = std::chrono::duration<float, std::milli>(
+        Clock::now() - m_frameStart).count();
+    int sceneIndex = frame / FramesPerScene;
+    int sceneFrame = frame % FramesPerScene;
+    if (sceneFrame < WarmupFrames)
+        return;
+    m_frameTimes.push_back(frameTime);
+    if (sceneFrame + 1 < FramesPerScene)
+        return;
 
-    std::vector<uint32_t> indices;
-    indices.resize(mesh->mNumFaces * 3);
-    for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
-        indices[3*i  ] = mesh->mFaces[i].mIndices[0];
-        indices[3*i+1] = mesh->mFaces[i].mIndices[1];
-        indices[3*i+2] = mesh->mFaces[i].mIndices[2];
+    auto& scene = m_scenes[sceneIndex];
+    auto& result = m_results[sceneIndex];
+    result.frameTime = Profiler::GetPercentile(m_frameTimes, 0.5f);
+    result.drawCalls = context->GetDrawCallCount();
+
+    std::vector<uint8_t> pixels((size_t)width * height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, Framebuffer::GetDefault());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    Framebuffer::BindToDefault();
+    CheckImage(scene, result, pixels, width, height);
+}
+
+void GoldenImages::CheckImage(const Scene& scene, Result& result,
+    const std::vector<uint8_t>& pixels, int width, int height) const {
+    // pngs are stored top row first, the pixels are read bottom row first
+    auto filename = fmt::format("{}/{}.png", m_directory, scene.name);
+    if (m_update) {
+        stbi_flip_vertically_on_write(true);
+        if (!stbi_write_png(filename.c_str(), width, height, 4, pixels.data(), width * 4))
+            result.error = fmt::format("failed to write {}", filename);
+        stbi_flip_vertically_on_write(false);
+        return;
     }
 
-    auto glMesh = Mesh::Create(vertices, indices, GL_TRIANGLES);
-    // if (mesh->mMaterialIndex >= 0)
-    //     glMesh->SetMaterial(m_materials[mesh->mMaterialIndex]);
-
-    m_meshes.push_back(std::move(glMesh));
-}
-
-void Model::ProcessNode(aiNode* node, const aiScene* scene) {
-    for (uint32_t i = 0; i < node->mNumMeshes; i++) {
-        auto meshIndex = node->mMeshes[i];
-        auto mesh = scene->mMeshes[meshIndex];
-        ProcessMesh(mesh, scene);
+    auto reference = Image::Load(filename);
+    if (!reference) {
+        result.error = fmt::format("no reference {}, run --golden-update", filename);
+        return;
     }
-
-    for (uint32_t i = 0; i < node->mNumChildren; i++) {
-        ProcessNode(node->mChildren[i], scene);
+    if (reference->GetWidth() != width || reference->GetHeight() != height ||
+        reference->GetChannelCount() != 4) {
+        result.error = fmt::format("reference is {}x{}x{}, frame is {}x{}x4",
+            reference->GetWidth(), reference->GetHeight(), reference->GetChannelCount(),
+            width, height);
+        return;
     }
-}
-
-// void Model::Draw(const Program* program) const {
-//     for (auto& mesh: m_meshes) {
-//         mesh->Draw(program);
-//     }
-// }
-
-void Model::Draw() const {
-    for (auto& mesh: m_meshes) {
-        mesh->Draw();
+    result.psnr = ComputePsnr(pixels.data(), reference->GetData(), width, height);
+    result.ssim = ComputeSsim(pixels.data(), reference->GetData(), width, height);
+}
+
+bool GoldenImages::WriteReport(std::ostream& out) const {
+    bool passed = true;
+    out << fmt::format("frame time budgets: {}", m_budgetProfile);
+    if (m_budgetScale != 1.0f)
+        out << fmt::format(", scaled by {}", m_budgetScale);
+    out << std::endl;
+    for (size_t i = 0; i < m_scenes.size(); i++) {
+        auto& scene = m_scenes[i];
+        auto& result = m_results[i];
+        std::vector<std::string> failures;
+        if (!result.error.empty())
+            failures.push_back(result.error);
+        else if (!m_update) {
+            if (result.psnr < scene.minPsnr)
+                failures.push_back(fmt::format("psnr below {:.1f}", scene.minPsnr));
+            if (result.ssim < scene.minSsim)
+                failures.push_back(fmt::format("ssim below {:.3f}", scene.minSsim));
+        }
+        float maxFrameTime = scene.maxFrameTime * m_budgetScale;
+        if (result.frameTime > maxFrameTime)
+            failures.push_back(fmt::format("frame time over {:.2f} ms", maxFrameTime));
+        if (result.drawCalls > scene.maxDrawCalls)
+            failures.push_back(fmt::format("draw calls over {}", scene.maxDrawCalls));
+
+        out << fmt::format("{:<12}", scene.name);
+        if (!m_update)
+            out << fmt::format(" psnr {:6.2f} dB, ssim {:.4f},", result.psnr, result.ssim);
+        out << fmt::format(" {:7.3f} ms, {} draw calls", result.frameTime, result.drawCalls);
+        for (size_t k = 0; k < failures.size(); k++)
+            out << (k ? ", " : " - FAILED: ") << failures[k];
+        if (failures.empty())
+            out << (m_update ? " - written" : " - ok");
+        out << std::endl;
+        passed = passed && failures.empty();
     }
+    return passed;
 }
 
 
 
-
-CLASS_PTR(Context)
-class Context {
+// draws frames on its own thread, which takes over the window's gl
+// context. the main thread hands a frame over as the context's frame
+// state plus a copy of the ui's draw lists, then goes on with the events,
+// simulation and ui of the next frame while this one is drawn and
+// swapped. of the two frame slots one is drawn and one waits, so the
+// main thread runs at most one frame ahead
+CLASS_PTR(RenderThread)
+class RenderThread {
 public:
-    static ContextUPtr Create();
-    void Render();  
-
-    void ProcessInput(GLFWwindow* window);
-    void Reshape(int width, int height);
-    void MouseMove(double x, double y);
-    void MouseButton(int button, int action, double x, double y);
- 
-private:
-    Context() {}
-    bool Init();
-
-    ProgramUPtr m_program;
-    ProgramUPtr m_simpleProgram;
-
-    MeshUPtr m_box;
-    ModelUPtr m_model;
-
-    int m_width {WINDOW_WIDTH};
-    int m_height {WINDOW_HEIGHT};
-
-    // uint32_t m_vertexArrayObject;
-    // uint32_t m_vertexBuffer;
-    // uint32_t m_indexBuffer;
+    static RenderThreadUPtr Create(GLFWwindow* window, Context* context);
+    // draws the frames handed over, then makes the gl context current on
+    // the calling thread again
+    ~RenderThread();
 
-    // clear color
-    glm::vec4 m_clearColor { glm::vec4(0.1f, 0.2f, 0.3f, 0.0f) };
+    // after ImGui::Render, waits for a free slot
+    void Submit(const Context::FrameState& state, ImDrawData* drawData);
 
-    // VertexLayoutUPtr m_vertexLayout;
-    // BufferUPtr m_vertexBuffer;
-    // BufferUPtr m_indexBuffer;
-
-    // uint32_t m_texture;
-    TextureUPtr m_texture;
-    TextureUPtr m_texture2;
-
-    // animation
-    bool m_animation { true };
-
-    // camera parameter
-    bool m_cameraControl { false };
-    glm::vec2 m_prevMousePos { glm::vec2(0.0f) };
-
-    float m_cameraPitch { 0.0f };
-    float m_cameraYaw { 0.0f };
-
-    glm::vec3 m_cameraFront { glm::vec3(0.0f, 0.0f, -1.0f) };
-    glm::vec3 m_cameraPos { glm::vec3(0.0f, 0.0f, 7.0f) };
-    glm::vec3 m_cameraUp { glm::vec3(0.0f, 1.0f, 0.0f) };
-
-    // light parameter
-    struct Light {
-        glm::vec3 position { glm::vec3(2.0f, 2.0f, 2.0f) };
-        glm::vec3 direction { glm::vec3(-0.2f, -1.0f, -0.3f) };
-        glm::vec2 cutoff { glm::vec2(20.0f, 5.0f) };
-        // float cutoff { 20.0f };
-        float distance { 32.0f };
-        glm::vec3 ambient { glm::vec3(0.1f, 0.1f, 0.1f) };
-        glm::vec3 diffuse { glm::vec3(0.8f, 0.8f, 0.8f) };
-        glm::vec3 specular { glm::vec3(1.0f, 1.0f, 1.0f) };
-    };
-    Light m_light;
-
-    glm::vec3 m_lightPos { glm::vec3(3.0f, 3.0f, 3.0f) };
-    glm::vec3 m_lightColor { glm::vec3(1.0f, 1.0f, 1.0f) };
-    glm::vec3 m_objectColor { glm::vec3(1.0f, 1.0f, 1.0f) };
-    float m_ambientStrength { 0.3f };
-
-    float m_specularStrength { 0.5f };
-    float m_specularShininess { 32.0f };
-
-    // material parameter
-    struct Material {
-        // glm::vec3 position { glm::vec3(2.0f, 2.0f, 2.0f) };
-        // glm::vec3 direction { glm::vec3(-1.0f, -1.0f, -1.0f) };
-        // glm::vec2 cutoff { glm::vec2(20.0f, 5.0f) };
-        // float distance { 32.0f };
-        TextureUPtr diffuse;
-        TextureUPtr specular;
-        // glm::vec3 ambient { glm::vec3(0.1f, 0.5f, 0.3f) };
-        // glm::vec3 diffuse { glm::vec3(0.8f, 0.5f, 0.3f) };
-        // glm::vec3 specular { glm::vec3(0.5f, 0.5f, 0.5f) };
-        float shininess { 32.0f };
+private:
+    RenderThread() {}
+    void Run();
+
+    // draw lists of a slot are kept from frame to frame, their buffers
+    // only reallocate when a frame needs more than before
+    struct Frame {
+        Context::FrameState state;
+        ImDrawData drawData;
+        std::vector<ImDrawList*> drawLists;
     };
-    Material m_material;
-
+    static void CopyDrawData(const ImDrawData* drawData, Frame& frame);
+    static void FreeDrawLists(Frame& frame);
+
+    GLFWwindow* m_window { nullptr };
+    Context* m_context { nullptr };
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    Frame m_frames[2];
+    // frames handed over and frames swapped so far
+    size_t m_submitted { 0 };
+    size_t m_drawn { 0 };
+    bool m_quit { false };
 };
 
-ContextUPtr Context::Create() {
-    auto context = ContextUPtr(new Context());
-    if (!context->Init())
-        return nullptr;
-    return std::move(context);
-}
-
-void Context::ProcessInput(GLFWwindow* window) {
-    if (!m_cameraControl)
-        return;
-
-    const float cameraSpeed = 0.05f;
-
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        m_cameraPos += cameraSpeed * m_cameraFront;
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        m_cameraPos -= cameraSpeed * m_cameraFront;
-
-    auto cameraRight = glm::normalize(glm::cross(m_cameraUp, -m_cameraFront));
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        m_cameraPos += cameraSpeed * cameraRight;
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        m_cameraPos -= cameraSpeed * cameraRight;    
-
-    auto cameraUp = glm::normalize(glm::cross(-m_cameraFront, cameraRight));
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-        m_cameraPos += cameraSpeed * cameraUp;
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        m_cameraPos -= cameraSpeed * cameraUp;
-}
-
-void Context::Reshape(int width, int height) {
-    m_width = width;
-    m_height = height;
-    glViewport(0, 0, m_width, m_height);
-}
-
-void Context::MouseMove(double x, double y) {
-    if (!m_cameraControl)
-        return;
-    auto pos = glm::vec2((float)x, (float)y);
-    auto deltaPos = pos - m_prevMousePos;
-
-    const float cameraRotSpeed = 0.8f;
-    m_cameraYaw -= deltaPos.x * cameraRotSpeed;
-    m_cameraPitch -= deltaPos.y * cameraRotSpeed;
-
-    if (m_cameraYaw < 0.0f)   m_cameraYaw += 360.0f;
-    if (m_cameraYaw > 360.0f) m_cameraYaw -= 360.0f;
-
-    if (m_cameraPitch > 89.0f)  m_cameraPitch = 89.0f;
-    if (m_cameraPitch < -89.0f) m_cameraPitch = -89.0f;
-
-    m_prevMousePos = pos;    
+RenderThreadUPtr RenderThread::Create(GLFWwindow* window, Context* context) {
+    auto renderThread = RenderThreadUPtr(new RenderThread());
+    renderThread->m_window = window;
+    renderThread->m_context = context;
+    // a gl context is current on one thread at a time
+    glfwMakeContextCurrent(nullptr);
+    renderThread->m_thread = std::thread(&RenderThread::Run, renderThread.get());
+    return std::move(renderThread);
 }
 
-void Context::MouseButton(int button, int action, double x, double y) {
-    if (button == GLFW_MOUSE_BUTTON_RIGHT) {
-        if (action == GLFW_PRESS) {
-            m_prevMousePos = glm::vec2((float)x, (float)y);
-            m_cameraControl = true;
-        }
-        else if (action == GLFW_RELEASE) {
-            m_cameraControl = false;
-        }
+RenderThread::~RenderThread() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
     }
-}
-
-
-void Context::Render() {
-
-    if (ImGui::Begin("ui window")) {
-    
-        if (ImGui::ColorEdit4("clear color", glm::value_ptr(m_clearColor))) {
-            glClearColor(m_clearColor.r, m_clearColor.g, m_clearColor.b, m_clearColor.a);
+    m_condition.notify_all();
+    m_thread.join();
+    for (auto& frame: m_frames)
+        FreeDrawLists(frame);
+    glfwMakeContextCurrent(m_window);
+}
+
+void RenderThread::Submit(const Context::FrameState& state, ImDrawData* drawData) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [this]() { return m_submitted - m_drawn < 2; });
+    // the render thread only reads slots of frames already handed over
+    auto& frame = m_frames[m_submitted % 2];
+    lock.unlock();
+    frame.state = state;
+    CopyDrawData(drawData, frame);
+
+    lock.lock();
+    m_submitted++;
+    lock.unlock();
+    m_condition.notify_all();
+}
+
+void RenderThread::Run() {
+    glfwMakeContextCurrent(m_window);
+    while (true) {
+        Frame* frame = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_drawn < m_submitted || m_quit; });
+            if (m_drawn == m_submitted)
+                break;
+            frame = &m_frames[m_drawn % 2];
         }
 
-        // camera
-        ImGui::Separator();
-        ImGui::DragFloat3("camera pos", glm::value_ptr(m_cameraPos), 0.01f);
-        ImGui::DragFloat("camera yaw", &m_cameraYaw, 0.5f);
-        ImGui::DragFloat("camera pitch", &m_cameraPitch, 0.5f, -89.0f, 89.0f);
-        ImGui::Separator();
-
-        if (ImGui::Button("reset camera")) {
-            m_cameraYaw = 0.0f;
-            m_cameraPitch = 0.0f;
-            m_cameraPos = glm::vec3(0.0f, 0.0f, 3.0f);
+        m_context->Render(frame->state);
+        {
+            TRACE_SCOPE("ui render");
+            ImGui_ImplOpenGL3_RenderDrawData(&frame->drawData);
         }
-
-
-        ImGui::Checkbox("animation", &m_animation);
-
-        if (ImGui::CollapsingHeader("light", ImGuiTreeNodeFlags_DefaultOpen)) {
-            ImGui::DragFloat3("l.position", glm::value_ptr(m_light.position), 0.01f);
-            ImGui::DragFloat3("l.direction", glm::value_ptr(m_light.direction), 0.01f);
-            // ImGui::DragFloat2("l.cutoff", &m_light.cutoff, 0.1f, 0.0f, 180.0f);
-            ImGui::DragFloat2("l.cutoff", glm::value_ptr(m_light.cutoff), 0.1f, 0.0f, 180.0f);
-            ImGui::DragFloat("l.distance", &m_light.distance, 0.5f, 0.0f, 1000.0f);
-            ImGui::ColorEdit3("l.ambient", glm::value_ptr(m_light.ambient));
-            ImGui::ColorEdit3("l.diffuse", glm::value_ptr(m_light.diffuse));
-            ImGui::ColorEdit3("l.specular", glm::value_ptr(m_light.specular));
+        {
+            TRACE_SCOPE("glfwSwapBuffers");
+            glfwSwapBuffers(m_window);
         }
 
-        // material
-        if (ImGui::CollapsingHeader("material", ImGuiTreeNodeFlags_DefaultOpen)) {
-            // ImGui::ColorEdit3("m.ambient", glm::value_ptr(m_light.ambient));
-            // ImGui::ColorEdit3("m.diffuse", glm::value_ptr(m_light.diffuse));
-            // ImGui::ColorEdit3("m.specular", glm::value_ptr(m_light.specular));
-            ImGui::DragFloat("m.shininess", &m_material.shininess, 1.0f, 1.0f, 256.0f);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_drawn++;
         }
+        m_condition.notify_all();
     }
-    ImGui::End();
-
-    
-    // glClear(GL_COLOR_BUFFER_BIT);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glEnable(GL_DEPTH_TEST);
-
-    m_program->Use();
-
-    m_cameraFront =
-        glm::rotate(glm::mat4(1.0f), glm::radians(m_cameraYaw), glm::vec3(0.0f, 1.0f, 0.0f)) *
-        glm::rotate(glm::mat4(1.0f), glm::radians(m_cameraPitch), glm::vec3(1.0f, 0.0f, 0.0f)) *
-        glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
-    
-    // m_cameraFront = glm::rotate(glm::mat4(1.0f),
-    //     glm::radians(m_cameraYaw), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::rotate(glm::mat4(1.0f),
-    //     glm::radians(m_cameraPitch), glm::vec3(1.0f, 0.0f, 0.0f)) * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
-
-    auto view = glm::lookAt( m_cameraPos,
-        m_cameraPos + m_cameraFront, m_cameraUp);
-
-    auto projection = glm::perspective(glm::radians(30.0f), 
-        // (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.01f, 10.0f);
-        (float)m_width / (float)m_height, 0.01f, 20.0f);
-    // auto view = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -5.0f));
-    // auto model = glm::rotate(glm::mat4(1.0f), glm::radians((float)glfwGetTime() * 60.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    // auto model = glm::rotate(glm::mat4(1.0f), glm::radians(60.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-
-    // auto transform = projection * view * model;
-    // m_program->SetUniform("transform", transform);
-
-    // drawing a light emmiting object - didn;;t show -- fix it
-    auto lightModelTransform = glm::translate(glm::mat4(1.0), m_lightPos) *
-        glm::scale(glm::mat4(1.0), glm::vec3(0.1f));
-        
-    m_program->Use();
-
-    m_simpleProgram->SetUniform("color", glm::vec4(m_light.ambient + m_light.diffuse, 1.0f));
-    m_simpleProgram->SetUniform("transform", projection * view * lightModelTransform);
-    
-    // glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-    m_box->Draw();
-
-
-    m_program->Use();
-    m_program->SetUniform("viewPos", m_cameraPos);
-
-    m_program->SetUniform("light.position", m_light.position);
-    m_program->SetUniform("light.attenuation", GetAttenuationCoeff(m_light.distance));
-    // m_program->SetUniform("light.direction", m_light.direction);
-    m_program->SetUniform("light.direction", m_light.direction);
-    // m_program->SetUniform("light.cutoff", cosf(glm::radians(m_light.cutoff)));
-    m_program->SetUniform("light.cutoff", glm::vec2(
-        cosf(glm::radians(m_light.cutoff[0])),
-        cosf(glm::radians(m_light.cutoff[0] + m_light.cutoff[1]))));
-    m_program->SetUniform("light.ambient", m_light.ambient);
-    m_program->SetUniform("light.diffuse", m_light.diffuse);
-    m_program->SetUniform("light.specular", m_light.specular);
-
-    // m_program->SetUniform("material.ambient", m_material.ambient);
-    // m_program->SetUniform("material.diffuse", m_material.diffuse);
-    m_program->SetUniform("material.diffuse", 0);   // slut number 0
-    // m_program->SetUniform("material.specular", m_material.specular);
-    m_program->SetUniform("material.specular", 1);
-    m_program->SetUniform("material.shininess", m_material.shininess);
-
-    glActiveTexture(GL_TEXTURE0);
-    m_material.diffuse->Bind();
-    glActiveTexture(GL_TEXTURE1);
-    m_material.specular->Bind();
-
-    auto modelTransform = glm::mat4(1.0f);
-    auto transform = projection * view * modelTransform;
-    m_program->SetUniform("transform", transform);
-    m_program->SetUniform("modelTransform", modelTransform);
-    // m_model->Draw(m_program.get());
-    m_model->Draw();
-
-    // for (size_t i = 0; i < cubePositions.size(); i++){
-    //     auto& pos = cubePositions[i];
-    //     auto model = glm::translate(glm::mat4(1.0f), pos);
-    //     model = glm::rotate(model,
-    //         // glm::radians((float)glfwGetTime() * 60.0f + 20.0f * (float)i),
-    //         glm::radians((m_animation ? (float)glfwGetTime() : 0.0f)* 60.0f + 20.0f * (float)i),
-    //         glm::vec3(1.0f, 0.5f, 0.0f));
-    //     auto transform = projection * view * model;
-    //     m_program->SetUniform("transform", transform);
-    //     m_program->SetUniform("modelTransform", model);
-        
-    //     // glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-    //     m_box->Draw();
-    // }
-
+    glfwMakeContextCurrent(nullptr);
+}
+
+template <typename T>
+static void CopyImVector(const ImVector<T>& src, ImVector<T>& dst) {
+    dst.resize(src.Size);
+    if (src.Size > 0)
+        memcpy(dst.Data, src.Data, (size_t)src.Size * sizeof(T));
+}
+
+void RenderThread::CopyDrawData(const ImDrawData* drawData, Frame& frame) {
+    // imgui reuses its draw lists in the next frame. copies what
+    // ImDrawList::CloneOutput does into the slot's own lists
+    while ((int)frame.drawLists.size() < drawData->CmdListsCount)
+        frame.drawLists.push_back(IM_NEW(ImDrawList)(ImGui::GetDrawListSharedData()));
+    for (int i = 0; i < drawData->CmdListsCount; i++) {
+        auto src = drawData->CmdLists[i];
+        auto dst = frame.drawLists[i];
+        CopyImVector(src->CmdBuffer, dst->CmdBuffer);
+        CopyImVector(src->IdxBuffer, dst->IdxBuffer);
+        CopyImVector(src->VtxBuffer, dst->VtxBuffer);
+        dst->Flags = src->Flags;
+    }
+    frame.drawData = *drawData;
+#if IMGUI_VERSION_NUM >= 18980
+    for (int i = 0; i < drawData->CmdListsCount; i++)
+        frame.drawData.CmdLists[i] = frame.drawLists[i];
+#else
+    frame.drawData.CmdLists = frame.drawLists.data();
+#endif
 }
 
-bool Context::Init() {
-
-    glEnable(GL_DEPTH_TEST);
-    glClearColor(m_clearColor.r, m_clearColor.g, m_clearColor.b, m_clearColor.a);
-
-    m_box = Mesh::CreateBox();
-
-    // m_model = Model::Load("./model/Ak-47.obj");
-    m_model = Model::Load("./model/backpack.obj");
-    if (!m_model)
-        return false;
-
-    m_simpleProgram = Program::Create("./shader/simple.vs", "./shader/simple.fs");
-    if (!m_simpleProgram)
-        return false;
-    SPDLOG_INFO("simple program id: {}", m_simpleProgram->Get());    
-
-    // m_program = Program::Create("./shader/lighting-1.vs", "./shader/lighting-1.fs");
-    m_program = Program::Create("./shader/lighting-3.vs", "./shader/lighting-3.fs");
-    if (!m_program)
-        return false;
-    SPDLOG_INFO("program id: {}", m_program->Get());  
-  
-    // m_material = Material::Create();
-    // m_material = Context::Create();
-    // m_material->diffuse = Texture::CreateFromImage(
-    m_material.diffuse = Texture::CreateFromImage(
-        Image::CreateSingleColorImage(4, 4,
-            glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)).get());
-
-    // m_material->specular = Texture::CreateFromImage(
-    m_material.specular = Texture::CreateFromImage(
-        Image::CreateSingleColorImage(4, 4,
-            glm::vec4(0.5f, 0.5f, 0.5f, 1.0f)).get());
-
-/*
-    glClearColor(0.1f, 0.2f, 0.3f, 0.0f);
-
-   
-    auto image = Image::Create(512, 512);
-    image->SetCheckImage(64, 64);
-
-    m_texture = Texture::CreateFromImage(image.get());
-    // m_material.specular = Texture::CreateFromImage(image.get());
-  
-    auto image2 = Image::Load("./image/face-3.jpg");
-    m_texture2 = Texture::CreateFromImage(image2.get());
-
-    m_material.diffuse = Texture::CreateFromImage(Image::Load("./image/face-4.jpg").get());
-    // m_material.specular = Texture::CreateFromImage(Image::Load("./image/metal_sp.png").get());
-    m_material.specular = Texture::CreateFromImage(image.get());
-*/
-/*
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_texture->Get());
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, m_texture2->Get());
-
-    m_program->Use();
-    // glUniform1i(glGetUniformLocation(m_program->Get(), "tex"), 0);
-    // glUniform1i(glGetUniformLocation(m_program->Get(), "tex2"), 1);
-
-    m_program->SetUniform("tex", 0);
-    m_program->SetUniform("tex2", 1);
-
-
-    // auto model = glm::rotate(glm::mat4(1.0f), glm::radians(30.0f), glm::vec3(1.0f, 1.0f, 0.0f));
-    // auto view = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f));
-    // auto projection = glm::perspective(glm::radians(30.0f), (float)WINDOW_WIDTH/(float)WINDOW_HEIGHT, 0.01f, 10.0f);
-
-    // auto transform = projection * view * model;
-
-    // // auto transformLoc = glGetUniformLocation(m_program->Get(), "transform");
-    // // glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(transform));
-    // m_program->SetUniform("transform", transform);
-*/
-
-    return true;
+void RenderThread::FreeDrawLists(Frame& frame) {
+    for (auto drawList: frame.drawLists)
+        IM_DELETE(drawList);
+    frame.drawLists.clear();
 }
 
 
@@ -1194,97 +710,281 @@ int main(int argc, const char** argv) {
     // 시작을 알리는 로그
     SPDLOG_INFO("Start program");
 
-    // glfw 라이브러리 초기화, 실패하면 에러 출력후 종료
-    SPDLOG_INFO("Initialize glfw");
-    if (!glfwInit()) {
-        const char* description = nullptr;
-        glfwGetError(&description);
-        SPDLOG_ERROR("failed to initialize glfw: {}", description);
+    // --trace <file> captures the startup, --trace-frames <n> the first
+    // n frames after it as well. --headless renders without a window or
+    // a display, --size <w>x<h> sets the frame size and --frames <n>
+    // stops after n frames, headless runs default to one. --benchmark
+    // times 600 frames after --warmup <n>, 60 by default, with vsync off
+    // and prints a json report, --cubes <n> sets the cube count.
+    // --golden <dir> renders the golden image scenes and checks them
+    // against the pngs in dir, --golden-update <dir> writes the pngs.
+    // --budget-scale <s> scales their frame time budgets for slower gpus.
+    // --model <file> loads another model than ./model/backpack.obj.
+    // --max-fps <n> throttles rendering, the simulation keeps its rate.
+    // a window is drawn on a render thread unless --single-thread, the
+    // other modes render on the main thread
+    std::string traceFilename;
+    int traceFrames = 0;
+    bool headless = false;
+    int width = WINDOW_WIDTH;
+    int height = WINDOW_HEIGHT;
+    int frameCount = -1;
+    bool benchmark = false;
+    int warmupFrames = 60;
+    int cubeCount = -1;
+    std::string goldenDirectory;
+    bool goldenUpdate = false;
+    float budgetScale = 1.0f;
+    std::string modelFilename = "./model/backpack.obj";
+    int maxFps = 0;
+    bool singleThread = false;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--trace") == 0 && hasValue)
+            traceFilename = argv[++i];
+        else if (strcmp(argv[i], "--trace-frames") == 0 && hasValue)
+            traceFrames = std::max(atoi(argv[++i]), 0);
+        else if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if (strcmp(argv[i], "--size") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                SPDLOG_ERROR("invalid size: {}", argv[i]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && hasValue)
+            frameCount = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--benchmark") == 0)
+            benchmark = true;
+        else if (strcmp(argv[i], "--warmup") == 0 && hasValue)
+            warmupFrames = std::max(atoi(argv[++i]), 0);
+        else if (strcmp(argv[i], "--cubes") == 0 && hasValue)
+            cubeCount = std::max(atoi(argv[++i]), 0);
+        else if (strcmp(argv[i], "--golden") == 0 && hasValue)
+            goldenDirectory = argv[++i];
+        else if (strcmp(argv[i], "--golden-update") == 0 && hasValue) {
+            goldenDirectory = argv[++i];
+            goldenUpdate = true;
+        }
+        else if (strcmp(argv[i], "--budget-scale") == 0 && hasValue)
+            budgetScale = std::max((float)atof(argv[++i]), 0.0f);
+        else if (strcmp(argv[i], "--model") == 0 && hasValue)
+            modelFilename = argv[++i];
+        else if (strcmp(argv[i], "--max-fps") == 0 && hasValue)
+            maxFps = std::max(atoi(argv[++i]), 0);
+        else if (strcmp(argv[i], "--single-thread") == 0)
+            singleThread = true;
+    }
+    bool golden = !goldenDirectory.empty();
+    // the golden scenes are only comparable with the model they were
+    // rendered with, a missing one is an error of its own
+    if (golden && !std::ifstream(modelFilename)) {
+        SPDLOG_ERROR("golden images need the scene model {}, pass it with --model <file>",
+            modelFilename);
         return -1;
     }
+    if (benchmark && frameCount < 0)
+        frameCount = 600;
+    if (headless && frameCount < 0)
+        frameCount = 1;
+    if (!traceFilename.empty())
+        TraceCapture::Start(traceFilename, traceFrames);
+
+    GLFWwindow* window = nullptr;
+    OffscreenContextUPtr offscreen;
+    if (headless) {
+        SPDLOG_INFO("Create offscreen context");
+        offscreen = OffscreenContext::Create(width, height);
+        if (!offscreen) {
+            SPDLOG_ERROR("failed to create offscreen context");
+            return -1;
+        }
+    }
+    else {
+        // glfw 라이브러리 초기화, 실패하면 에러 출력후 종료
+        SPDLOG_INFO("Initialize glfw");
+        if (!glfwInit()) {
+            const char* description = nullptr;
+            glfwGetError(&description);
+            SPDLOG_ERROR("failed to initialize glfw: {}", description);
+            return -1;
+        }
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-    // glfw 윈도우 생성, 실패하면 에러 출력후 종료
-    SPDLOG_INFO("Create glfw window");
-    auto window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_NAME,
-      nullptr, nullptr);
-    
-    // GLFW to make the window the current context
-	glfwMakeContextCurrent(window);
+        // glfw 윈도우 생성, 실패하면 에러 출력후 종료
+        SPDLOG_INFO("Create glfw window");
+        window = glfwCreateWindow(width, height, WINDOW_NAME,
+          nullptr, nullptr);
 
-    if (!window) {
-        SPDLOG_ERROR("failed to create glfw window");
-        glfwTerminate();
-        return -1;
-    }
+        if (!window) {
+            SPDLOG_ERROR("failed to create glfw window");
+            glfwTerminate();
+            return -1;
+        }
 
-    // glad를 활용한 OpenGL 함수 로딩
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-		std::cout << "Couldn't load opengl" << std::endl;
-        SPDLOG_ERROR("failed to initialize glad");
-		glfwTerminate();
-		return -1;
-	}
+        // GLFW to make the window the current context
+        glfwMakeContextCurrent(window);
+        if (benchmark || golden)
+            glfwSwapInterval(0);
+
+        // glad를 활용한 OpenGL 함수 로딩
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+            std::cout << "Couldn't load opengl" << std::endl;
+            SPDLOG_ERROR("failed to initialize glad");
+            glfwTerminate();
+            return -1;
+        }
+    }
 
     auto glVersion = reinterpret_cast<const char*>(glGetString(GL_VERSION));
     SPDLOG_INFO("OpenGL context version: {}", glVersion);
 
+    // without a window imgui gets the display size and time step from us
     auto imguiContext = ImGui::CreateContext();
     ImGui::SetCurrentContext(imguiContext);
-    ImGui_ImplGlfw_InitForOpenGL(window, false);
+    if (window)
+        ImGui_ImplGlfw_InitForOpenGL(window, false);
     ImGui_ImplOpenGL3_Init();
     ImGui_ImplOpenGL3_CreateFontsTexture();
     ImGui_ImplOpenGL3_CreateDeviceObjects();
 
 
-    auto context = Context::Create();
+    auto context = Context::Create(modelFilename);
     if (!context) {
         SPDLOG_ERROR("failed to create context");
-        glfwTerminate();
+        TraceCapture::Stop();
+        if (window)
+            glfwTerminate();
         return -1;
     }
 
-    glfwSetWindowUserPointer(window, context.get());
-    OnFramebufferSizeChange(window, WINDOW_WIDTH, WINDOW_HEIGHT);  // reshape()
-    glfwSetFramebufferSizeCallback(window, OnFramebufferSizeChange);
+    if (window) {
+        glfwSetWindowUserPointer(window, context.get());
+        OnFramebufferSizeChange(window, width, height);  // reshape()
+        glfwSetFramebufferSizeCallback(window, OnFramebufferSizeChange);
 
-    glfwSetKeyCallback(window, OnKeyEvent);
+        glfwSetKeyCallback(window, OnKeyEvent);
 
-    glfwSetCharCallback(window, OnCharEvent);
-    glfwSetCursorPosCallback(window, OnCursorPos);
-    glfwSetMouseButtonCallback(window, OnMouseButton);
-    glfwSetScrollCallback(window, OnScroll);
+        glfwSetCharCallback(window, OnCharEvent);
+        glfwSetCursorPosCallback(window, OnCursorPos);
+        glfwSetMouseButtonCallback(window, OnMouseButton);
+        glfwSetScrollCallback(window, OnScroll);
+    }
+    else {
+        context->Reshape(width, height);
+    }
+    if (cubeCount >= 0)
+        context->SetCubeCount(cubeCount);
+    if (traceFrames == 0)
+        TraceCapture::Stop();
+
+    BenchmarkUPtr benchmarkRun;
+    if (benchmark) {
+        benchmarkRun = Benchmark::Create(frameCount, warmupFrames);
+        frameCount = benchmarkRun->GetTotalFrameCount();
+    }
+    GoldenImagesUPtr goldenRun;
+    if (golden) {
+        goldenRun = GoldenImages::Create(goldenDirectory, goldenUpdate, budgetScale);
+        frameCount = goldenRun->GetTotalFrameCount();
+    }
+    // benchmark and golden runs time and read back frames on this thread
+    RenderThreadUPtr renderThread;
+    if (window && !singleThread && !benchmarkRun && !goldenRun)
+        renderThread = RenderThread::Create(window, context.get());
 
  
     // glfw 루프 실행, 윈도우 close 버튼을 누르면 정상 종료
     SPDLOG_INFO("Start main loop");
 
-    while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
-
-        ImGui_ImplGlfw_NewFrame();  //
+    double lastTime = GetTime();
+    Context::FrameState frameState;
+    for (int frame = 0; frameCount < 0 || frame < frameCount; frame++) {
+        double frameStart = GetTime();
+        if (window) {
+            if (glfwWindowShouldClose(window))
+                break;
+            glfwPollEvents();
+            ImGui_ImplGlfw_NewFrame();  //
+        }
+        else {
+            double time = GetTime();
+            auto& io = ImGui::GetIO();
+            io.DisplaySize = ImVec2((float)width, (float)height);
+            io.DeltaTime = std::max((float)(time - lastTime), 1e-4f);
+            lastTime = time;
+        }
         ImGui::NewFrame();
 
-        context->ProcessInput(window);
-        context->Render();
-
+        if (benchmarkRun)
+            benchmarkRun->BeginFrame(context.get(), frame);
+        else if (goldenRun)
+            goldenRun->BeginFrame(context.get(), frame);
+        else if (window)
+            context->ProcessInput(window);
+        context->Update(frameState);
         ImGui::Render();    //
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
-		glfwSwapBuffers(window);
+        if (renderThread) {
+            TRACE_SCOPE("wait for render thread");
+            renderThread->Submit(frameState, ImGui::GetDrawData());
+        }
+        else {
+            context->Render(frameState);
+            if (goldenRun)
+                goldenRun->EndFrame(context.get(), frame, width, height);
+
+            // golden images are compared without the ui
+            if (!goldenRun) {
+                TRACE_SCOPE("ui render");
+                ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            }
+
+            if (window) {
+                TRACE_SCOPE("glfwSwapBuffers");
+                glfwSwapBuffers(window);
+            }
+            else {
+                // the frame is done when the gpu is, as a swap would wait
+                TRACE_SCOPE("glFinish");
+                glFinish();
+            }
+        }
+        if (benchmarkRun)
+            benchmarkRun->EndFrame(frame);
+        TraceCapture::EndFrame();
+
+        if (maxFps > 0) {
+            double waitTime = frameStart + 1.0 / maxFps - GetTime();
+            if (waitTime > 0.0)
+                std::this_thread::sleep_for(std::chrono::duration<double>(waitTime));
+        }
         
     }
+    renderThread.reset();
 
+    if (benchmarkRun) {
+        benchmarkRun->WriteReport(context.get(), std::cout, width, height);
+        benchmarkRun.reset();
+    }
+    bool passed = true;
+    if (goldenRun) {
+        passed = goldenRun->WriteReport(std::cout);
+        goldenRun.reset();
+    }
     context.reset();
 
     ImGui_ImplOpenGL3_DestroyFontsTexture();    //
     ImGui_ImplOpenGL3_DestroyDeviceObjects();
-    ImGui_ImplGlfw_Shutdown();
+    if (window)
+        ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext(imguiContext);
 
-    glfwTerminate();
-    return 0;
-}
\ No newline at end of file
+    offscreen.reset();
+    if (window)
+        glfwTerminate();
+    return passed ? 0 : 1;
+}
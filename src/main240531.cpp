@@ -148,6 +148,7 @@ public:
 
     void SetUniform(const std::string& name, int value) const;
     void SetUniform(const std::string& name, const glm::mat4& value) const;
+    void SetUniform(const std::string& name, const glm::mat3& value) const;
     
     void SetUniform(const std::string& name, float value) const;
     void SetUniform(const std::string& name, const glm::vec2& value) const;
@@ -214,6 +215,11 @@ void Program::SetUniform(const std::string& name, const glm::mat4& value) const
     glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(value));
 }
 
+void Program::SetUniform(const std::string& name, const glm::mat3& value) const {
+    auto loc = glGetUniformLocation(m_program, name.c_str());
+    glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(value));
+}
+
 void Program::SetUniform(const std::string& name, float value) const {
     auto loc = glGetUniformLocation(m_program, name.c_str());
     glUniform1f(loc, value);
@@ -911,6 +917,7 @@ void Context::Render() {
 
     m_program->SetUniform("transform", projection * view * lightModelTransform);
     m_program->SetUniform("modelTransform", lightModelTransform);
+    m_program->SetUniform("normalTransform", glm::transpose(glm::inverse(glm::mat3(lightModelTransform))));
 */    
     m_simpleProgram->SetUniform("color", glm::vec4(m_light.ambient + m_light.diffuse, 1.0f));
     m_simpleProgram->SetUniform("transform", projection * view * lightModelTransform);
@@ -962,6 +969,7 @@ void Context::Render() {
         auto transform = projection * view * model;
         m_program->SetUniform("transform", transform);
         m_program->SetUniform("modelTransform", model);
+        m_program->SetUniform("normalTransform", glm::transpose(glm::inverse(glm::mat3(model))));
         
         // glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
         m_box->Draw();
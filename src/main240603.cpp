@@ -153,6 +153,7 @@ public:
 
     void SetUniform(const std::string& name, int value) const;
     void SetUniform(const std::string& name, const glm::mat4& value) const;
+    void SetUniform(const std::string& name, const glm::mat3& value) const;
     
     void SetUniform(const std::string& name, float value) const;
     void SetUniform(const std::string& name, const glm::vec2& value) const;
@@ -219,6 +220,11 @@ void Program::SetUniform(const std::string& name, const glm::mat4& value) const
     glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(value));
 }
 
+void Program::SetUniform(const std::string& name, const glm::mat3& value) const {
+    auto loc = glGetUniformLocation(m_program, name.c_str());
+    glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(value));
+}
+
 void Program::SetUniform(const std::string& name, float value) const {
     auto loc = glGetUniformLocation(m_program, name.c_str());
     glUniform1f(loc, value);
@@ -1032,6 +1038,7 @@ void Context::Render() {
     auto transform = projection * view * modelTransform;
     m_program->SetUniform("transform", transform);
     m_program->SetUniform("modelTransform", modelTransform);
+    m_program->SetUniform("normalTransform", glm::transpose(glm::inverse(glm::mat3(modelTransform))));
     // m_model->Draw(m_program.get());
     m_model->Draw();
 
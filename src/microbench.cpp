@@ -0,0 +1,276 @@
+#include "engine.h"
+
+#include <stb/stb_image_write.h>
+
+#include <cstdio>
+
+
+
+// microbenchmarks of the engine's cpu paths, each over a few input sizes.
+// every size runs in batches that grow until one takes --min-time ms and
+// the best of five such batches is reported
+struct BenchResult {
+    std::string name;
+    size_t size;
+    double nsPerOp;
+    size_t itemsPerOp;
+};
+
+using Clock = std::chrono::steady_clock;
+
+// keeps results alive so the timed work is not optimized away
+static volatile float s_sink { 0.0f };
+
+template <typename Func>
+double MeasureNs(Func&& func, double minTime) {
+    size_t iterations = 1;
+    double best = DBL_MAX;
+    int rounds = 0;
+    while (rounds < 5) {
+        auto start = Clock::now();
+        for (size_t i = 0; i < iterations; i++)
+            func();
+        double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (elapsed < minTime) {
+            iterations *= 2;
+            continue;
+        }
+        best = std::min(best, elapsed * 1e6 / (double)iterations);
+        rounds++;
+    }
+    return best;
+}
+
+// a grid of vertexCount vertices with two triangles per cell, laid out
+// the way assimp hands over a triangulated mesh
+static std::unique_ptr<aiMesh> CreateGridMesh(size_t vertexCount) {
+    auto side = (uint32_t)ceilf(sqrtf((float)vertexCount));
+    auto mesh = std::make_unique<aiMesh>();
+    mesh->mNumVertices = side * side;
+    mesh->mVertices = new aiVector3D[mesh->mNumVertices];
+    mesh->mNormals = new aiVector3D[mesh->mNumVertices];
+    mesh->mTextureCoords[0] = new aiVector3D[mesh->mNumVertices];
+    for (uint32_t y = 0; y < side; y++) {
+        for (uint32_t x = 0; x < side; x++) {
+            uint32_t i = y * side + x;
+            float u = (float)x / (float)(side - 1);
+            float v = (float)y / (float)(side - 1);
+            mesh->mVertices[i] = aiVector3D(u - 0.5f, 0.1f * sinf(u * 20.0f), v - 0.5f);
+            mesh->mNormals[i] = aiVector3D(0.0f, 1.0f, 0.0f);
+            mesh->mTextureCoords[0][i] = aiVector3D(u, v, 0.0f);
+        }
+    }
+    mesh->mNumFaces = 2 * (side - 1) * (side - 1);
+    mesh->mFaces = new aiFace[mesh->mNumFaces];
+    uint32_t face = 0;
+    for (uint32_t y = 0; y + 1 < side; y++) {
+        for (uint32_t x = 0; x + 1 < side; x++) {
+            uint32_t i = y * side + x;
+            uint32_t corners[2][3] = { { i, i + side, i + 1 }, { i + 1, i + side, i + side + 1 } };
+            for (auto& corner: corners) {
+                auto& f = mesh->mFaces[face++];
+                f.mNumIndices = 3;
+                f.mIndices = new unsigned int[3] { corner[0], corner[1], corner[2] };
+            }
+        }
+    }
+    return mesh;
+}
+
+static void BenchProcessMesh(std::vector<BenchResult>& results, double minTime) {
+    for (size_t size: { 1024, 16384, 262144 }) {
+        auto mesh = CreateGridMesh(size);
+        std::vector<Vertex> vertices(mesh->mNumVertices);
+        std::vector<uint32_t> indices(mesh->mNumFaces * 3);
+        double ns = MeasureNs([&]() {
+            ConvertMesh(mesh.get(), vertices.data(), indices.data());
+            auto box = ComputeBoundingBox(vertices);
+            auto sphere = ComputeBoundingSphere(vertices, box);
+            s_sink = s_sink + sphere.radius;
+        }, minTime);
+        results.push_back({ "Model::ProcessMesh", size, ns, mesh->mNumVertices });
+    }
+}
+
+static void BenchLoadWithStb(std::vector<BenchResult>& results, double minTime) {
+    // a checker with a gradient, so the png does not compress to nothing
+    auto filename = fmt::format("microbench-{}.png", (int)(GetTime() * 1e6));
+    for (int size: { 64, 256, 1024 }) {
+        std::vector<uint8_t> pixels((size_t)size * size * 4);
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                uint8_t* p = &pixels[((size_t)y * size + x) * 4];
+                uint8_t check = ((x / 8 + y / 8) % 2) ? 255 : 0;
+                p[0] = check;
+                p[1] = (uint8_t)(x * 255 / size);
+                p[2] = (uint8_t)(y * 255 / size);
+                p[3] = 255;
+            }
+        }
+        if (!stbi_write_png(filename.c_str(), size, size, 4, pixels.data(), size * 4)) {
+            SPDLOG_ERROR("failed to write {}", filename);
+            return;
+        }
+        double ns = MeasureNs([&]() {
+            auto image = Image::Load(filename);
+            s_sink = s_sink + (float)image->GetData()[0];
+        }, minTime);
+        results.push_back({ "Image::LoadWithStb", (size_t)size, ns, (size_t)size * size });
+    }
+    remove(filename.c_str());
+}
+
+static void BenchSetCheckImage(std::vector<BenchResult>& results, double minTime) {
+    for (int size: { 64, 256, 1024, 4096 }) {
+        auto image = Image::Create(size, size);
+        double ns = MeasureNs([&]() {
+            image->SetCheckImage(16, 16);
+            s_sink = s_sink + (float)image->GetData()[0];
+        }, minTime);
+        results.push_back({ "Image::SetCheckImage", (size_t)size, ns, (size_t)size * size });
+    }
+}
+
+static void BenchCreateSingleColorImage(std::vector<BenchResult>& results, double minTime) {
+    for (int size: { 64, 256, 1024, 4096 }) {
+        double ns = MeasureNs([&]() {
+            auto image = Image::CreateSingleColorImage(size, size,
+                glm::vec4(0.2f, 0.4f, 0.6f, 1.0f));
+            s_sink = s_sink + (float)image->GetData()[0];
+        }, minTime);
+        results.push_back({ "Image::CreateSingleColorImage", (size_t)size, ns, (size_t)size * size });
+    }
+}
+
+static void BenchAttenuationCoeff(std::vector<BenchResult>& results, double minTime) {
+    // distances spread over the range of the ui's light distance
+    for (size_t size: { 16, 1024, 65536 }) {
+        std::vector<float> distances(size);
+        for (size_t i = 0; i < size; i++)
+            distances[i] = 1.0f + 999.0f * (float)i / (float)size;
+        double ns = MeasureNs([&]() {
+            float sum = 0.0f;
+            for (auto distance: distances)
+                sum += GetAttenuationCoeff(distance).z;
+            s_sink = s_sink + sum;
+        }, minTime);
+        results.push_back({ "GetAttenuationCoeff", size, ns, size });
+    }
+}
+
+static void BenchMatrixSetup(std::vector<BenchResult>& results, double minTime) {
+    // the camera matrices of Context::Render, then the cube field's
+    // model and mvp matrices
+    float yaw = 30.0f, pitch = -10.0f;
+    auto position = glm::vec3(0.0f, 0.0f, 7.0f);
+    glm::mat4 viewProjection;
+    auto cameraSetup = [&]() {
+        auto front =
+            glm::rotate(glm::mat4(1.0f), glm::radians(yaw), glm::vec3(0.0f, 1.0f, 0.0f)) *
+            glm::rotate(glm::mat4(1.0f), glm::radians(pitch), glm::vec3(1.0f, 0.0f, 0.0f)) *
+            glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+        auto view = glm::lookAt(position, position + glm::vec3(front),
+            glm::vec3(0.0f, 1.0f, 0.0f));
+        auto projection = glm::perspective(glm::radians(30.0f), 640.0f / 480.0f, 0.01f, 20.0f);
+        viewProjection = projection * view;
+    };
+    double ns = MeasureNs([&]() {
+        cameraSetup();
+        s_sink = s_sink + viewProjection[0][0];
+    }, minTime);
+    results.push_back({ "camera matrices", 1, ns, 1 });
+
+    auto axis = glm::normalize(glm::vec3(1.0f, 0.5f, 0.0f));
+    for (size_t size: { 1024, 16384, 262144 }) {
+        TransformSoA transforms;
+        transforms.Resize(size);
+        int side = (int)ceilf(sqrtf((float)size));
+        for (size_t i = 0; i < size; i++) {
+            transforms.Set(i, glm::vec3((float)(i % side) * 2.0f, -2.0f, -(float)(i / side) * 2.0f),
+                glm::angleAxis(glm::radians(20.0f * (float)i), axis));
+        }
+        std::vector<glm::mat4> models(size), mvps(size);
+        double ns = MeasureNs([&]() {
+            cameraSetup();
+            ComputeTransforms(transforms, viewProjection, 0, size,
+                models.data(), sizeof(glm::mat4), mvps.data(), sizeof(glm::mat4));
+            s_sink = s_sink + mvps[size - 1][3][3];
+        }, minTime);
+        results.push_back({ "ComputeTransforms", size, ns, size });
+    }
+}
+
+static void BenchJobSystem(std::vector<BenchResult>& results, double minTime) {
+    // the scheduling cost of a batch of empty jobs
+    auto jobSystem = JobSystem::Get();
+    std::atomic<int> done { 0 };
+    for (size_t size: { 1, 64, 4096 }) {
+        double ns = MeasureNs([&]() {
+            JobCounter counter;
+            for (size_t i = 0; i < size; i++)
+                jobSystem->Run([&]() { done.fetch_add(1, std::memory_order_relaxed); }, &counter);
+            jobSystem->Wait(counter);
+        }, minTime);
+        results.push_back({ "JobSystem::Run", size, ns, size });
+    }
+    s_sink = s_sink + (float)done.load();
+}
+
+
+
+int main(int argc, const char** argv) {
+    // --filter <text> runs the benchmarks whose name contains text,
+    // --min-time <ms> is the shortest timed batch, 50 by default, and
+    // --json prints a json report instead of the table
+    std::string filter;
+    double minTime = 50.0;
+    bool json = false;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--filter") == 0 && hasValue)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "--min-time") == 0 && hasValue)
+            minTime = std::max(atof(argv[++i]), 1.0);
+        else if (strcmp(argv[i], "--json") == 0)
+            json = true;
+    }
+
+    using BenchFunc = void (*)(std::vector<BenchResult>&, double);
+    const std::pair<const char*, BenchFunc> benches[] = {
+        { "Model::ProcessMesh", BenchProcessMesh },
+        { "Image::LoadWithStb", BenchLoadWithStb },
+        { "Image::SetCheckImage", BenchSetCheckImage },
+        { "Image::CreateSingleColorImage", BenchCreateSingleColorImage },
+        { "GetAttenuationCoeff", BenchAttenuationCoeff },
+        { "matrix setup", BenchMatrixSetup },
+        { "JobSystem::Run", BenchJobSystem },
+    };
+    std::vector<BenchResult> results;
+    for (auto& bench: benches) {
+        if (!filter.empty() && std::string(bench.first).find(filter) == std::string::npos)
+            continue;
+        size_t first = results.size();
+        bench.second(results, minTime);
+        if (json)
+            continue;
+        for (size_t i = first; i < results.size(); i++) {
+            auto& result = results[i];
+            std::cout << fmt::format("{:<32}{:>8}{:>14.1f} ns{:>12.2f} M items/s",
+                result.name, result.size, result.nsPerOp,
+                (double)result.itemsPerOp / result.nsPerOp * 1e3) << std::endl;
+        }
+    }
+
+    if (json) {
+        std::cout << "[";
+        for (size_t i = 0; i < results.size(); i++) {
+            auto& result = results[i];
+            std::cout << (i ? ",\n  " : "\n  ");
+            std::cout << fmt::format(
+                "{{\"name\": \"{}\", \"size\": {}, \"ns\": {:.1f}, \"items\": {}}}",
+                result.name, result.size, result.nsPerOp, result.itemsPerOp);
+        }
+        std::cout << (results.empty() ? "]" : "\n]") << std::endl;
+    }
+    return 0;
+}